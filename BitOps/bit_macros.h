@@ -49,6 +49,29 @@
  */
 #define TOGGLE_BIT(VALUE, BIT_POS) ((VALUE) ^= BIT(BIT_POS))
 
+/**
+ * @brief Finds the lowest set bit in a value (a single bit-scan instruction with GCC).
+ * @param VALUE The value to scan. Must not be zero.
+ * @return The 0-indexed position of the least significant set bit.
+ */
+#if defined(__GNUC__)
+#define LOWEST_SET_BIT(VALUE) ((uint8_t)__builtin_ctz((uint32_t)(VALUE)))
+#else
+static inline uint8_t lowest_set_bit(uint32_t value)
+{
+	uint8_t bit_pos = 0;
+
+	while (!(value & 1U))
+	{
+		value >>= 1;
+		bit_pos++;
+	}
+
+	return bit_pos;
+}
+#define LOWEST_SET_BIT(VALUE) (lowest_set_bit((uint32_t)(VALUE)))
+#endif
+
 
 // --- Bitfield Extraction and Insertion ---
 
@@ -0,0 +1,1099 @@
+/*
+ * cartridge.c
+ *
+ * Cartridge loading and MBC1/MBC3/MBC5 banking.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "..\headers\mystdbool.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "cartridge.h"
+#include "mmu.h"
+#include "cpu.h"
+#include "gb.h"
+
+#if CARTRIDGE_MMAP_SUPPORTED
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if CARTRIDGE_SAVE_LOCK_SUPPORTED
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
+// ----------------------------------------------------------------------
+// Header Decoding
+// ----------------------------------------------------------------------
+static void cartridge_decode_type(cartridge_header_t *header)
+{
+	header->mbc_supported = myTrue;
+
+	switch (header->type)
+	{
+		case 0x00:											// ROM only
+		case 0x08: case 0x09:								// ROM + RAM (+ battery)
+			header->mbc = CARTRIDGE_MBC_NONE;
+			break;
+
+		case 0x01: case 0x02: case 0x03:					// MBC1 (+ RAM, + battery)
+			header->mbc = CARTRIDGE_MBC1;
+			break;
+
+		case 0x0F: case 0x10:								// MBC3 + timer (+ RAM) + battery
+			header->has_rtc = myTrue;
+			header->mbc = CARTRIDGE_MBC3;
+			break;
+
+		case 0x11: case 0x12: case 0x13:					// MBC3 (+ RAM, + battery)
+			header->mbc = CARTRIDGE_MBC3;
+			break;
+
+		case 0x1C: case 0x1D: case 0x1E:					// MBC5 + rumble (+ RAM, + battery)
+			header->has_rumble = myTrue;
+			header->mbc = CARTRIDGE_MBC5;
+			break;
+
+		case 0x19: case 0x1A: case 0x1B:					// MBC5 (+ RAM, + battery)
+			header->mbc = CARTRIDGE_MBC5;
+			break;
+
+		default:
+			header->mbc = CARTRIDGE_MBC_NONE;
+			header->mbc_supported = myFalse;
+			break;
+	}
+
+	switch (header->type)
+	{
+		case 0x03: case 0x09: case 0x0F: case 0x10: case 0x13: case 0x1B: case 0x1E:
+			header->has_battery = myTrue;
+			break;
+
+		default:
+			break;
+	}
+}
+
+static uint32_t cartridge_ram_size_from_header(uint8_t code)
+{
+	switch (code)
+	{
+		case 0x01: return 0x0800;		// 2 KiB (unofficial)
+		case 0x02: return 0x2000;		// 8 KiB
+		case 0x03: return 0x8000;		// 32 KiB, 4 banks
+		case 0x04: return 0x20000;		// 128 KiB, 16 banks
+		case 0x05: return 0x10000;		// 64 KiB, 8 banks
+		default:   return 0;
+	}
+}
+
+// 32 KiB << code, or 0 for codes no cartridge uses.
+static uint32_t cartridge_rom_size_from_header(uint8_t code)
+{
+	return (code <= 0x08) ? ((uint32_t)CARTRIDGE_MIN_ROM_SIZE << code) : 0;
+}
+
+// ----------------------------------------------------------------------
+// Bank Selection
+// ----------------------------------------------------------------------
+
+// Bank mapped at 0x0000-0x3FFF. Only MBC1 in mode 1 moves it.
+static uint16_t cartridge_low_rom_bank(const cartridge_t *cartridge, const cartridge_registers_t *registers)
+{
+	if (cartridge->mbc == CARTRIDGE_MBC1 && registers->mbc1_mode)
+	{
+		return (uint16_t)((registers->ram_bank_register << 5) % cartridge->rom_bank_count);
+	}
+
+	return 0;
+}
+
+// Bank mapped at 0x4000-0x7FFF.
+static uint16_t cartridge_high_rom_bank(const cartridge_t *cartridge, const cartridge_registers_t *registers)
+{
+	uint16_t bank;
+
+	switch (cartridge->mbc)
+	{
+		case CARTRIDGE_MBC1:
+			// A 0 in the low five bits reads as 1 (so 0x20/0x40/0x60 give 0x21/0x41/0x61).
+			bank = registers->rom_bank_register & 0x1F;
+			if (bank == 0)
+			{
+				bank = 1;
+			}
+			bank |= (uint16_t)(registers->ram_bank_register << 5);
+			break;
+
+		case CARTRIDGE_MBC3:
+			bank = registers->rom_bank_register & 0x7F;
+			if (bank == 0)
+			{
+				bank = 1;
+			}
+			break;
+
+		case CARTRIDGE_MBC5:
+			bank = registers->rom_bank_register & 0x1FF;	// Bank 0 is allowed here
+			break;
+
+		default:
+			bank = 1;
+			break;
+	}
+
+	return (uint16_t)(bank % cartridge->rom_bank_count);
+}
+
+// RAM bank mapped at 0xA000-0xBFFF, or -1 when the window is not plain RAM.
+static int cartridge_ram_bank(const cartridge_t *cartridge, const cartridge_registers_t *registers)
+{
+	uint8_t bank;
+
+	if (cartridge->ram_size == 0 || !registers->ram_enabled)
+	{
+		return -1;
+	}
+
+	switch (cartridge->mbc)
+	{
+		case CARTRIDGE_MBC1:
+			bank = registers->mbc1_mode ? (registers->ram_bank_register & 0x03) : 0;
+			break;
+
+		case CARTRIDGE_MBC3:
+			if (registers->ram_bank_register >= CARTRIDGE_RTC_SECONDS)
+			{
+				return -1;
+			}
+			bank = registers->ram_bank_register & 0x03;
+			break;
+
+		case CARTRIDGE_MBC5:
+			// On rumble carts bit 3 drives the motor instead.
+			bank = registers->ram_bank_register & (cartridge->has_rumble ? 0x07 : 0x0F);
+			break;
+
+		default:
+			bank = 0;
+			break;
+	}
+
+	return bank % cartridge->ram_bank_count;
+}
+
+void cartridge_map(gb_t *gb)
+{
+	const cartridge_t *cartridge = &gb->cartridge;
+	const cartridge_registers_t *registers = &gb->cartridge_registers;
+	int ram_bank;
+
+	if (cartridge->rom == NULL)
+	{
+		// No cartridge: the whole range reads back as open bus (0xFF).
+		mmu_map_pages(gb, MMU_ADDRESS_ROM_BANK_00_START, MMU_ADDRESS_ROM_BANK_END, NULL, NULL);
+		mmu_map_pages(gb, MMU_ADDRESS_EXTERNAL_RAM_START, MMU_ADDRESS_EXTERNAL_RAM_END, NULL, NULL);
+		gb->mmu_rom_bank_number = 1;
+		return;
+	}
+
+	gb->mmu_rom_bank_number = cartridge_high_rom_bank(cartridge, registers);
+
+	// ROM writes always go to the MBC, so the write pointers stay NULL.
+	mmu_map_pages(gb, MMU_ADDRESS_ROM_BANK_00_START, MMU_ADDRESS_ROM_BANK_00_END,
+				  cartridge->rom + (uint32_t)cartridge_low_rom_bank(cartridge, registers) * CARTRIDGE_ROM_BANK_SIZE, NULL);
+	mmu_map_pages(gb, MMU_ADDRESS_ROM_BANK_01_NN_START, MMU_ADDRESS_ROM_BANK_01_NN_END,
+				  cartridge->rom + (uint32_t)gb->mmu_rom_bank_number * CARTRIDGE_ROM_BANK_SIZE, NULL);
+
+	ram_bank = cartridge_ram_bank(cartridge, registers);
+
+	if (ram_bank >= 0)
+	{
+		uint8_t *bank_base = gb->external_ram + (uint32_t)ram_bank * CARTRIDGE_RAM_BANK_SIZE;
+		mmu_map_pages(gb, MMU_ADDRESS_EXTERNAL_RAM_START, MMU_ADDRESS_EXTERNAL_RAM_END, bank_base, bank_base);
+	}
+	else
+	{
+		mmu_map_pages(gb, MMU_ADDRESS_EXTERNAL_RAM_START, MMU_ADDRESS_EXTERNAL_RAM_END, NULL, NULL);
+	}
+}
+
+// ----------------------------------------------------------------------
+// MBC3 Clock
+// ----------------------------------------------------------------------
+static uint32_t cartridge_rtc_seconds(cartridge_registers_t *registers)
+{
+	int64_t seconds;
+
+	if (registers->rtc_halted)
+	{
+		return registers->rtc_halted_seconds;
+	}
+
+	seconds = (int64_t)time(NULL) - registers->rtc_base_time;
+
+	// The day counter wraps after 511 days and leaves the carry set.
+	if (seconds >= (int64_t)CARTRIDGE_RTC_DAY_LIMIT * 86400)
+	{
+		registers->rtc_day_carry = myTrue;
+		seconds %= (int64_t)CARTRIDGE_RTC_DAY_LIMIT * 86400;
+		registers->rtc_base_time = (int64_t)time(NULL) - seconds;
+	}
+
+	return (uint32_t)seconds;
+}
+
+static void cartridge_rtc_set_seconds(cartridge_registers_t *registers, uint32_t seconds)
+{
+	if (registers->rtc_halted)
+	{
+		registers->rtc_halted_seconds = seconds;
+	}
+	else
+	{
+		registers->rtc_base_time = (int64_t)time(NULL) - seconds;
+	}
+}
+
+static void cartridge_rtc_latch(cartridge_registers_t *registers)
+{
+	uint32_t seconds = cartridge_rtc_seconds(registers);
+	uint16_t days = (uint16_t)(seconds / 86400);
+
+	registers->rtc_latched[0] = (uint8_t)(seconds % 60);
+	registers->rtc_latched[1] = (uint8_t)((seconds / 60) % 60);
+	registers->rtc_latched[2] = (uint8_t)((seconds / 3600) % 24);
+	registers->rtc_latched[3] = (uint8_t)days;
+	registers->rtc_latched[4] = (uint8_t)((days >> 8) & 0x01)
+								| (registers->rtc_halted ? CARTRIDGE_RTC_DAYS_HIGH_HALT : 0x00)
+								| (registers->rtc_day_carry ? CARTRIDGE_RTC_DAYS_HIGH_CARRY : 0x00);
+}
+
+static void cartridge_rtc_write(cartridge_registers_t *registers, uint8_t reg, uint8_t value)
+{
+	uint32_t seconds = cartridge_rtc_seconds(registers);
+	uint32_t second = seconds % 60;
+	uint32_t minute = (seconds / 60) % 60;
+	uint32_t hour = (seconds / 3600) % 24;
+	uint32_t day = seconds / 86400;
+
+	switch (reg)
+	{
+		case CARTRIDGE_RTC_SECONDS:		second = (value & 0x3F) % 60;						break;
+		case CARTRIDGE_RTC_MINUTES:		minute = (value & 0x3F) % 60;						break;
+		case CARTRIDGE_RTC_HOURS:		hour = (value & 0x1F) % 24;							break;
+		case CARTRIDGE_RTC_DAYS_LOW:	day = (day & 0x100) | value;						break;
+		case CARTRIDGE_RTC_DAYS_HIGH:
+			day = (day & 0xFF) | ((uint32_t)(value & 0x01) << 8);
+			registers->rtc_day_carry = (value & CARTRIDGE_RTC_DAYS_HIGH_CARRY) ? myTrue : myFalse;
+
+			// Halting freezes the count where it is; resuming restarts it from there.
+			if (!registers->rtc_halted && (value & CARTRIDGE_RTC_DAYS_HIGH_HALT))
+			{
+				registers->rtc_halted = myTrue;
+			}
+			else if (registers->rtc_halted && !(value & CARTRIDGE_RTC_DAYS_HIGH_HALT))
+			{
+				registers->rtc_halted = myFalse;
+			}
+			break;
+
+		default:
+			return;
+	}
+
+	cartridge_rtc_set_seconds(registers, ((day * 24 + hour) * 60 + minute) * 60 + second);
+}
+
+// ----------------------------------------------------------------------
+// MBC Register Writes
+// ----------------------------------------------------------------------
+void cartridge_write_control(gb_t *gb, uint16_t address, uint8_t value)
+{
+	const cartridge_t *cartridge = &gb->cartridge;
+	cartridge_registers_t *registers = &gb->cartridge_registers;
+	uint16_t low_bank_before;
+
+	if (cartridge->rom == NULL || cartridge->mbc == CARTRIDGE_MBC_NONE)
+	{
+		return;
+	}
+
+	low_bank_before = cartridge_low_rom_bank(cartridge, registers);
+
+	if (address <= CARTRIDGE_RAM_ENABLE_END)
+	{
+		registers->ram_enabled = ((value & 0x0F) == CARTRIDGE_RAM_ENABLE_VALUE) ? myTrue : myFalse;
+	}
+	else if (address <= CARTRIDGE_ROM_BANK_END)
+	{
+		if (cartridge->mbc == CARTRIDGE_MBC5)
+		{
+			if (address <= CARTRIDGE_MBC5_ROM_BANK_LOW_END)
+			{
+				registers->rom_bank_register = (registers->rom_bank_register & 0x100) | value;
+			}
+			else
+			{
+				registers->rom_bank_register = (registers->rom_bank_register & 0x0FF) | ((uint16_t)(value & 0x01) << 8);
+			}
+		}
+		else
+		{
+			registers->rom_bank_register = value;
+		}
+	}
+	else if (address <= CARTRIDGE_RAM_BANK_END)
+	{
+		registers->ram_bank_register = (cartridge->mbc == CARTRIDGE_MBC1) ? (value & 0x03) : value;
+	}
+	else
+	{
+		if (cartridge->mbc == CARTRIDGE_MBC1)
+		{
+			registers->mbc1_mode = value & 0x01;
+		}
+		else if (cartridge->mbc == CARTRIDGE_MBC3 && cartridge->has_rtc)
+		{
+			// Writing 0x00 then 0x01 copies the running clock into the registers.
+			if (registers->rtc_latch_previous == 0x00 && value == 0x01)
+			{
+				cartridge_rtc_latch(registers);
+			}
+			registers->rtc_latch_previous = value;
+		}
+	}
+
+	cartridge_map(gb);
+
+	// Blocks from 0x0000-0x3FFF carry no bank, so they go if that window moved.
+	if (cartridge_low_rom_bank(cartridge, registers) != low_bank_before)
+	{
+		cpu_block_cache_flush(gb);
+	}
+}
+
+// ----------------------------------------------------------------------
+// External RAM Outside the Page Table
+// ----------------------------------------------------------------------
+uint8_t cartridge_read_ram(gb_t *gb, uint16_t address)
+{
+	const cartridge_t *cartridge = &gb->cartridge;
+	const cartridge_registers_t *registers = &gb->cartridge_registers;
+
+	if (cartridge->mbc == CARTRIDGE_MBC3 && cartridge->has_rtc && registers->ram_enabled
+		&& registers->ram_bank_register >= CARTRIDGE_RTC_SECONDS && registers->ram_bank_register <= CARTRIDGE_RTC_DAYS_HIGH)
+	{
+		return registers->rtc_latched[registers->ram_bank_register - CARTRIDGE_RTC_SECONDS];
+	}
+
+	(void)address;
+
+	// Disabled or missing RAM reads as open bus.
+	return 0xFF;
+}
+
+void cartridge_write_ram(gb_t *gb, uint16_t address, uint8_t value)
+{
+	const cartridge_t *cartridge = &gb->cartridge;
+	cartridge_registers_t *registers = &gb->cartridge_registers;
+
+	if (cartridge->mbc == CARTRIDGE_MBC3 && cartridge->has_rtc && registers->ram_enabled)
+	{
+		cartridge_rtc_write(registers, registers->ram_bank_register, value);
+		cartridge_rtc_latch(registers);
+	}
+
+	(void)address;
+}
+
+// ----------------------------------------------------------------------
+// Battery Save
+// cartridge->save is a copy of what the .sav file holds. Flushing
+// compares it with the RAM and only touches the file when they differ.
+// A flush never writes into the save itself: it writes a temporary file
+// and renames it over the save, so whatever kills the process, the file
+// is either the previous flush or the new one, never a mix.
+// ----------------------------------------------------------------------
+
+// path followed by suffix, NULL if out of memory.
+static char *cartridge_path_with_suffix(const char *path, const char *suffix)
+{
+	size_t path_length = strlen(path);
+	size_t suffix_size = strlen(suffix) + 1;
+	char *result = (char *)malloc(path_length + suffix_size);
+
+	if (result != NULL)
+	{
+		memcpy(result, path, path_length);
+		memcpy(result + path_length, suffix, suffix_size);
+	}
+
+	return result;
+}
+
+// The ROM's path with its extension (if any) replaced by CARTRIDGE_SAVE_EXTENSION.
+static char *cartridge_save_path(const char *rom_path)
+{
+	const char *extension = strrchr(rom_path, '.');
+	const char *separator = strrchr(rom_path, '/');
+	const char *backslash = strrchr(rom_path, '\\');
+	size_t stem_length;
+	char *path;
+
+	if (backslash != NULL && (separator == NULL || backslash > separator))
+	{
+		separator = backslash;
+	}
+
+	// A dot in a directory name is not an extension.
+	if (extension == NULL || (separator != NULL && extension < separator))
+	{
+		stem_length = strlen(rom_path);
+	}
+	else
+	{
+		stem_length = (size_t)(extension - rom_path);
+	}
+
+	path = (char *)malloc(stem_length + sizeof(CARTRIDGE_SAVE_EXTENSION));
+	if (path != NULL)
+	{
+		memcpy(path, rom_path, stem_length);
+		memcpy(path + stem_length, CARTRIDGE_SAVE_EXTENSION, sizeof(CARTRIDGE_SAVE_EXTENSION));
+	}
+
+	return path;
+}
+
+#if CARTRIDGE_SAVE_LOCK_SUPPORTED
+// Takes the lock that makes this instance the only one writing the save.
+// It is held on a file of its own: renaming over the save replaces the
+// save's inode, so a lock on the save would not survive the first flush.
+// Returns the descriptor holding it, or -1 if another instance (in this
+// process or another) holds it already or it cannot be taken.
+static int cartridge_save_lock(const char *save_path)
+{
+	char *lock_path = cartridge_path_with_suffix(save_path, CARTRIDGE_SAVE_LOCK_EXTENSION);
+	int file_descriptor = -1;
+
+	if (lock_path != NULL)
+	{
+		file_descriptor = open(lock_path, O_RDWR | O_CREAT, 0644);
+		free(lock_path);
+	}
+
+	if (file_descriptor >= 0 && flock(file_descriptor, LOCK_EX | LOCK_NB) != 0)
+	{
+		close(file_descriptor);
+		file_descriptor = -1;
+	}
+
+	return file_descriptor;
+}
+
+// Makes a rename in the save's directory survive a power cut.
+static void cartridge_save_sync_directory(const char *save_path)
+{
+	const char *separator = strrchr(save_path, '/');
+	char *directory;
+	int file_descriptor;
+
+	if (separator == NULL)
+	{
+		directory = cartridge_path_with_suffix(".", "");
+	}
+	else
+	{
+		directory = (char *)malloc((size_t)(separator - save_path) + 2);
+		if (directory != NULL)
+		{
+			// "/" for a save at the root.
+			size_t length = (separator == save_path) ? 1 : (size_t)(separator - save_path);
+
+			memcpy(directory, save_path, length);
+			directory[length] = '\0';
+		}
+	}
+
+	if (directory == NULL)
+	{
+		return;
+	}
+
+	file_descriptor = open(directory, O_RDONLY);
+	if (file_descriptor >= 0)
+	{
+		fsync(file_descriptor);
+		close(file_descriptor);
+	}
+
+	free(directory);
+}
+#endif
+
+// Replaces the save with size bytes of data: writes them to the temporary
+// file, then renames it over the save. With wait set, the data is on disk
+// before this returns.
+static myBool cartridge_save_write(const char *save_path, const uint8_t *data, uint32_t size, myBool wait)
+{
+	char *temporary_path = cartridge_path_with_suffix(save_path, CARTRIDGE_SAVE_TEMPORARY_EXTENSION);
+	FILE *file_ptr;
+	myBool written;
+
+	if (temporary_path == NULL)
+	{
+		return myFalse;
+	}
+
+	file_ptr = fopen(temporary_path, "wb");
+	written = (file_ptr != NULL && fwrite(data, 1, size, file_ptr) == size && fflush(file_ptr) == 0) ? myTrue : myFalse;
+
+#if CARTRIDGE_SAVE_LOCK_SUPPORTED
+	if (written && wait && fsync(fileno(file_ptr)) != 0)
+	{
+		written = myFalse;
+	}
+#else
+	(void)wait;
+#endif
+
+	if (file_ptr != NULL && fclose(file_ptr) != 0)
+	{
+		written = myFalse;
+	}
+
+#if !CARTRIDGE_SAVE_LOCK_SUPPORTED
+	// rename does not replace an existing file here. Between the two calls
+	// only the (complete) temporary file exists; cartridge_save_open falls
+	// back to it.
+	if (written)
+	{
+		remove(save_path);
+	}
+#endif
+
+	if (written && rename(temporary_path, save_path) != 0)
+	{
+		written = myFalse;
+	}
+
+	if (!written)
+	{
+		remove(temporary_path);
+	}
+#if CARTRIDGE_SAVE_LOCK_SUPPORTED
+	else if (wait)
+	{
+		cartridge_save_sync_directory(save_path);
+	}
+#endif
+
+	free(temporary_path);
+
+	return written;
+}
+
+// Reads the save into cartridge->save (zeros where there is no file yet,
+// which is a new game).
+static void cartridge_save_read(cartridge_t *cartridge)
+{
+	FILE *file_ptr = fopen(cartridge->save_path, "rb");
+
+#if !CARTRIDGE_SAVE_LOCK_SUPPORTED
+	// A flush interrupted between removing the save and renaming the
+	// temporary file over it left only the temporary file.
+	if (file_ptr == NULL)
+	{
+		char *temporary_path = cartridge_path_with_suffix(cartridge->save_path, CARTRIDGE_SAVE_TEMPORARY_EXTENSION);
+
+		if (temporary_path != NULL)
+		{
+			file_ptr = fopen(temporary_path, "rb");
+			free(temporary_path);
+		}
+	}
+#endif
+
+	if (file_ptr != NULL)
+	{
+		if (fread(cartridge->save, 1, cartridge->ram_size, file_ptr) != cartridge->ram_size)
+		{
+			printf("Warning: Save file %s is shorter than the cartridge RAM.\n", cartridge->save_path);
+		}
+		fclose(file_ptr);
+	}
+}
+
+// Claims and loads the save file for the battery RAM. Failing only costs
+// persistence, so the cartridge then runs with RAM that is lost on exit.
+static void cartridge_save_open(gb_t *gb, const char *rom_path)
+{
+	cartridge_t *cartridge = &gb->cartridge;
+
+	cartridge->save_path = cartridge_save_path(rom_path);
+	if (cartridge->save_path == NULL)
+	{
+		printf("Error: Could not allocate the save file path.\n");
+		return;
+	}
+
+#if CARTRIDGE_SAVE_LOCK_SUPPORTED
+	cartridge->save_lock = cartridge_save_lock(cartridge->save_path);
+	if (cartridge->save_lock < 0)
+	{
+		printf("Warning: Save file %s is in use by another instance, progress will not be kept.\n", cartridge->save_path);
+		free(cartridge->save_path);
+		cartridge->save_path = NULL;
+		return;
+	}
+#endif
+
+	cartridge->save = (uint8_t *)calloc(1, cartridge->ram_size);
+	if (cartridge->save == NULL)
+	{
+		printf("Error: Could not allocate %u bytes for the save file.\n", (unsigned)cartridge->ram_size);
+#if CARTRIDGE_SAVE_LOCK_SUPPORTED
+		close(cartridge->save_lock);
+#endif
+		free(cartridge->save_path);
+		cartridge->save_path = NULL;
+		return;
+	}
+
+	cartridge_save_read(cartridge);
+	cartridge->save_unsynced = myFalse;
+
+	memcpy(gb->external_ram, cartridge->save, cartridge->ram_size);
+}
+
+void cartridge_save_flush(gb_t *gb, myBool wait)
+{
+	cartridge_t *cartridge = &gb->cartridge;
+
+	cartridge->save_frames = 0;
+
+	if (cartridge->save == NULL)
+	{
+		return;
+	}
+
+	// Unchanged RAM needs no write, unless the caller waits for the disk
+	// and the last write has not been synced yet.
+	if (memcmp(cartridge->save, gb->external_ram, cartridge->ram_size) == 0
+		&& !(wait && cartridge->save_unsynced))
+	{
+		return;
+	}
+
+	if (!cartridge_save_write(cartridge->save_path, gb->external_ram, cartridge->ram_size, wait))
+	{
+		// cartridge->save still holds the old contents, so the next flush retries.
+		printf("Warning: Could not write save file %s.\n", cartridge->save_path);
+		return;
+	}
+
+	memcpy(cartridge->save, gb->external_ram, cartridge->ram_size);
+	cartridge->save_unsynced = wait ? myFalse : myTrue;
+}
+
+void cartridge_end_frame(gb_t *gb)
+{
+	if (gb->cartridge.save != NULL && ++gb->cartridge.save_frames >= CARTRIDGE_SAVE_FLUSH_FRAMES)
+	{
+		cartridge_save_flush(gb, myFalse);
+	}
+}
+
+// Flushes the save one last time and lets go of the file.
+static void cartridge_save_close(gb_t *gb)
+{
+	cartridge_t *cartridge = &gb->cartridge;
+
+	if (cartridge->save != NULL)
+	{
+		cartridge_save_flush(gb, myTrue);
+		free(cartridge->save);
+
+#if CARTRIDGE_SAVE_LOCK_SUPPORTED
+		// Releases the lock for the next instance.
+		close(cartridge->save_lock);
+#endif
+	}
+
+	free(cartridge->save_path);
+	cartridge->save = NULL;
+	cartridge->save_path = NULL;
+}
+
+// ----------------------------------------------------------------------
+// Loading
+// ----------------------------------------------------------------------
+
+// Whole banks only, and always at least the two the fixed map needs.
+static uint32_t cartridge_rom_allocation(uint32_t image_size)
+{
+	uint32_t rom_size = (image_size + CARTRIDGE_ROM_BANK_SIZE - 1) & ~(uint32_t)(CARTRIDGE_ROM_BANK_SIZE - 1);
+
+	return (rom_size < CARTRIDGE_MIN_ROM_SIZE) ? CARTRIDGE_MIN_ROM_SIZE : rom_size;
+}
+
+// Sum of size bytes. With SSE2, PSADBW against zero adds 8 bytes per
+// 64-bit lane at a time, so a 2 MiB image is summed in a few hundred
+// microseconds.
+static uint32_t cartridge_byte_sum(const uint8_t *data, uint32_t size)
+{
+	uint32_t sum = 0;
+	uint32_t index = 0;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	__m128i total_a = _mm_setzero_si128();
+	__m128i total_b = _mm_setzero_si128();
+
+	for (; index + 64 <= size; index += 64)
+	{
+		total_a = _mm_add_epi64(total_a, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(data + index)), zero));
+		total_b = _mm_add_epi64(total_b, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(data + index + 16)), zero));
+		total_a = _mm_add_epi64(total_a, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(data + index + 32)), zero));
+		total_b = _mm_add_epi64(total_b, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(data + index + 48)), zero));
+	}
+
+	total_a = _mm_add_epi64(total_a, total_b);
+	sum = (uint32_t)_mm_cvtsi128_si32(total_a) + (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(total_a, 8));
+#endif
+
+	for (; index < size; index++)
+	{
+		sum += data[index];
+	}
+
+	return sum;
+}
+
+myBool cartridge_read_header(const uint8_t *image, uint32_t size, cartridge_header_t *header)
+{
+	uint8_t header_checksum = 0;
+	uint16_t global_checksum;
+	uint8_t length;
+
+	memset(header, 0, sizeof(*header));
+
+	if (size < CARTRIDGE_HEADER_END)
+	{
+		return myFalse;
+	}
+
+	// The title ends at the first NUL or non-ASCII byte (the CGB flag
+	// overlaps its last character on newer cartridges).
+	for (length = 0; length < CARTRIDGE_HEADER_TITLE_LENGTH; length++)
+	{
+		uint8_t character = image[CARTRIDGE_HEADER_TITLE_ADDRESS + length];
+
+		if (character < 0x20 || character > 0x7E)
+		{
+			break;
+		}
+
+		header->title[length] = (char)character;
+	}
+
+	header->type = image[CARTRIDGE_HEADER_TYPE_ADDRESS];
+	cartridge_decode_type(header);
+
+	header->cgb_flag = image[CARTRIDGE_HEADER_CGB_FLAG_ADDRESS];
+	header->rom_size = cartridge_rom_size_from_header(image[CARTRIDGE_HEADER_ROM_SIZE_ADDRESS]);
+	header->ram_size = cartridge_ram_size_from_header(image[CARTRIDGE_HEADER_RAM_SIZE_ADDRESS]);
+
+	// Header checksum: 0x014D, over 0x0134-0x014C. Global checksum:
+	// 0x014E-0x014F, big-endian sum of every other byte.
+	for (uint16_t address = CARTRIDGE_HEADER_TITLE_ADDRESS; address < CARTRIDGE_HEADER_CHECKSUM_ADDRESS; address++)
+	{
+		header_checksum = header_checksum - image[address] - 1;
+	}
+
+	global_checksum = (uint16_t)(cartridge_byte_sum(image, size)
+								 - image[CARTRIDGE_HEADER_GLOBAL_CHECKSUM_ADDRESS]
+								 - image[CARTRIDGE_HEADER_GLOBAL_CHECKSUM_ADDRESS + 1]);
+
+	header->header_checksum_ok = (header_checksum == image[CARTRIDGE_HEADER_CHECKSUM_ADDRESS]) ? myTrue : myFalse;
+	header->global_checksum_ok = (global_checksum == (uint16_t)((image[CARTRIDGE_HEADER_GLOBAL_CHECKSUM_ADDRESS] << 8)
+																 | image[CARTRIDGE_HEADER_GLOBAL_CHECKSUM_ADDRESS + 1])) ? myTrue : myFalse;
+
+	return myTrue;
+}
+
+// Takes over rom (rom_size bytes in whole banks, the image at the start,
+// padding already filled), decodes the header and sets up RAM and the MBC.
+static myBool cartridge_insert(gb_t *gb, const uint8_t *rom, uint32_t rom_size, uint32_t image_size, myBool rom_mapped)
+{
+	cartridge_t *cartridge = &gb->cartridge;
+	cartridge_header_t header;
+
+	cartridge->rom = rom;
+	cartridge->rom_size = rom_size;
+	cartridge->rom_mapped = rom_mapped;
+	cartridge->rom_references = (_Atomic uint32_t *)malloc(sizeof(*cartridge->rom_references));
+
+	if (cartridge->rom_references == NULL)
+	{
+		printf("Error: Could not allocate the ROM image reference count.\n");
+		cartridge_unload(gb);
+		return myFalse;
+	}
+
+	atomic_init(cartridge->rom_references, 1);
+	cartridge->rom_bank_count = (uint16_t)(cartridge->rom_size / CARTRIDGE_ROM_BANK_SIZE);
+
+	// Images are always at least two banks, so the header is there.
+	cartridge_read_header(rom, image_size, &header);
+	cartridge->type = header.type;
+	cartridge->mbc = header.mbc;
+	cartridge->has_battery = header.has_battery;
+	cartridge->has_rtc = header.has_rtc;
+	cartridge->has_rumble = header.has_rumble;
+	cartridge->header_checksum_ok = header.header_checksum_ok;
+	cartridge->global_checksum_ok = header.global_checksum_ok;
+	cartridge->cgb_mode = (header.cgb_flag & CARTRIDGE_CGB_FLAG_COLOUR) ? myTrue : myFalse;
+
+	if (!header.mbc_supported)
+	{
+		printf("Warning: Unsupported cartridge type 0x%02X, running it without an MBC.\n", header.type);
+	}
+
+	// Real hardware only insists on the header checksum, so a mismatch is
+	// reported, not fatal.
+	if (!cartridge->header_checksum_ok)
+	{
+		printf("Warning: Cartridge header checksum mismatch (a real Game Boy would refuse to boot it).\n");
+	}
+
+	if (!cartridge->global_checksum_ok)
+	{
+		printf("Note: Cartridge global checksum mismatch.\n");
+	}
+
+	// MBC3 with a clock but no RAM still has the clock registers.
+	cartridge->ram_size = header.ram_size;
+
+	if (cartridge->ram_size > 0)
+	{
+		// A 2 KiB chip still gets a full bank so every page has somewhere to point.
+		cartridge->ram_bank_count = (uint8_t)(((cartridge->ram_size < CARTRIDGE_RAM_BANK_SIZE) ? CARTRIDGE_RAM_BANK_SIZE : cartridge->ram_size)
+											  / CARTRIDGE_RAM_BANK_SIZE);
+	}
+
+	cartridge_reset(gb);
+
+	// The VRAM and WRAM banks in view depend on the mode.
+	mmu_map_memory(gb);
+	return myTrue;
+}
+
+myBool cartridge_load_image(gb_t *gb, const uint8_t *image, uint32_t size)
+{
+	uint32_t rom_size = cartridge_rom_allocation(size);
+	uint8_t *rom;
+
+	cartridge_unload(gb);
+
+	rom = (uint8_t *)malloc(rom_size);
+	if (rom == NULL)
+	{
+		printf("Error: Could not allocate %u bytes for the ROM image.\n", (unsigned)rom_size);
+		return myFalse;
+	}
+
+	memcpy(rom, image, size);
+	memset(rom + size, 0xFF, rom_size - size);
+
+	return cartridge_insert(gb, rom, rom_size, size, myFalse);
+}
+
+#if CARTRIDGE_MMAP_SUPPORTED
+// Maps a ROM file read-only. Every instance mapping the same file shares
+// its pages through the page cache. Returns NULL for files that are not
+// whole banks (those are read and padded instead).
+static const uint8_t *cartridge_map_file(const char *filename, uint32_t *size)
+{
+	struct stat file_status;
+	void *image;
+	int file_descriptor = open(filename, O_RDONLY);
+
+	if (file_descriptor < 0)
+	{
+		return NULL;
+	}
+
+	if (fstat(file_descriptor, &file_status) != 0
+		|| file_status.st_size < CARTRIDGE_MIN_ROM_SIZE
+		|| file_status.st_size > CARTRIDGE_MAX_ROM_SIZE
+		|| (file_status.st_size % CARTRIDGE_ROM_BANK_SIZE) != 0)
+	{
+		close(file_descriptor);
+		return NULL;
+	}
+
+	image = mmap(NULL, (size_t)file_status.st_size, PROT_READ, MAP_SHARED, file_descriptor, 0);
+
+	// The mapping holds its own reference to the file.
+	close(file_descriptor);
+
+	if (image == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	*size = (uint32_t)file_status.st_size;
+	return (const uint8_t *)image;
+}
+#endif
+
+// Reads or maps the ROM file and inserts it.
+static myBool cartridge_load_file(gb_t *gb, const char *filename)
+{
+	FILE *file_ptr;
+	uint8_t *rom;
+	uint32_t rom_size;
+	long file_size;
+
+	cartridge_unload(gb);
+
+#if CARTRIDGE_MMAP_SUPPORTED
+	{
+		uint32_t mapped_size;
+		const uint8_t *mapped = cartridge_map_file(filename, &mapped_size);
+
+		if (mapped != NULL)
+		{
+			return cartridge_insert(gb, mapped, mapped_size, mapped_size, myTrue);
+		}
+	}
+#endif
+
+	// We open the file in binary read mode ("rb")
+	file_ptr = fopen(filename, "rb");
+
+	if (file_ptr == NULL)
+	{
+		printf("Error: Could not open ROM file: %s\n", filename);
+		return myFalse;
+	}
+
+	fseek(file_ptr, 0, SEEK_END);
+	file_size = ftell(file_ptr);
+	fseek(file_ptr, 0, SEEK_SET);
+
+	if (file_size <= CARTRIDGE_HEADER_GLOBAL_CHECKSUM_ADDRESS + 1 || file_size > CARTRIDGE_MAX_ROM_SIZE)
+	{
+		printf("Error: ROM file has an impossible size (%ld bytes): %s\n", file_size, filename);
+		fclose(file_ptr);
+		return myFalse;
+	}
+
+	rom_size = cartridge_rom_allocation((uint32_t)file_size);
+	rom = (uint8_t *)malloc(rom_size);
+
+	if (rom == NULL || fread(rom, 1, (size_t)file_size, file_ptr) != (size_t)file_size)
+	{
+		printf("Error: Could not read ROM file: %s\n", filename);
+		free(rom);
+		fclose(file_ptr);
+		return myFalse;
+	}
+
+	fclose(file_ptr);
+
+	memset(rom + file_size, 0xFF, rom_size - (uint32_t)file_size);
+
+	return cartridge_insert(gb, rom, rom_size, (uint32_t)file_size, myFalse);
+}
+
+myBool cartridge_load(gb_t *gb, const char *filename)
+{
+	if (!cartridge_load_file(gb, filename))
+	{
+		return myFalse;
+	}
+
+	if (gb->cartridge.has_battery && gb->cartridge.ram_size > 0)
+	{
+		cartridge_save_open(gb, filename);
+	}
+
+	return myTrue;
+}
+
+void cartridge_unload(gb_t *gb)
+{
+	cartridge_t *cartridge = &gb->cartridge;
+
+	cartridge_save_close(gb);
+
+	// Whichever instance drops the last reference releases the image; the
+	// release ordering makes every other holder's use of it happen first.
+	if (cartridge->rom != NULL
+		&& (cartridge->rom_references == NULL
+			|| atomic_fetch_sub_explicit(cartridge->rom_references, 1, memory_order_acq_rel) == 1))
+	{
+#if CARTRIDGE_MMAP_SUPPORTED
+		if (cartridge->rom_mapped)
+		{
+			munmap((void *)cartridge->rom, cartridge->rom_size);
+		}
+		else
+#endif
+		{
+			free((void *)cartridge->rom);
+		}
+
+		free(cartridge->rom_references);
+	}
+
+	memset(cartridge, 0, sizeof(*cartridge));
+	memset(&gb->cartridge_registers, 0, sizeof(gb->cartridge_registers));
+	memset(gb->external_ram, 0, sizeof(gb->external_ram));
+
+	mmu_map_memory(gb);
+}
+
+void cartridge_share(gb_t *gb, const gb_t *source)
+{
+	gb->cartridge = source->cartridge;
+	gb->cartridge.save_path = NULL;
+	gb->cartridge.save = NULL;
+	gb->cartridge.save_frames = 0;
+
+	if (gb->cartridge.rom != NULL)
+	{
+		// source holds a reference throughout, so the count cannot reach zero here.
+		atomic_fetch_add_explicit(gb->cartridge.rom_references, 1, memory_order_relaxed);
+	}
+}
+
+void cartridge_reset(gb_t *gb)
+{
+	const cartridge_t *cartridge = &gb->cartridge;
+	cartridge_registers_t *registers = &gb->cartridge_registers;
+
+	memset(registers, 0, sizeof(*registers));
+
+	// Carts without an MBC have their RAM (if any) permanently enabled.
+	registers->ram_enabled = (cartridge->mbc == CARTRIDGE_MBC_NONE) ? myTrue : myFalse;
+	registers->rom_bank_register = 1;
+	registers->rtc_base_time = (int64_t)time(NULL);
+
+	cartridge_map(gb);
+}
@@ -0,0 +1,219 @@
+/*
+ * cartridge.h
+ *
+ * Cartridge image, external RAM and memory bank controller (MBC1, MBC3
+ * with its clock, MBC5). The MBC registers only decide which slice of the
+ * loaded image each window of the page table points at; switching a bank
+ * repoints pages and never copies ROM or RAM.
+ *
+ * The image (cartridge_t) is host state and may be shared by several
+ * instances. The MBC registers (cartridge_registers_t) and the RAM itself
+ * are guest state and live in each instance's arena (see gb.h).
+ */
+
+#ifndef COMPONENTS_CARTRIDGE_H_
+#define COMPONENTS_CARTRIDGE_H_
+
+#include <stdint.h>
+#include "..\headers\mystdbool.h"
+#include "..\BitOps\bit_macros.h"
+
+#ifndef GB_T_DECLARED
+#define GB_T_DECLARED
+typedef struct gb_s gb_t;
+#endif
+
+// ----------------------------------------------------------------------
+// Cartridge Header
+// ----------------------------------------------------------------------
+#define CARTRIDGE_HEADER_TITLE_ADDRESS				(0x0134)
+#define CARTRIDGE_HEADER_TITLE_LENGTH				(16)		// 0x0134-0x0143, shorter on CGB carts
+#define CARTRIDGE_HEADER_CGB_FLAG_ADDRESS			(0x0143)	// 0x80 CGB enhanced, 0xC0 CGB only
+#define CARTRIDGE_CGB_FLAG_COLOUR					BIT(7)		// Set in both
+#define CARTRIDGE_HEADER_TYPE_ADDRESS				(0x0147)
+#define CARTRIDGE_HEADER_ROM_SIZE_ADDRESS			(0x0148)
+#define CARTRIDGE_HEADER_RAM_SIZE_ADDRESS			(0x0149)
+#define CARTRIDGE_HEADER_CHECKSUM_ADDRESS			(0x014D)	// Over 0x0134-0x014C
+#define CARTRIDGE_HEADER_GLOBAL_CHECKSUM_ADDRESS	(0x014E)	// Big-endian, over the whole image
+#define CARTRIDGE_HEADER_END						(0x0150)	// First byte after the header
+
+#define CARTRIDGE_ROM_BANK_SIZE				(0x4000)	// 16 KiB
+#define CARTRIDGE_RAM_BANK_SIZE				(0x2000)	// 8 KiB
+#define CARTRIDGE_MIN_ROM_SIZE				(2 * CARTRIDGE_ROM_BANK_SIZE)
+#define CARTRIDGE_MAX_ROM_SIZE				(512 * CARTRIDGE_ROM_BANK_SIZE)	// 8 MiB, the MBC5 limit
+#define CARTRIDGE_MAX_RAM_SIZE				(16 * CARTRIDGE_RAM_BANK_SIZE)	// 128 KiB, the MBC5 limit
+
+// ROM files are mapped read-only where mmap exists, so instances running
+// the same game share one copy in the page cache. Elsewhere (and for
+// images that are not whole banks) they are read into a private buffer.
+#if defined(__unix__) || defined(__APPLE__)
+#define CARTRIDGE_MMAP_SUPPORTED			(1)
+#else
+#define CARTRIDGE_MMAP_SUPPORTED			(0)
+#endif
+
+// Battery-backed RAM is kept in a .sav file next to the ROM. The RAM the
+// game sees stays in the instance (so snapshots include it); every
+// CARTRIDGE_SAVE_FLUSH_FRAMES frames, if it has changed, it is written to
+// the save path plus CARTRIDGE_SAVE_TEMPORARY_EXTENSION and renamed over
+// the save, so a process killed mid-flush loses at most that flush and
+// never leaves a torn file. Periodic flushes do not wait for the disk.
+#define CARTRIDGE_SAVE_EXTENSION			".sav"
+#define CARTRIDGE_SAVE_TEMPORARY_EXTENSION	".tmp"
+#define CARTRIDGE_SAVE_FLUSH_FRAMES			(60)
+
+// Only one instance at a time may own a save file. Where flock exists the
+// first instance to load the ROM takes an exclusive lock on the save path
+// plus CARTRIDGE_SAVE_LOCK_EXTENSION, and any other (in this process or
+// another) runs without persistence until it is released. Elsewhere there
+// is no lock, and keeping to one instance per save is up to the caller.
+#define CARTRIDGE_SAVE_LOCK_EXTENSION		".lock"
+#if defined(__unix__) || defined(__APPLE__)
+#define CARTRIDGE_SAVE_LOCK_SUPPORTED		(1)
+#else
+#define CARTRIDGE_SAVE_LOCK_SUPPORTED		(0)
+#endif
+
+// ----------------------------------------------------------------------
+// MBC Registers
+// Writes to 0x0000-0x7FFF select these by address range.
+// ----------------------------------------------------------------------
+#define CARTRIDGE_RAM_ENABLE_END			(0x1FFF)	// 0x0A in the low nibble enables RAM
+#define CARTRIDGE_ROM_BANK_END				(0x3FFF)
+#define CARTRIDGE_MBC5_ROM_BANK_LOW_END		(0x2FFF)	// MBC5: 0x3000-0x3FFF is ROM bank bit 8
+#define CARTRIDGE_RAM_BANK_END				(0x5FFF)
+#define CARTRIDGE_RAM_ENABLE_VALUE			(0x0A)
+
+// MBC3 clock registers, selected through the RAM bank register.
+#define CARTRIDGE_RTC_SECONDS				(0x08)
+#define CARTRIDGE_RTC_MINUTES				(0x09)
+#define CARTRIDGE_RTC_HOURS					(0x0A)
+#define CARTRIDGE_RTC_DAYS_LOW				(0x0B)
+#define CARTRIDGE_RTC_DAYS_HIGH				(0x0C)	// Bit 0 day bit 8, bit 6 halt, bit 7 day carry
+#define CARTRIDGE_RTC_DAYS_HIGH_HALT		BIT(6)
+#define CARTRIDGE_RTC_DAYS_HIGH_CARRY		BIT(7)
+#define CARTRIDGE_RTC_DAY_LIMIT				(512)
+
+typedef enum
+{
+	CARTRIDGE_MBC_NONE = 0,
+	CARTRIDGE_MBC1,
+	CARTRIDGE_MBC3,
+	CARTRIDGE_MBC5
+} cartridge_mbc_t;
+
+// What the header of an image says, decoded without loading it.
+typedef struct
+{
+	char title[CARTRIDGE_HEADER_TITLE_LENGTH + 1];	// Printable part, NUL-terminated
+	uint8_t type;						// Raw cartridge type byte (0x0147)
+	cartridge_mbc_t mbc;
+	myBool mbc_supported;				// myFalse for types run without an MBC for want of one
+	myBool has_battery;
+	myBool has_rtc;
+	myBool has_rumble;
+	uint8_t cgb_flag;					// Raw byte at 0x0143
+	uint32_t rom_size;					// As declared (0 for an unknown code)
+	uint32_t ram_size;
+	myBool header_checksum_ok;
+	myBool global_checksum_ok;
+} cartridge_header_t;
+
+typedef struct
+{
+	// Loaded image (NULL with no cartridge inserted). Clones of an instance
+	// share it; the last one to let go frees or unmaps it.
+	const uint8_t *rom;
+	uint32_t rom_size;					// Whole 16 KiB banks, at least two
+	uint16_t rom_bank_count;
+	myBool rom_mapped;					// rom is an mmap of the file, not a malloc'd copy
+	_Atomic uint32_t *rom_references;	// Instances holding rom; clones may come and go on any thread
+
+	// External RAM, which lives in gb->external_ram
+	uint32_t ram_size;					// As declared in the header (0 for none)
+	uint8_t ram_bank_count;
+
+	// Decoded from the header
+	uint8_t type;						// Raw cartridge type byte (0x0147)
+	cartridge_mbc_t mbc;
+	myBool has_battery;
+	myBool has_rtc;
+	myBool has_rumble;
+	myBool header_checksum_ok;
+	myBool global_checksum_ok;
+	myBool cgb_mode;					// Colour cartridge: VRAM/WRAM banking is switched on
+
+	// Battery save (NULL save_path for none, e.g. images loaded from memory)
+	char *save_path;
+	uint8_t *save;						// What the file holds (ram_size bytes), NULL for no save
+	uint32_t save_frames;				// Frames since the last flush
+	myBool save_unsynced;				// Written by a flush that did not wait for the disk
+	int save_lock;						// Descriptor holding the save's lock (while save is set)
+} cartridge_t;
+
+typedef struct
+{
+	myBool ram_enabled;
+	uint16_t rom_bank_register;			// MBC1: 5 bits, MBC3: 7 bits, MBC5: 9 bits
+	uint8_t ram_bank_register;			// MBC1: 2 upper bits, MBC3: RAM bank or clock register, MBC5: 4 bits
+	uint8_t mbc1_mode;					// MBC1 banking mode (0 simple, 1 advanced)
+
+	// MBC3 clock: the running time is host time since rtc_base_time
+	// (or rtc_halted_seconds while halted); rtc_latched is what reads see.
+	int64_t rtc_base_time;
+	uint32_t rtc_halted_seconds;
+	myBool rtc_halted;
+	myBool rtc_day_carry;
+	uint8_t rtc_latched[5];				// Seconds, minutes, hours, days low, days high
+	uint8_t rtc_latch_previous;			// Last value written to 0x6000-0x7FFF
+} cartridge_registers_t;
+
+// Decodes the header of the size-byte image and checks both checksums
+// (the global one over all size bytes). Prints nothing. Returns myFalse,
+// with header zeroed, if the image is too short to have a header.
+myBool cartridge_read_header(const uint8_t *image, uint32_t size, cartridge_header_t *header);
+
+// Loads a ROM file (mapping it when possible), checks the header and
+// global checksums, sizes its RAM from the header and resets the MBC.
+// Battery-backed RAM is loaded from (and later saved to) the ROM's path
+// with CARTRIDGE_SAVE_EXTENSION in place of its extension.
+// Returns myFalse (leaving no cartridge inserted) if the file cannot be read.
+myBool cartridge_load(gb_t *gb, const char *filename);
+
+// Same for an image already in memory; the image is copied.
+myBool cartridge_load_image(gb_t *gb, const uint8_t *image, uint32_t size);
+
+// Flushes the save, then drops this instance's hold on the image (freeing
+// or unmapping it if no other instance shares it) and clears the RAM.
+void cartridge_unload(gb_t *gb);
+
+// Makes gb (a fresh instance) share source's image. The save file stays
+// with source; the copy's RAM is not persisted. The image's reference
+// count is atomic, so instances sharing it may be cloned and destroyed on
+// different threads, as long as source outlives this call.
+void cartridge_share(gb_t *gb, const gb_t *source);
+
+// Writes the battery RAM to the .sav file if it differs from what is
+// there. With wait set, returns only once it is on disk.
+void cartridge_save_flush(gb_t *gb, myBool wait);
+
+// Called at the start of every V-Blank; flushes the save every
+// CARTRIDGE_SAVE_FLUSH_FRAMES frames.
+void cartridge_end_frame(gb_t *gb);
+
+// Puts the MBC back in its power-on state (banks 0/1, RAM disabled).
+void cartridge_reset(gb_t *gb);
+
+// Points the ROM and external RAM pages of the page table at the banks
+// the MBC currently selects (NULL where the MMU must call in here).
+void cartridge_map(gb_t *gb);
+
+// MBC register write (0x0000-0x7FFF).
+void cartridge_write_control(gb_t *gb, uint16_t address, uint8_t value);
+
+// External RAM accesses the page table could not serve: RAM disabled,
+// absent, or an MBC3 clock register selected.
+uint8_t cartridge_read_ram(gb_t *gb, uint16_t address);
+void cartridge_write_ram(gb_t *gb, uint16_t address, uint8_t value);
+
+#endif /* COMPONENTS_CARTRIDGE_H_ */
@@ -11,2877 +11,1875 @@
 #include <stdio.h>
 #include "cpu.h"
 #include "mmu.h"
+#include "ppu.h"
+#include "jit_x64.h"
+#include "gb.h"
 #include "..\BitOps\bit_macros.h"
 
-CPU_State cpu_regs;
-
-void cpu_init();
-void cpu_run();
-static void cpu_step();
-static void check_and_handle_interrupts();
-
-static void cpu_execute(uint8_t opcode);
+void cpu_init(gb_t *gb);
+void cpu_run(gb_t *gb);
+uint16_t cpu_step(gb_t *gb);
+static void dispatch_interrupt(gb_t *gb);
+static uint16_t cpu_halted_cycles_to_skip(gb_t *gb);
+#if CPU_IDLE_LOOP_SKIP
+static void cpu_idle_loop_skip(gb_t *gb);
+#endif
 
 /*HELPER FUNCTIONS*/
-static uint16_t read_imm16();
-static void write_imm16(uint16_t address, uint16_t value);
-
-uint8_t get_register_value(uint8_t reg_code);
-void set_register_value(uint8_t reg_code, uint8_t value);
+static uint8_t read_imm8(gb_t *gb);
+static uint16_t read_imm16(gb_t *gb);
+static void write_imm16(gb_t *gb, uint16_t address, uint16_t value);
+
+
+
+// ----------------------------------------------------------------------
+// Opcode Dispatch
+// Every opcode (and every $CB-prefixed opcode) has its own handler.
+// The handlers are generated below from the opcode bit fields and
+// collected into two 256-entry tables indexed by the opcode byte.
+// ----------------------------------------------------------------------
+static const cpu_opcode_handler_t cpu_opcode_table[256];
+static const cpu_opcode_handler_t cpu_cb_opcode_table[256];
+
+// ----------------------------------------------------------------------
+// Cycle Tables (T-cycles)
+// cpu_cycles_table holds the cost of each opcode when a conditional
+// branch is NOT taken (or for unconditional instructions).
+// cpu_cycles_branch_taken_table only differs for JR/JP/CALL/RET cc.
+// $CB costs live in cpu_cb_cycles_table (prefix fetch included), so the
+// 0xCB entries here are 0. Illegal opcodes are 0 as well.
+// ----------------------------------------------------------------------
+static const uint8_t cpu_cycles_table[256] =
+{
+/*          x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF */
+/* 0x */     4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4,
+/* 1x */     4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4,
+/* 2x */     8, 12,  8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4,
+/* 3x */     8, 12,  8,  8, 12, 12, 12,  4,  8,  8,  8,  8,  4,  4,  8,  4,
+/* 4x */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* 5x */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* 6x */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* 7x */     8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4,
+/* 8x */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* 9x */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* Ax */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* Bx */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* Cx */     8, 12, 12, 16, 12, 16,  8, 16,  8, 16, 12,  0, 12, 24,  8, 16,
+/* Dx */     8, 12, 12,  0, 12, 16,  8, 16,  8, 16, 12,  0, 12,  0,  8, 16,
+/* Ex */    12, 12,  8,  0,  0, 16,  8, 16, 16,  4, 16,  0,  0,  0,  8, 16,
+/* Fx */    12, 12,  8,  4,  0, 16,  8, 16, 12,  8, 16,  4,  0,  0,  8, 16,
+};
+
+static const uint8_t cpu_cycles_branch_taken_table[256] =
+{
+/*          x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF */
+/* 0x */     4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4,
+/* 1x */     4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4,
+/* 2x */    12, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4,
+/* 3x */    12, 12,  8,  8, 12, 12, 12,  4, 12,  8,  8,  8,  4,  4,  8,  4,
+/* 4x */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* 5x */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* 6x */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* 7x */     8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4,
+/* 8x */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* 9x */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* Ax */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* Bx */     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,
+/* Cx */    20, 12, 16, 16, 24, 16,  8, 16, 20, 16, 16,  0, 24, 24,  8, 16,
+/* Dx */    20, 12, 16,  0, 24, 16,  8, 16, 20, 16, 16,  0, 24,  0,  8, 16,
+/* Ex */    12, 12,  8,  0,  0, 16,  8, 16, 16,  4, 16,  0,  0,  0,  8, 16,
+/* Fx */    12, 12,  8,  4,  0, 16,  8, 16, 12,  8, 16,  4,  0,  0,  8, 16,
+};
+
+static const uint8_t cpu_cb_cycles_table[256] =
+{
+/*          x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF */
+/* 0x */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* 1x */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* 2x */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* 3x */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* 4x */     8,  8,  8,  8,  8,  8, 12,  8,  8,  8,  8,  8,  8,  8, 12,  8,
+/* 5x */     8,  8,  8,  8,  8,  8, 12,  8,  8,  8,  8,  8,  8,  8, 12,  8,
+/* 6x */     8,  8,  8,  8,  8,  8, 12,  8,  8,  8,  8,  8,  8,  8, 12,  8,
+/* 7x */     8,  8,  8,  8,  8,  8, 12,  8,  8,  8,  8,  8,  8,  8, 12,  8,
+/* 8x */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* 9x */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* Ax */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* Bx */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* Cx */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* Dx */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* Ex */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+/* Fx */     8,  8,  8,  8,  8,  8, 16,  8,  8,  8,  8,  8,  8,  8, 16,  8,
+};
+
+// ----------------------------------------------------------------------
+// Instruction Lengths (bytes, opcode included)
+// Only the block decoder uses these; the handlers still advance PC
+// themselves through read_imm8/read_imm16. Illegal opcodes are 1.
+// ----------------------------------------------------------------------
+static const uint8_t cpu_length_table[256] =
+{
+/*          x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF */
+/* 0x */     1,  3,  1,  1,  1,  1,  2,  1,  3,  1,  1,  1,  1,  1,  2,  1,
+/* 1x */     2,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1,
+/* 2x */     2,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1,
+/* 3x */     2,  3,  1,  1,  1,  1,  2,  1,  2,  1,  1,  1,  1,  1,  2,  1,
+/* 4x */     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/* 5x */     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/* 6x */     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/* 7x */     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/* 8x */     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/* 9x */     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/* Ax */     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/* Bx */     1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,  1,
+/* Cx */     1,  1,  3,  3,  3,  1,  2,  1,  1,  1,  3,  2,  3,  3,  2,  1,
+/* Dx */     1,  1,  3,  1,  3,  1,  2,  1,  1,  1,  3,  1,  3,  1,  2,  1,
+/* Ex */     2,  1,  1,  1,  1,  1,  2,  1,  2,  1,  3,  1,  1,  1,  2,  1,
+/* Fx */     2,  1,  1,  1,  1,  1,  2,  1,  2,  1,  3,  1,  1,  1,  2,  1,
+};
+
+// Cost of pushing PC and jumping to an interrupt vector.
+#define CPU_INTERRUPT_DISPATCH_CYCLES	(20)
+
+// Interrupt n (bit n of IE/IF) jumps to 0x0040 + n * 8.
+#define CPU_INTERRUPT_VECTOR_BASE		(0x0040)
+#define CPU_INTERRUPT_VECTOR_SPACING	(8)
+
+// A halted CPU skips straight to the next point at which something could
+// raise an interrupt, and an idle loop to the next point at which what it
+// polls could change. With nothing scheduled a step still only skips this
+// many T-cycles (one scanline), so the caller keeps getting control.
+#define CPU_HALTED_STEP_CYCLES			(4)
+#define CPU_MAX_SKIP_CYCLES				(456)
+
+// Conditional handlers call this when their condition holds.
+#define BRANCH_TAKEN(opcode)	(gb->cpu_step_cycles += cpu_cycles_branch_taken_table[(opcode)] - cpu_cycles_table[(opcode)])
+
+
+void cpu_init(gb_t *gb)
+{
+	gb->cpu_regs.PC = 0x0100;
+	gb->cpu_regs.SP = 0xFFFE;
+	gb->cpu_regs.AF = 0x01B0;
+	gb->cpu_lazy_flags.op = CPU_LAZY_FLAGS_NONE;
+	gb->cpu_regs.BC = 0x0013;
+	gb->cpu_regs.DE = 0x00D8;
+	gb->cpu_regs.HL = 0x014D;
+
+	gb->running = myTrue;
+}
 
-void execute_prefix_instruction (uint8_t prefixed_opcode);
+void cpu_run(gb_t *gb)
+{
+	while(gb->running)
+	{
+		ppu_step(gb, cpu_step(gb));
+	}
+}
 
+// ----------------------------------------------------------------------
+// Block Cache
+// A block is a straight run of predecoded instructions ending at the
+// first control transfer (JP/JR/CALL/RET/RST), HALT, STOP or EI, or after
+// CPU_BLOCK_MAX_INSTRUCTIONS. Each instruction carries its handler
+// (already resolved through the $CB page), its immediate and its cost.
+// Blocks are only built from ROM, WRAM and HRAM; code anywhere else is
+// fetched and dispatched one instruction at a time as before.
+// ----------------------------------------------------------------------
+
+#define BLOCK_GRANULE(address)		((uint16_t)(address) >> CPU_BLOCK_GRANULE_SHIFT)
+
+// Finds the last address a block starting at pc may decode from.
+// Returns myFalse when code at pc is not cached at all.
+static myBool block_region(uint16_t pc, uint16_t *region_end, myBool *in_ram)
+{
+	*in_ram = myFalse;
 
-myBool running = myTrue;
-myBool emulator_is_stopped = myFalse;
-myBool cpu_is_halted = myFalse;
-myBool interrupt_master_enable = myFalse;
+	if (pc <= MMU_ADDRESS_ROM_BANK_00_END)
+	{
+		*region_end = MMU_ADDRESS_ROM_BANK_00_END;
+	}
+	else if (pc <= MMU_ADDRESS_ROM_BANK_01_NN_END)
+	{
+		*region_end = MMU_ADDRESS_ROM_BANK_01_NN_END;
+	}
+	else if (pc >= MMU_ADDRESS_WORK_RAM_A_START && pc <= MMU_ADDRESS_WORK_RAM_END)
+	{
+		*region_end = MMU_ADDRESS_WORK_RAM_END;
+		*in_ram = myTrue;
+	}
+	else if (pc >= MMU_ADDRESS_HIGH_RAM_START && pc <= MMU_ADDRESS_HIGH_RAM_END)
+	{
+		*region_end = MMU_ADDRESS_HIGH_RAM_END;
+		*in_ram = myTrue;
+	}
+	else
+	{
+		return myFalse;
+	}
 
+	return myTrue;
+}
 
-void cpu_init()
+static uint16_t block_bank(gb_t *gb, uint16_t pc)
 {
-	cpu_regs.PC = 0x0100;
-	cpu_regs.SP = 0xFFFE;
-	cpu_regs.AF = 0x01B0;
-	cpu_regs.BC = 0x0013;
-	cpu_regs.DE = 0x00D8;
-	cpu_regs.HL = 0x014D;
+	if (pc >= MMU_ADDRESS_ROM_BANK_01_NN_START && pc <= MMU_ADDRESS_ROM_BANK_01_NN_END)
+	{
+		return gb->mmu_rom_bank_number;
+	}
+
+	return 0;
 }
 
-void cpu_run()
+static myBool opcode_ends_block(uint8_t opcode)
 {
-	while(running)
+	switch (opcode)
 	{
-		cpu_step();
+		case 0x18: case 0x20: case 0x28: case 0x30: case 0x38:		// jr
+		case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA:		// jp
+		case 0xE9:													// jp hl
+		case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:		// call
+		case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8:		// ret
+		case 0xD9:													// reti
+		case 0xC7: case 0xCF: case 0xD7: case 0xDF:					// rst
+		case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+		case 0x10: case 0x76: case 0xFB:							// stop, halt, ei
+		case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4:		// unused
+		case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+			return myTrue;
 
+		default:
+			return myFalse;
 	}
 }
 
-static void cpu_step()
+static myBool block_is_current(gb_t *gb, const cpu_block_t *block)
 {
-	uint8_t opcode;
-	opcode = mmu_read_byte(cpu_regs.PC);
-	cpu_regs.PC = cpu_regs.PC + 1;
-
-	cpu_execute(opcode);
-	check_and_handle_interrupts();
+	return block->granule_generation[0] == gb->block_granule_generation[BLOCK_GRANULE(block->start_pc)]
+		&& block->granule_generation[1] == gb->block_granule_generation[BLOCK_GRANULE(block->end_pc - 1)];
 }
 
-static void check_and_handle_interrupts()
+// Records where control can go after the block when that is known now:
+// the target of JP/JR/CALL/RST imm and/or the fall-through address.
+static void block_find_exits(cpu_block_t *block, uint8_t last_opcode, uint16_t immediate)
 {
-	uint8_t IF_byte = mmu_read_byte(MMU_ADDRESS_INTERRUPT_FLAG_REGISTER);
-	uint8_t IE_byte = mmu_read_byte(MMU_ADDRESS_INTERRUPT_ENABLE_REGISTER);
-	uint8_t active_interrupts = IF_byte & IE_byte;
+	uint16_t fall_through = block->end_pc;
 
-	if (IF_byte > 0x00)
-	{
-		if(cpu_is_halted)
-		{
-			cpu_is_halted = myFalse;
-		}
+	block->exit_count = 0;
 
-		if (interrupt_master_enable && (active_interrupts > 0x00))
-		{
-			interrupt_master_enable = myFalse;
-			cpu_regs.SP -= 2;
-			mmu_write_word(cpu_regs.SP, cpu_regs.PC);
+	switch (last_opcode)
+	{
+		case 0x18:
+			block->exit_pc[block->exit_count++] = fall_through + (int8_t)immediate;
+			break;
+
+		case 0x20: case 0x28: case 0x30: case 0x38:
+			block->exit_pc[block->exit_count++] = fall_through + (int8_t)immediate;
+			block->exit_pc[block->exit_count++] = fall_through;
+			break;
+
+		case 0xC3: case 0xCD:
+			block->exit_pc[block->exit_count++] = immediate;
+			break;
+
+		case 0xC2: case 0xCA: case 0xD2: case 0xDA:
+		case 0xC4: case 0xCC: case 0xD4: case 0xDC:
+			block->exit_pc[block->exit_count++] = immediate;
+			block->exit_pc[block->exit_count++] = fall_through;
+			break;
+
+		case 0xC7: case 0xCF: case 0xD7: case 0xDF:
+		case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+			block->exit_pc[block->exit_count++] = last_opcode & 0x38;
+			break;
 
-			if(CHK_BIT(active_interrupts, MMU_INTERRUPT_FLAG_VBLANK))
-			{
-				CLR_BIT(IF_byte, MMU_INTERRUPT_FLAG_VBLANK);
-				cpu_regs.PC = 0x0040;
-				mmu_write_byte(MMU_ADDRESS_INTERRUPT_FLAG_REGISTER, IF_byte);
-			}
-			else if
-			(CHK_BIT(active_interrupts, MMU_INTERRUPT_FLAG_LCD))
-			{
-				CLR_BIT(IF_byte, MMU_INTERRUPT_FLAG_LCD);
-				cpu_regs.PC = 0x0048;
-				mmu_write_byte(MMU_ADDRESS_INTERRUPT_FLAG_REGISTER, IF_byte);
-			}
-			else if
-			(CHK_BIT(active_interrupts, MMU_INTERRUPT_FLAG_TIMER))
-			{
-				CLR_BIT(IF_byte, MMU_INTERRUPT_FLAG_TIMER);
-				cpu_regs.PC = 0x0050;
-				mmu_write_byte(MMU_ADDRESS_INTERRUPT_FLAG_REGISTER, IF_byte);
-			}
-			else if
-			(CHK_BIT(active_interrupts, MMU_INTERRUPT_FLAG_SERIAL))
-			{
-				CLR_BIT(IF_byte, MMU_INTERRUPT_FLAG_SERIAL);
-				cpu_regs.PC = 0x0058;
-				mmu_write_byte(MMU_ADDRESS_INTERRUPT_FLAG_REGISTER, IF_byte);
-			}
-			else if
-			(CHK_BIT(active_interrupts, MMU_INTERRUPT_FLAG_JOYPAD))
+		default:
+			// RET, JP HL, HALT, STOP and EI go back through cpu_step.
+			if (!opcode_ends_block(last_opcode))
 			{
-				CLR_BIT(IF_byte, MMU_INTERRUPT_FLAG_JOYPAD);
-				cpu_regs.PC = 0x0060;
-				mmu_write_byte(MMU_ADDRESS_INTERRUPT_FLAG_REGISTER, IF_byte);
+				block->exit_pc[block->exit_count++] = fall_through;
 			}
-		}
+			break;
 	}
 }
 
-
-static void cpu_execute(uint8_t opcode)
+// Spots a polling loop such as
+//		loop:	ldh a,(STAT)	/ ld a,(LY)
+//				and 3			(any of and/or/xor/cp n, and a, or a, bit b,a)
+//				jr nz,loop		(or jp cc,loop)
+// Every pass loads A afresh from LY, STAT or IF and only touches A and F,
+// so until the PPU changes that register each pass is an exact repeat.
+static myBool block_is_idle_loop(const cpu_block_t *block)
 {
-	switch (opcode)
+	const cpu_decoded_instruction_t *first = &block->instructions[0];
+	const cpu_decoded_instruction_t *last = &block->instructions[block->instruction_count - 1];
+	uint16_t polled_address;
+
+	if (block->instruction_count < 2 || first->prefixed || last->prefixed)
 	{
-		case 0x00: // NOP
-		{
-			// No operation needed
-		}
-		break;
+		return myFalse;
+	}
 
-		case 0x01: // ld BC, imm16
-		{
-			cpu_regs.BC = read_imm16();
-		}
-		break;
+	if (first->opcode == 0xF0)			// ldh a,(n)
+	{
+		polled_address = MMU_ADDRESS_I_O_REGISTER_START | (uint8_t)first->immediate;
+	}
+	else if (first->opcode == 0xFA)		// ld a,(nn)
+	{
+		polled_address = first->immediate;
+	}
+	else
+	{
+		return myFalse;
+	}
 
-		case 0x11: // ld DE, imm16
-		{
-			cpu_regs.DE = read_imm16();
-		}
-		break;
+	if (polled_address != PPU_REGISTER_LY_ADDRESS
+		&& polled_address != PPU_REGISTER_STAT_ADDRESS
+		&& polled_address != MMU_ADDRESS_INTERRUPT_FLAG_REGISTER)
+	{
+		return myFalse;
+	}
 
-		case 0x21: // ld HL, imm16
-		{
-			cpu_regs.HL = read_imm16();
-		}
-		break;
+	for (uint8_t index = 1; index < block->instruction_count - 1; index++)
+	{
+		const cpu_decoded_instruction_t *instruction = &block->instructions[index];
 
-		case 0x31: // ld SP, imm16
+		if (instruction->prefixed)
 		{
-			cpu_regs.SP = read_imm16();
+			// bit b,a
+			if ((instruction->opcode & 0xC7) != 0x47)
+			{
+				return myFalse;
+			}
 		}
-		break;
-
-
-		case 0x02: // ld (BC), A
+		else if (instruction->opcode != 0xA7 && instruction->opcode != 0xB7		// and a, or a
+			&& instruction->opcode != 0xE6 && instruction->opcode != 0xEE		// and n, xor n
+			&& instruction->opcode != 0xF6 && instruction->opcode != 0xFE)		// or n, cp n
 		{
-			mmu_write_byte(cpu_regs.BC, cpu_regs.A);
+			return myFalse;
 		}
-		break;
+	}
 
-		case 0x12: // ld (DE), A
-		{
-			mmu_write_byte(cpu_regs.DE, cpu_regs.A);
-		}
-		break;
+	switch (last->opcode)
+	{
+		case 0x20: case 0x28: case 0x30: case 0x38:		// jr cc
+			return (uint16_t)(block->end_pc + (int8_t)last->immediate) == block->start_pc;
 
-		case 0x22: // ld (HL+), A
-		{
-			mmu_write_byte(cpu_regs.HL++, cpu_regs.A);
-		}
-		break;
+		case 0xC2: case 0xCA: case 0xD2: case 0xDA:		// jp cc
+			return last->immediate == block->start_pc;
 
-		case 0x32: // ld (HL-), A
-		{
-			mmu_write_byte(cpu_regs.HL--, cpu_regs.A);
-		}
-		break;
+		default:
+			return myFalse;
+	}
+}
 
+// Forgets every chain between translated blocks.
+static void block_cache_unlink(gb_t *gb)
+{
+	for (uint16_t entry = 0; entry < CPU_BLOCK_CACHE_ENTRIES; entry++)
+	{
+		gb->cpu_block_cache[entry].link[0] = NULL;
+		gb->cpu_block_cache[entry].link[1] = NULL;
+	}
+}
 
+// Forgets every translation (the JIT's code buffer is about to be reused).
+static void block_cache_drop_native(gb_t *gb)
+{
+	for (uint16_t entry = 0; entry < CPU_BLOCK_CACHE_ENTRIES; entry++)
+	{
+		gb->cpu_block_cache[entry].native_entry = NULL;
+		gb->cpu_block_cache[entry].native_body = NULL;
+		gb->cpu_block_cache[entry].executions = 0;
+	}
 
-		case 0x0A: //ld a, (BC)
-		{
-			cpu_regs.A = mmu_read_byte(cpu_regs.BC);
-		}
-		break;
+	block_cache_unlink(gb);
+}
 
-		case 0x1A: //ld a, (DE)
-		{
-			cpu_regs.A = mmu_read_byte(cpu_regs.DE);
-		}
-		break;
+static void block_decode(gb_t *gb, cpu_block_t *block, uint16_t pc, uint16_t bank, uint16_t region_end, myBool in_ram)
+{
+	uint16_t address = pc;
+	uint8_t count = 0;
+	uint8_t last_opcode = 0x00;
+	uint16_t last_immediate = 0x0000;
 
-		case 0x2A: //ld a, (HL+)
-		{
-			cpu_regs.A = mmu_read_byte(cpu_regs.HL++);
-		}
-		break;
+	// Other translated blocks may be chained into the one being replaced.
+	if (block->native_entry != NULL)
+	{
+		block_cache_unlink(gb);
+	}
 
-		case 0x3A: //ld a, (HL-)
-		{
-			cpu_regs.A = mmu_read_byte(cpu_regs.HL--);
-		}
-		break;
+	block->native_entry = NULL;
+	block->native_body = NULL;
+	block->link[0] = NULL;
+	block->link[1] = NULL;
+	block->executions = 0;
 
+	block->start_pc = pc;
+	block->bank = bank;
+	block->in_ram = in_ram;
+	block->cycles = 0;
+
+	while (count < CPU_BLOCK_MAX_INSTRUCTIONS)
+	{
+		uint8_t opcode = mmu_read_byte(gb, address);
+		uint8_t length = cpu_length_table[opcode];
+		cpu_decoded_instruction_t *instruction = &block->instructions[count];
 
-		case 0x08: // LD (imm16), SP
+		// Never decode past the end of the region (or bank) the block started in.
+		if ((uint32_t)address + length - 1 > region_end)
 		{
-			uint16_t target_address = read_imm16();
-			write_imm16(target_address, cpu_regs.SP);
+			break;
 		}
-		break;
 
+		instruction->opcode = opcode;
+		instruction->length = length;
+		instruction->handler = cpu_opcode_table[opcode];
+		instruction->cycles = cpu_cycles_table[opcode];
+		instruction->immediate = 0x0000;
+		instruction->prefixed = myFalse;
 
-		case 0x03: //increment BC
+		if (length == 2)
 		{
-			cpu_regs.BC++;
+			instruction->immediate = mmu_read_byte(gb, address + 1);
 		}
-		break;
-
-		case 0x13: //increment DE
+		else if (length == 3)
 		{
-			cpu_regs.DE++;
+			instruction->immediate = mmu_read_word(gb, address + 1);
 		}
-		break;
 
-		case 0x23: //increment HL
+		// Resolve the prefix now so the block calls the $CB handler directly.
+		if (opcode == 0xCB)
 		{
-			cpu_regs.HL++;
+			instruction->opcode = (uint8_t)instruction->immediate;
+			instruction->prefixed = myTrue;
+			instruction->handler = cpu_cb_opcode_table[instruction->opcode];
+			instruction->cycles = cpu_cb_cycles_table[instruction->opcode];
 		}
-		break;
 
-		case 0x33: //increment SP
+		block->cycles += instruction->cycles;
+		address += length;
+		count++;
+		last_opcode = opcode;
+		last_immediate = instruction->immediate;
+
+		if (opcode_ends_block(opcode))
 		{
-			cpu_regs.SP++;
+			break;
 		}
-		break;
+	}
 
+	block->end_pc = address;
+	block->instruction_count = count;
+	block_find_exits(block, last_opcode, last_immediate);
+	block->idle_loop = (count > 0) ? block_is_idle_loop(block) : myFalse;
 
-		case 0x0B: //decrement BC
-		{
-			cpu_regs.BC--;
-		}
-		break;
+	if (in_ram && count > 0)
+	{
+		uint16_t first_granule = BLOCK_GRANULE(pc);
+		uint16_t last_granule = BLOCK_GRANULE(address - 1);
 
-		case 0x1B: //decrement DE
-		{
-			cpu_regs.DE--;
-		}
-		break;
+		gb->cpu_block_code_granules[first_granule] = 1;
+		gb->cpu_block_code_granules[last_granule] = 1;
+		block->granule_generation[0] = gb->block_granule_generation[first_granule];
+		block->granule_generation[1] = gb->block_granule_generation[last_granule];
+	}
+}
 
-		case 0x2B: //decrement HL
-		{
-			cpu_regs.HL--;
-		}
-		break;
+// Returns the block starting at pc, decoding it on a miss, or NULL when
+// pc is outside the cached regions.
+static cpu_block_t *block_cache_lookup(gb_t *gb, uint16_t pc)
+{
+	uint16_t region_end;
+	myBool in_ram;
 
-		case 0x3B: //decrement SP
-		{
-			cpu_regs.SP--;
-		}
-		break;
+	if (!block_region(pc, &region_end, &in_ram))
+	{
+		return NULL;
+	}
 
+	uint16_t bank = block_bank(gb, pc);
+	cpu_block_t *block = &gb->cpu_block_cache[(pc ^ (pc >> 10) ^ (bank << 5)) & (CPU_BLOCK_CACHE_ENTRIES - 1)];
 
+	if (block->instruction_count == 0
+		|| block->start_pc != pc
+		|| block->bank != bank
+		|| (block->in_ram && !block_is_current(gb, block)))
+	{
+		block_decode(gb, block, pc, bank, region_end, in_ram);
+	}
 
-		case 0x09: //add hl, BC
-		{
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
+	return (block->instruction_count > 0) ? block : NULL;
+}
 
-			uint16_t old_HL = cpu_regs.HL; // get current value in HL
-			uint16_t value = cpu_regs.BC; // get current value from BC
+static void block_execute(gb_t *gb, const cpu_block_t *block)
+{
+	const cpu_decoded_instruction_t *instruction = block->instructions;
+	const cpu_decoded_instruction_t *block_end = instruction + block->instruction_count;
 
-			if ((old_HL & 0x0FFF)+(value & 0x0FFF) > 0x0FFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
+	gb->cpu_step_cycles = block->cycles;
+	gb->cpu_block_cache_written = myFalse;
 
-			if (((uint32_t)old_HL + (uint32_t)value) > 0xFFFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
+	while (instruction < block_end)
+	{
+		cpu_execute_instruction(gb, instruction);
+		instruction++;
+
+		// The block wrote over its own code: stop here and give back the
+		// cycles of the instructions that will now be decoded afresh.
+		if (gb->cpu_block_cache_written && block->in_ram && !block_is_current(gb, block))
+		{
+			while (instruction < block_end)
 			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
+				gb->cpu_step_cycles -= instruction->cycles;
+				instruction++;
 			}
-
-			cpu_regs.HL += cpu_regs.BC;
 		}
-		break;
+	}
+}
+
+void cpu_execute_instruction(gb_t *gb, const cpu_decoded_instruction_t *instruction)
+{
+	gb->current_instruction = instruction;
+	gb->cpu_regs.PC += instruction->length;
+	instruction->handler(gb, instruction->opcode);
+	gb->current_instruction = NULL;
+}
 
-		case 0x19: //add hl, DE
+#if CPU_JIT_SUPPORTED
+// Runs the block as translated code, translating it first once it is hot.
+// Returns myFalse when the block should be interpreted this time.
+static myBool block_execute_native(gb_t *gb, cpu_block_t *block, cpu_block_t *previous)
+{
+	if (block->native_entry == NULL)
+	{
+		if (++block->executions < CPU_JIT_HOT_THRESHOLD)
 		{
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
+			return myFalse;
+		}
 
-			uint16_t old_HL = cpu_regs.HL; // get current value in HL
-			uint16_t value = cpu_regs.DE; // get current value from BC
+		// A full code buffer is simply started over.
+		if (!jit_compile(gb, block))
+		{
+			block_cache_drop_native(gb);
+			jit_reset(gb);
 
-			if ((old_HL & 0x0FFF)+(value & 0x0FFF) > 0x0FFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
+			if (!jit_compile(gb, block))
 			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
+				return myFalse;
 			}
+		}
+	}
 
-			if (((uint32_t)old_HL + (uint32_t)value) > 0xFFFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
+	// Chain the block the last translated run ended in to this one, so
+	// next time it jumps straight here without coming back to cpu_step.
+	// Instrumented builds leave blocks unchained so each run is counted.
+#if !MMU_INSTRUMENTATION
+	if (previous != NULL && previous->native_entry != NULL)
+	{
+		for (uint8_t exit = 0; exit < previous->exit_count; exit++)
+		{
+			if (previous->exit_pc[exit] == block->start_pc)
 			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
+				previous->link[exit] = block->native_body;
+				previous->link_bank[exit] = block->bank;
 			}
-
-			cpu_regs.HL += cpu_regs.DE;
 		}
-		break;
+	}
+#else
+	(void)previous;
+#endif
 
-		case 0x29: //add hl, HL
-		{
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
+	gb->cpu_step_cycles = 0;
+	jit_enter(gb, block);
 
-			uint16_t old_HL = cpu_regs.HL; // get current value in HL
-			uint16_t value = cpu_regs.HL; // get current value from BC
+	return myTrue;
+}
+#endif
 
-			if ((old_HL & 0x0FFF)+(value & 0x0FFF) > 0x0FFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
+myBool cpu_jit_set_enabled(gb_t *gb, myBool enable)
+{
+	// Translations are dropped on every switch so none outlive a mode change.
+	block_cache_drop_native(gb);
+	gb->cpu_jit_enabled = myFalse;
 
-			if (((uint32_t)old_HL + (uint32_t)value) > 0xFFFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
+#if CPU_JIT_SUPPORTED
+	if (enable)
+	{
+		gb->cpu_jit_enabled = jit_init(gb);
+	}
+#endif
 
-			cpu_regs.HL += cpu_regs.HL;
-		}
-		break;
+	return gb->cpu_jit_enabled == enable;
+}
 
+void cpu_block_cache_invalidate(gb_t *gb, uint16_t address)
+{
+	uint16_t granule = BLOCK_GRANULE(address);
 
-		case 0x39: //add hl, SP
-		{
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
+	gb->cpu_block_code_granules[granule] = 0;
+	gb->block_granule_generation[granule]++;
+	gb->cpu_block_cache_written = myTrue;
 
-			uint16_t old_HL = cpu_regs.HL; // get current value in HL
-			uint16_t value = cpu_regs.SP; // get current value from BC
+	// A chain may lead into code from this granule; rebuild them all.
+	if (gb->cpu_jit_enabled)
+	{
+		block_cache_unlink(gb);
+	}
+}
 
-			if ((old_HL & 0x0FFF)+(value & 0x0FFF) > 0x0FFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
+void cpu_block_cache_flush(gb_t *gb)
+{
+	block_cache_drop_native(gb);
 
-			if (((uint32_t)old_HL + (uint32_t)value) > 0xFFFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
+	for (uint16_t entry = 0; entry < CPU_BLOCK_CACHE_ENTRIES; entry++)
+	{
+		gb->cpu_block_cache[entry].instruction_count = 0;
+	}
 
-			cpu_regs.HL += cpu_regs.SP;
-		}
-		break;
+#if CPU_JIT_SUPPORTED
+	if (gb->cpu_jit_enabled)
+	{
+		jit_reset(gb);
+	}
+#endif
 
+	for (uint16_t granule = 0; granule < CPU_BLOCK_GRANULE_COUNT; granule++)
+	{
+		gb->cpu_block_code_granules[granule] = 0;
+	}
+}
 
-		case 0x04: // INC B
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
+// ----------------------------------------------------------------------
+// cpu_step
+// Runs the block at PC (or fetches and executes one instruction outside
+// the cached regions, or skips ahead to the next peripheral event if
+// halted). Interrupts are only checked here, between blocks. Returns the
+// T-cycles used.
+// ----------------------------------------------------------------------
+uint16_t cpu_step(gb_t *gb)
+{
+	cpu_block_t *block;
+	uint8_t opcode;
 
-			uint8_t old_value = cpu_regs.B; // Store original value for Half Carry check
+#if CPU_JIT_SUPPORTED
+	// Last block a translated run finished in, for chaining.
+	cpu_block_t *previous_native = gb->jit_last_block;
+	gb->jit_last_block = NULL;
+#endif
 
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x0F)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
+	if (gb->cpu_is_halted)
+	{
+		gb->cpu_step_cycles = CPU_HALTED_STEP_CYCLES;
 
-			// Perform the actual increment
-			cpu_regs.B++;
+		// HALT ends as soon as an enabled interrupt is requested, even with IME off.
+		if (gb->m_interrupt_flags & gb->interrupt_enable & MMU_INTERRUPT_FLAG_ALL)
+		{
+			gb->cpu_is_halted = myFalse;
 
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.B after incrementing
-			if (cpu_regs.B == 0x00)
+			if (gb->cpu_interrupts_pending)
 			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
+				dispatch_interrupt(gb);
 			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
 		}
-		break;
-
-		case 0x0C: // INC C
+		else
 		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
-
-			uint8_t old_value = cpu_regs.C; // Store original value for Half Carry check
+			gb->cpu_step_cycles = cpu_halted_cycles_to_skip(gb);
+		}
 
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x0F)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
+		return gb->cpu_step_cycles;
+	}
 
-			// Perform the actual increment
-			cpu_regs.C++;
+	// While OAM DMA holds the bus only HRAM can be fetched from; code
+	// anywhere else takes the fetch path below, which sees the locked bus.
+	if (gb->ppu_state.dma_active && gb->cpu_regs.PC < MMU_ADDRESS_HIGH_RAM_START)
+	{
+		block = NULL;
+	}
+	else
+	{
+		block = block_cache_lookup(gb, gb->cpu_regs.PC);
+	}
 
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.C after incrementing
-			if (cpu_regs.C == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+	if (block != NULL)
+	{
+		MMU_STATS_EXECUTE(gb, block->start_pc, block->instruction_count);
 
-			// C Flag (Carry): NOT AFFECTED by INC r8
+#if CPU_JIT_SUPPORTED
+		// Idle loops stay interpreted so each step is exactly one pass.
+		if (!gb->cpu_jit_enabled || block->idle_loop || !block_execute_native(gb, block, previous_native))
+#endif
+		{
+			block_execute(gb, block);
 		}
-		break;
 
-		case 0x14: // INC D
+#if CPU_IDLE_LOOP_SKIP
+		// Went round again: nothing will differ until the next PPU event.
+		if (block->idle_loop && gb->cpu_regs.PC == block->start_pc)
 		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
+			cpu_idle_loop_skip(gb);
+		}
+#endif
+	}
+	else
+	{
+		MMU_STATS_EXECUTE(gb, gb->cpu_regs.PC, 1);
+		opcode = mmu_read_byte(gb, gb->cpu_regs.PC);
+		gb->cpu_regs.PC = gb->cpu_regs.PC + 1;
 
-			uint8_t old_value = cpu_regs.D; // Store original value for Half Carry check
+		gb->cpu_step_cycles = cpu_cycles_table[opcode];
+		cpu_opcode_table[opcode](gb, opcode);
+	}
 
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x0F)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
+	if (gb->cpu_interrupts_pending)
+	{
+		dispatch_interrupt(gb);
+	}
 
-			// Perform the actual increment
-			cpu_regs.D++;
+	return gb->cpu_step_cycles;
+}
 
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.D after incrementing
-			if (cpu_regs.D == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+// ----------------------------------------------------------------------
+// cpu_skip_window
+// How far HALT or an idle loop may be fast-forwarded: up to the next
+// peripheral event, at most CPU_MAX_SKIP_CYCLES, and no further than
+// gb->cpu_skip_limit when a bounded run has set one.
+// ----------------------------------------------------------------------
+static uint32_t cpu_skip_window(gb_t *gb)
+{
+	uint32_t cycles = ppu_cycles_until_next_event(gb);
 
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
+	if (cycles == 0 || cycles > CPU_MAX_SKIP_CYCLES)
+	{
+		cycles = CPU_MAX_SKIP_CYCLES;
+	}
 
-		case 0x1C: // INC E
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
+	if (gb->cpu_skip_limit != 0 && cycles > gb->cpu_skip_limit)
+	{
+		cycles = gb->cpu_skip_limit;
+	}
 
-			uint8_t old_value = cpu_regs.E; // Store original value for Half Carry check
+	return cycles;
+}
 
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x0F)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
+// ----------------------------------------------------------------------
+// cpu_halted_cycles_to_skip
+// Nothing but an interrupt can wake a halted CPU, and only the peripherals
+// raise those, so the whole wait up to the next peripheral event can be
+// handed out in one step instead of one M-cycle at a time.
+// ----------------------------------------------------------------------
+static uint16_t cpu_halted_cycles_to_skip(gb_t *gb)
+{
+	uint32_t cycles = cpu_skip_window(gb);
 
-			// Perform the actual increment
-			cpu_regs.E++;
+	// Whole M-cycles only.
+	cycles = (cycles + CPU_HALTED_STEP_CYCLES - 1) & ~(uint32_t)(CPU_HALTED_STEP_CYCLES - 1);
 
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.E after incrementing
-			if (cpu_regs.E == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+	return (uint16_t)cycles;
+}
 
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
+#if CPU_IDLE_LOOP_SKIP
+// ----------------------------------------------------------------------
+// cpu_idle_loop_skip
+// Called straight after one pass of an idle loop that branched back to
+// itself (that pass's cost is in cpu_step_cycles). Adds the whole passes
+// that would still start before the next PPU event, so the next pass run
+// is the first one that could see a different value.
+// ----------------------------------------------------------------------
+static void cpu_idle_loop_skip(gb_t *gb)
+{
+	uint32_t pass_cycles = gb->cpu_step_cycles;
+	uint32_t event_cycles;
+	uint32_t skipped_cycles;
 
-		case 0x24: // INC H
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
+	// A pending interrupt is taken at the end of this step instead.
+	if (gb->cpu_interrupts_pending)
+	{
+		return;
+	}
 
-			uint8_t old_value = cpu_regs.H; // Store original value for Half Carry check
+	event_cycles = cpu_skip_window(gb);
+	skipped_cycles = ((event_cycles - 1) / pass_cycles) * pass_cycles;
 
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x0F)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment
-			cpu_regs.H++;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.H after incrementing
-			if (cpu_regs.H == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
-
-		case 0x2C: // INC L
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
-
-			uint8_t old_value = cpu_regs.L; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x0F)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment
-			cpu_regs.L++;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.LH after incrementing
-			if (cpu_regs.L == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
-
-		case 0x34: // INC (HL) - Increment byte at memory address (HL)
-		{
-			// N Flag (Subtract): Always reset (0)
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			uint16_t hl_address = cpu_regs.HL; // Get the memory address from HL
-			uint8_t old_value_at_HL = mmu_read_byte(hl_address); // Read the byte from memory
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			if ((old_value_at_HL & 0x0F) == 0x0F) {
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			} else {
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment on the value from memory
-			uint8_t new_value_at_HL = old_value_at_HL + 1; // Or old_value_at_HL++;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			if (new_value_at_HL == 0x00) {
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			} else {
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED
-
-			// Write the incremented value back to memory
-			mmu_write_byte(hl_address, new_value_at_HL);
-		}
-		break;
-
-		case 0x3C: // INC A
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
-
-			uint8_t old_value = cpu_regs.A; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x0F)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment
-			cpu_regs.A++;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.A after incrementing
-			if (cpu_regs.A == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
-
-
-		case 0x05: // DEC B
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
-
-			uint8_t old_value = cpu_regs.B; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x00)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment
-			cpu_regs.B--;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.B after incrementing
-			if (cpu_regs.B == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
-
-		case 0x0D: // DEC C
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
-
-			uint8_t old_value = cpu_regs.C; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x00)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment
-			cpu_regs.C--;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.C after incrementing
-			if (cpu_regs.C == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
-
-		case 0x15: // DEC D
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
-
-			uint8_t old_value = cpu_regs.D; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x00)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment
-			cpu_regs.D--;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.D after incrementing
-			if (cpu_regs.D == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
-
-		case 0x1D: // DEC E
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
-
-			uint8_t old_value = cpu_regs.E; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x00)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment
-			cpu_regs.E--;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.E after incrementing
-			if (cpu_regs.E == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
-
-		case 0x25: // DEC H
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
-
-			uint8_t old_value = cpu_regs.H; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x00)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment
-			cpu_regs.H--;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.H after incrementing
-			if (cpu_regs.H == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
-
-		case 0x2D: // DEC L
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
-
-			uint8_t old_value = cpu_regs.L; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x00)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment
-			cpu_regs.L--;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.LH after incrementing
-			if (cpu_regs.L == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
-
-		case 0x35: // DEC (HL) - Increment byte at memory address (HL)
-		{
-			// N Flag (Subtract): Always reset (0)
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			uint16_t hl_address = cpu_regs.HL; // Get the memory address from HL
-			uint8_t old_value_at_HL = mmu_read_byte(hl_address); // Read the byte from memory
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			if ((old_value_at_HL & 0x0F) == 0x00) {
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			} else {
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment on the value from memory
-			uint8_t new_value_at_HL = old_value_at_HL - 1; // Or old_value_at_HL++;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			if (new_value_at_HL == 0x00) {
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			} else {
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED
-
-			// Write the incremented value back to memory
-			mmu_write_byte(hl_address, new_value_at_HL);
-		}
-		break;
-
-		case 0x3D: // DEC A
-		{
-			// N Flag (Subtract): Always reset (0) for INC r8
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT); // Use FLAG_N_POS as per our macro discussion
-
-			uint8_t old_value = cpu_regs.A; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Set if carry from bit 3 to bit 4
-			// This occurs if the lower nibble (bits 0-3) was 0xF before incrementing.
-			if ((old_value & 0x0F) == 0x00)
-			{ // Check if the lower nibble is 0xF
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-			// Perform the actual increment
-			cpu_regs.A--;
-
-			// Z Flag (Zero): Set if the result is 0x00
-			// Check the NEW value of cpu_regs.A after incrementing
-			if (cpu_regs.A == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			// C Flag (Carry): NOT AFFECTED by INC r8
-		}
-		break;
-
-
-		case 0x06: //ld r8 imm8
-		{
-			cpu_regs.B = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-		}
-		break;
-
-		case 0x0E: //ld r8 imm8
-		{
-			cpu_regs.C = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-		}
-		break;
-
-		case 0x16: //ld r8 imm8
-		{
-			cpu_regs.D = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-		}
-		break;
-
-		case 0x1E: //ld r8 imm8
-		{
-			cpu_regs.E = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-		}
-		break;
-
-		case 0x26: //ld r8 imm8
-		{
-			cpu_regs.H = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-		}
-		break;
-
-		case 0x2E: //ld r8 imm8
-		{
-			cpu_regs.L = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-		}
-		break;
-
-		case 0x36: //ld r8 imm8
-		{
-			mmu_write_byte(cpu_regs.HL, mmu_read_byte(cpu_regs.PC));
-			cpu_regs.PC++;
-		}
-		break;
-
-		case 0x3E: //ld r8 imm8
-		{
-			cpu_regs.A = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-		}
-		break;
-
-		case 0x07: //Rotate Left Circular Accumulator
-		{
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			uint8_t value = cpu_regs.A; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Not affected
-
-			if (CHK_BIT(value, 7))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			// Perform the actual increment
-
-			cpu_regs.A = (cpu_regs.A << 1 | value >> 7);
-
-		}
-		break;
-
-		case 0x0F: //rrca
-		{
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			uint8_t value = cpu_regs.A; // Store original value for Half Carry check
-
-			// H Flag (Half Carry): Not affected
-
-			if (CHK_BIT(value, 0))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			// Perform the actual increment
-
-			cpu_regs.A = (cpu_regs.A >> 1 | value << 7);
-
-		}
-		break;
-
-		case 0x17: //rla
-		{
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			uint8_t value = cpu_regs.A; // Store original value for Half Carry check
-
-			cpu_regs.A = cpu_regs.A << 1;
-			if (CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT))
-			{
-				SET_BIT(cpu_regs.A, 0);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.A, 0);
-			}
-
-			// H Flag (Half Carry): Not affected
-
-			if (CHK_BIT(value, 7))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-		}
-		break;
-
-		case 0x1F: //rra
-		{
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			uint8_t value = cpu_regs.A; // Store original value for Half Carry check
-
-			cpu_regs.A = cpu_regs.A >> 1;
-			if (CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT))
-			{
-				SET_BIT(cpu_regs.A, 7);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.A, 7);
-			}
-
-			// H Flag (Half Carry): Not affected
-
-			if (CHK_BIT(value, 0))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-		}
-		break;
-
-		case 0x27: // DAA - Decimal Adjust Accumulator
-		{
-			// Capture the flags from the instruction executed immediately before DAA.
-			uint8_t flags_from_previous_instruction = cpu_regs.F;
-
-			// The Half-Carry (H) flag is always cleared by DAA.
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			// Branch based on whether the previous operation was subtraction (N=1) or addition (N=0).
-			if (CHK_BIT(flags_from_previous_instruction, CPU_FLAG_SUB_N_BIT))
-			{
-				/**
-				 * Subtraction Logic (N flag was SET):
-				 * Adjusts Accumulator (A) and flags after a binary subtraction to make it BCD.
-				 * Adjustments depend ONLY on the H and C flags from the previous instruction.
-				 */
-
-				// Check if Half-Carry (H) flag was set from previous instruction.
-				if( CHK_BIT(flags_from_previous_instruction, CPU_FLAG_HALF_H_BIT))
-				{
-					// Subtract 0x06 from Accumulator if H was set.
-					cpu_regs.A -= 0x06;
-				}
-
-				// Check if Carry (C) flag was set from previous instruction.
-				if(CHK_BIT(flags_from_previous_instruction, CPU_FLAG_CARRY_C_BIT))
-				{
-					// Subtract 0x60 from Accumulator if C was set.
-					cpu_regs.A -= 0x60;
-					// This line needs review for subtraction DAA.
-				}
-			}
-			else // N_FLAG is CLEAR, meaning an ADDITION was performed.
-			{
-				/**
-				 * Addition Logic (N flag was CLEAR):
-				 * Adjusts Accumulator (A) and flags after a binary addition to make it BCD.
-				 */
-
-				// Adjust lower nibble (bits 0-3) if H flag set OR lower nibble > 0x09.
-				if( (CHK_BIT(flags_from_previous_instruction, CPU_FLAG_HALF_H_BIT) ) || ((cpu_regs.A & 0x0F) > 0x09))
-				{
-					// Add 0x06 to the Accumulator.
-					cpu_regs.A += 0x06;
-				}
-
-				// Adjust upper nibble (bits 4-7) if C flag set OR Accumulator > 0x99.
-				// (Uses cpu_regs.A's value after potential lower nibble adjustment).
-				if((CHK_BIT(flags_from_previous_instruction, CPU_FLAG_CARRY_C_BIT) ) || (cpu_regs.A > 0x99))
-				{
-					// Add 0x60 to the Accumulator.
-					cpu_regs.A += 0x60;
-					// Set the Carry (C) flag.
-					SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-				}
-			}
-
-			// --- Final Flag Updates ---
-
-			// Clear Zero (Z) flag.
-			CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-
-			// Set Zero (Z) flag if Accumulator is 0x00.
-			if(cpu_regs.A == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			// N (Subtract) flag is UNCHANGED by DAA.
-			// H (Half Carry) flag is always cleared by DAA.
-			// C (Carry) flag is handled within addition/subtraction logic.
-		}
-		break;
-
-		case 0x2F: //cpl
-		{
-			uint8_t to_be_notted = cpu_regs.A;
-			cpu_regs.A = ~to_be_notted;
-
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-		}
-		break;
-
-		case 0x37: //Set Carry Flag
-		{
-			//SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-		}
-		break;
-
-		case 0x3F: //ccf
-		{
-			//SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			TOGGLE_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-		}
-		break;
-
-		case 0x18: //jr imm8
-		{
-			cpu_regs.PC++;
-			int8_t imm8 = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-			cpu_regs.PC += imm8;
-		}
-		break;
-
-		case 0x20: //jr nz, imm8
-		{
-			cpu_regs.PC++;
-			int8_t imm8 = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-
-			if (!(CHK_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT)))
-			{
-
-				cpu_regs.PC += imm8;
-			}
-		}
-		break;
-
-		case 0x28: //jr z, imm8
-		{
-			cpu_regs.PC++;
-			int8_t imm8 = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-
-			if (CHK_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT))
-			{
-
-				cpu_regs.PC += imm8;
-			}
-		}
-		break;
-
-		case 0x30: //jr nc, imm8
-		{
-			cpu_regs.PC++;
-			int8_t imm8 = mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-
-			if (!(CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT)))
-			{
-
-				cpu_regs.PC += imm8;
-			}
-		}
-		break;
-
-		case 0x38: //jr c, imm8
-		{
-			cpu_regs.PC++;
-			int8_t imm8 = (uint8_t)mmu_read_byte(cpu_regs.PC);
-			cpu_regs.PC++;
-
-			if (CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT))
-			{
-
-				cpu_regs.PC += imm8;
-			}
-		}
-		break;
-
-
-		case 0x10: //STOP
-		{
-			emulator_is_stopped = myTrue;
-			cpu_regs.PC += 2;
-
-		}
-		break;
-
-
-		//ld r8, r8
-		case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47:
-		case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F:
-		case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57:
-		case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
-		case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66: case 0x67:
-		case 0x68: case 0x69: case 0x6A: case 0x6B: case 0x6C: case 0x6D: case 0x6E: case 0x6F:
-		case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x77: case 0x78:
-		case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F:
-		{
-			uint8_t destin = (opcode & 0x38) >> 3;
-			uint8_t SSS = opcode & 0x07;
-
-			uint8_t source = get_register_value(SSS);
-
-			set_register_value(destin, source);
-
-		}
-		break;
-
-		case 0x76:
-		{
-			cpu_is_halted = myTrue;//halt
-		}
-		break;
-
-
-		case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87:
-		{
-			uint8_t source = (opcode & 0x07);
-			uint8_t original_A = cpu_regs.A;
-			uint8_t r8_value = get_register_value(source);
-
-			uint16_t result16 = (uint16_t)(original_A + r8_value);
-
-			if (result16 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if (((original_A & 0xF) + (r8_value & 0xF) ) > 0xF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-
-			if (result16 > 0xFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			cpu_regs.A = (uint8_t)result16;
-
-		}
-		break;
-
-		case 0x88: case 0x89: case 0x8A: case 0x8B: case 0x8C: case 0x8D: case 0x8E: case 0x8F:
-		{
-			uint8_t source = (opcode & 0x07);
-			uint8_t original_A = cpu_regs.A;
-			uint8_t r8_value = get_register_value(source);
-
-			uint8_t carry_in = CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-			uint16_t result16 = (uint16_t)(original_A + r8_value + carry_in);
-
-			if (result16 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if (((original_A & 0xF) + (r8_value & 0xF) + carry_in ) > 0xF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-
-			if (result16 > 0xFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			cpu_regs.A = (uint8_t)result16;
-
-		}
-		break;
-
-
-
-		case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97:
-		{
-			uint8_t source = (opcode & 0x07);
-			uint8_t original_A = cpu_regs.A;
-			uint8_t r8_value = get_register_value(source);
-
-			uint8_t result = original_A - r8_value;
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if ((original_A & 0xF) < (r8_value & 0xF))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-
-			if (original_A < r8_value)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			cpu_regs.A = result;
-
-		}
-		break;
-
-		case 0x98: case 0x99: case 0x9A: case 0x9B: case 0x9C: case 0x9D: case 0x9E: case 0x9F:
-		{
-			uint8_t source = (opcode & 0x07);
-			uint8_t original_A = cpu_regs.A;
-			uint8_t r8_value = get_register_value(source);
-
-			uint8_t result = original_A - r8_value - CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if ((original_A & 0xF) < (r8_value & 0xF)+CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-
-			if (original_A < (r8_value + CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT)))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			cpu_regs.A = result;
-
-		}
-		break;
-
-
-		case 0xA0: case 0xA1: case 0xA2: case 0xA3: case 0xA4: case 0xA5: case 0xA6: case 0xA7:
-		{
-			uint8_t source = (opcode & 0x07);
-			uint8_t original_A = cpu_regs.A;
-			uint8_t r8_value = get_register_value(source);
-
-			uint8_t result = (uint16_t)(original_A & r8_value);
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-			cpu_regs.A = (uint8_t)result;
-
-		}
-		break;
-
-		case 0xA8: case 0xA9: case 0xAA: case 0xAB: case 0xAC: case 0xAD: case 0xAE: case 0xAF:
-		{
-			uint8_t source = (opcode & 0x07);
-			uint8_t original_A = cpu_regs.A;
-			uint8_t r8_value = get_register_value(source);
-
-			uint8_t result = (uint16_t)(original_A ^ r8_value);
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-			cpu_regs.A = (uint8_t)result;
-
-		}
-		break;
-
-		case 0xB0: case 0xB1: case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB6: case 0xB7:
-		{
-			uint8_t source = (opcode & 0x07);
-			uint8_t original_A = cpu_regs.A;
-			uint8_t r8_value = get_register_value(source);
-
-			uint8_t result = (uint16_t)(original_A | r8_value);
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-			cpu_regs.A = (uint8_t)result;
-
-		}
-		break;
-
-		case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF:
-		{
-			uint8_t source = (opcode & 0x07);
-			uint8_t original_A = cpu_regs.A;
-			uint8_t r8_value = get_register_value(source);
-
-			uint8_t result = original_A - r8_value;
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if ((original_A & 0xF) < (r8_value & 0xF))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-
-			if (original_A < r8_value)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-		}
-		break;
-
-// operations A, imm8
-		case 0xC6:
-		{
-			uint8_t original_A = cpu_regs.A;
-			uint8_t imm8_value = mmu_read_byte(cpu_regs.PC++);
-
-			uint16_t result16 = (uint16_t)(original_A + imm8_value);
-
-			if (result16 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if (((original_A & 0xF) + (imm8_value & 0xF) ) > 0xF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-
-			if (result16 > 0xFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			cpu_regs.A = (uint8_t)result16;
-
-		}
-		break;
-
-		case 0xCE:
-		{
-			uint8_t original_A = cpu_regs.A;
-			uint8_t imm8_value = mmu_read_byte(cpu_regs.PC++);
-
-			uint8_t carry_in = CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-			uint16_t result16 = (uint16_t)(original_A + imm8_value + carry_in);
-
-			if (result16 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if (((original_A & 0xF) + (imm8_value & 0xF) + carry_in ) > 0xF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-
-			if (result16 > 0xFF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			cpu_regs.A = (uint8_t)result16;
-
-		}
-		break;
-
-
-
-		case 0xD6:
-		{
-			uint8_t original_A = cpu_regs.A;
-			uint8_t imm8_value = mmu_read_byte(cpu_regs.PC++);
-
-			uint8_t result = original_A - imm8_value;
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if ((original_A & 0xF) < (imm8_value & 0xF))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-
-			if (original_A < imm8_value)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			cpu_regs.A = result;
-
-		}
-		break;
-
-		case 0xDE:
-		{
-			uint8_t original_A = cpu_regs.A;
-			uint8_t imm8_value = mmu_read_byte(cpu_regs.PC++);
-
-			uint8_t result = original_A - imm8_value - CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if ((original_A & 0xF) < (imm8_value & 0xF)+CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-
-			if (original_A < (imm8_value + CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT)))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			cpu_regs.A = result;
-
-		}
-		break;
-
-
-		case 0xE6:
-		{
-			uint8_t original_A = cpu_regs.A;
-			uint8_t imm8_value = mmu_read_byte(cpu_regs.PC++);
-
-			uint8_t result = (uint16_t)(original_A & imm8_value);
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-			cpu_regs.A = (uint8_t)result;
-
-		}
-		break;
-
-		case 0xEE:
-		{
-			uint8_t original_A = cpu_regs.A;
-			uint8_t imm8_value = mmu_read_byte(cpu_regs.PC++);
-
-			uint8_t result = (uint16_t)(original_A ^ imm8_value);
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-			cpu_regs.A = (uint8_t)result;
-
-		}
-		break;
-
-		case 0xF6:
-		{
-			uint8_t original_A = cpu_regs.A;
-			uint8_t imm8_value = mmu_read_byte(cpu_regs.PC++);
-
-			uint8_t result = (uint16_t)(original_A | imm8_value);
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-			cpu_regs.A = (uint8_t)result;
-
-		}
-		break;
-
-		case 0xFE:
-		{
-			uint8_t original_A = cpu_regs.A;
-			uint8_t imm8 = mmu_read_byte(cpu_regs.PC++);
-
-			uint8_t result = original_A - imm8;
-
-			if (result == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			SET_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if ((original_A & 0xF) < (imm8 & 0xF))
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-
-
-			if (original_A < imm8)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-		}
-		break;
-
-
-		case 0xC0: // RET COND
-		{
-			// Check the condition: if the Zero flag is NOT set
-			if (CHK_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT) == 0)
-			{
-				// 1. Read a 16-bit address from the stack (at cpu_regs.SP)
-				uint16_t return_address = mmu_read_word(cpu_regs.SP);
-
-				// 2. Increment the stack pointer by 2
-				cpu_regs.SP += 2;
-
-				// 3. Jump to that address
-				cpu_regs.PC = return_address;
-			}
-		}
-		break;
-
-		case 0xC8: // RET COND
-		{
-			// Check the condition: if the Zero flag is set
-			if (CHK_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT) == 1)
-			{
-				// 1. Read a 16-bit address from the stack (at cpu_regs.SP)
-				uint16_t return_address = mmu_read_word(cpu_regs.SP);
-
-				// 2. Increment the stack pointer by 2
-				cpu_regs.SP += 2;
-
-				// 3. Jump to that address
-				cpu_regs.PC = return_address;
-			}
-		}
-		break;
-
-		case 0xD0: // RET COND
-		{
-			// Check the condition: if the Carry flag is NOT set
-			if (CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT) == 0)
-			{
-				// 1. Read a 16-bit address from the stack (at cpu_regs.SP)
-				uint16_t return_address = mmu_read_word(cpu_regs.SP);
-
-				// 2. Increment the stack pointer by 2
-				cpu_regs.SP += 2;
-
-				// 3. Jump to that address
-				cpu_regs.PC = return_address;
-			}
-		}
-		break;
-
-		case 0xD8: // RET COND
-		{
-			// Check the condition: if the Carry flag is set
-			if (CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT) == 1)
-			{
-				// 1. Read a 16-bit address from the stack (at cpu_regs.SP)
-				uint16_t return_address = mmu_read_word(cpu_regs.SP);
-
-				// 2. Increment the stack pointer by 2
-				cpu_regs.SP += 2;
-
-				// 3. Jump to that address
-				cpu_regs.PC = return_address;
-			}
-		}
-		break;
-
-		case 0xC9: // RET
-		{
-			// 1. Read a 16-bit address from the stack (at cpu_regs.SP)
-			uint16_t return_address = mmu_read_word(cpu_regs.SP);
-
-			// 2. Increment the stack pointer by 2
-			cpu_regs.SP += 2;
-
-			// 3. Jump to that address
-			cpu_regs.PC = return_address;
-		}
-		break;
-
-		case 0xD9: // RETi
-		{
-			// 1. Read a 16-bit address from the stack (at cpu_regs.SP)
-			uint16_t return_address = mmu_read_word(cpu_regs.SP);
-
-			// 2. Increment the stack pointer by 2
-			cpu_regs.SP += 2;
-
-			// 3. Jump to that address
-			cpu_regs.PC = return_address;
-
-			// 4. IMPORTANT: Re-enable interrupts here.
-			interrupt_master_enable = myTrue;
-		}
-		break;
-
-		case 0xC2: //jp nz, imm16
-		{
-
-			int16_t imm16 = mmu_read_word(cpu_regs.PC);
-			cpu_regs.PC += 2;
-
-			if (!(CHK_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT)))
-			{
-
-				cpu_regs.PC = imm16;
-			}
-		}
-		break;
-
-		case 0xCA: //jp z, imm16
-		{
-
-			int16_t imm16 = mmu_read_word(cpu_regs.PC);
-			cpu_regs.PC += 2;
-
-			if ((CHK_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT)))
-			{
-
-				cpu_regs.PC = imm16;
-			}
-		}
-		break;
-
-		case 0xD2: //jp NC, imm16
-		{
-
-			int16_t imm16 = mmu_read_word(cpu_regs.PC);
-			cpu_regs.PC += 2;
-
-			if (!(CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT)))
-			{
-
-				cpu_regs.PC = imm16;
-			}
-		}
-		break;
-
-		case 0xDA: //jp C, imm16
-		{
-
-			int16_t imm16 = mmu_read_word(cpu_regs.PC);
-			cpu_regs.PC += 2;
-
-			if ((CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT)))
-			{
-
-				cpu_regs.PC = imm16;
-			}
-		}
-		break;
-
-		case 0xC3: //jp imm16
-		{
-
-			int16_t imm16 = mmu_read_word(cpu_regs.PC);
-			cpu_regs.PC = imm16;
-		}
-		break;
-
-		case 0xE9: //jp hl
-		{
-			cpu_regs.PC = cpu_regs.HL;
-		}
-		break;
-
-		case 0xC4: //call nz, imm16
-		{
-
-			int16_t imm16 = mmu_read_word(cpu_regs.PC);
-			cpu_regs.PC += 2;
-
-			if (!(CHK_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT)))
-			{
-				cpu_regs.SP -= 2;
-
-				mmu_write_word(cpu_regs.SP, cpu_regs.PC);
-
-				cpu_regs.PC = imm16;
-			}
-		}
-		break;
-
-		case 0xCC: //call z, imm16
-		{
-
-			int16_t imm16 = mmu_read_word(cpu_regs.PC);
-			cpu_regs.PC += 2;
-
-			if ((CHK_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT)))
-			{
-				cpu_regs.SP -= 2;
-
-				mmu_write_word(cpu_regs.SP, cpu_regs.PC);
-
-				cpu_regs.PC = imm16;
-			}
-		}
-		break;
-
-		case 0xD4: //call nc, imm16
-		{
-
-			int16_t imm16 = mmu_read_word(cpu_regs.PC);
-			cpu_regs.PC += 2;
-
-			if (!(CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT)))
-			{
-				cpu_regs.SP -= 2;
-
-				mmu_write_word(cpu_regs.SP, cpu_regs.PC);
-
-				cpu_regs.PC = imm16;
-			}
-		}
-		break;
-
-		case 0xDC: //call c, imm16
-		{
-
-			int16_t imm16 = mmu_read_word(cpu_regs.PC);
-			cpu_regs.PC += 2;
-
-			if ((CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT)))
-			{
-				cpu_regs.SP -= 2;
-
-				mmu_write_word(cpu_regs.SP, cpu_regs.PC);
-
-				cpu_regs.PC = imm16;
-			}
-		}
-		break;
-
-		case 0xCD: //call imm16
-		{
-
-			int16_t imm16 = mmu_read_word(cpu_regs.PC);
-			cpu_regs.PC += 2;
-			cpu_regs.SP -= 2;
+	gb->cpu_step_cycles += skipped_cycles;
+	gb->cpu_idle_skipped_cycles += skipped_cycles;
+}
+#endif
 
-			mmu_write_word(cpu_regs.SP, cpu_regs.PC);
+void cpu_idle_end_frame(gb_t *gb)
+{
+	gb->cpu_idle_skipped_cycles_last_frame = gb->cpu_idle_skipped_cycles;
+	gb->cpu_idle_skipped_cycles = 0;
+}
 
-			cpu_regs.PC = imm16;
+void cpu_interrupts_changed(gb_t *gb)
+{
+	gb->cpu_interrupts_pending = gb->interrupt_master_enable ? (gb->m_interrupt_flags & gb->interrupt_enable & MMU_INTERRUPT_FLAG_ALL) : 0x00;
+}
 
-		}
-		break;
+// ----------------------------------------------------------------------
+// dispatch_interrupt
+// Services the highest-priority pending interrupt (the lowest set bit of
+// cpu_interrupts_pending, VBlank first): acknowledges it in IF, clears
+// IME, wakes the CPU from HALT, pushes PC and jumps to its vector.
+// ----------------------------------------------------------------------
+static void dispatch_interrupt(gb_t *gb)
+{
+	uint8_t source = LOWEST_SET_BIT(gb->cpu_interrupts_pending);
 
-		 case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // rst 00h
-		{
-			int16_t RST = cpu_regs.PC;
-			cpu_regs.SP -= 2;
-			mmu_write_word(cpu_regs.SP, RST);
-
-			// Calculate the jump address from the opcode.
-			// The opcode is in the instruction_register (or similar variable from your fetch).
-			// We get the middle three bits (ttt) and multiply by 8.
-			uint8_t ttt = (opcode & 0x38) >> 3;
-			uint16_t jump_address = ttt * 8;
-
-			// Jump to the calculated address.
-			cpu_regs.PC = jump_address;
-		}
-		break;
+	gb->m_interrupt_flags &= (uint8_t)~BIT(source);
+	gb->interrupt_master_enable = myFalse;
+	gb->cpu_interrupts_pending = 0x00;
 
-//POP
+	// A block ending in HALT can be followed straight away by an interrupt
+	// that was already pending; the CPU must not stay halted in the handler.
+	gb->cpu_is_halted = myFalse;
 
-		 case 0xC1:
-		 {
-			 int16_t r16stk = mmu_read_word(cpu_regs.SP);
-			 cpu_regs.SP += 2;
+	gb->cpu_regs.SP -= 2;
+	mmu_write_word(gb, gb->cpu_regs.SP, gb->cpu_regs.PC);
+	gb->cpu_regs.PC = CPU_INTERRUPT_VECTOR_BASE + source * CPU_INTERRUPT_VECTOR_SPACING;
+	gb->cpu_step_cycles += CPU_INTERRUPT_DISPATCH_CYCLES;
+}
 
 
-			 cpu_regs.BC = r16stk;
+// ----------------------------------------------------------------------
+// Operand Encodings
+// The opcode bit fields select operands by number. These macros map
+// each number to its register so handlers can be generated per operand.
+//   r8  (bits 5-3 / 2-0): 0=B 1=C 2=D 3=E 4=H 5=L 6=(HL) 7=A
+//   r16 (bits 5-4):       0=BC 1=DE 2=HL 3=SP
+//   r16stk (bits 5-4):    0=BC 1=DE 2=HL 3=AF   (PUSH/POP)
+//   cc  (bits 4-3):       0=NZ 1=Z 2=NC 3=C
+// ----------------------------------------------------------------------
+#define R8_READ_0()			(gb->cpu_regs.B)
+#define R8_READ_1()			(gb->cpu_regs.C)
+#define R8_READ_2()			(gb->cpu_regs.D)
+#define R8_READ_3()			(gb->cpu_regs.E)
+#define R8_READ_4()			(gb->cpu_regs.H)
+#define R8_READ_5()			(gb->cpu_regs.L)
+#define R8_READ_6()			(mmu_read_byte(gb, gb->cpu_regs.HL))
+#define R8_READ_7()			(gb->cpu_regs.A)
+
+#define R8_WRITE_0(value)	(gb->cpu_regs.B = (value))
+#define R8_WRITE_1(value)	(gb->cpu_regs.C = (value))
+#define R8_WRITE_2(value)	(gb->cpu_regs.D = (value))
+#define R8_WRITE_3(value)	(gb->cpu_regs.E = (value))
+#define R8_WRITE_4(value)	(gb->cpu_regs.H = (value))
+#define R8_WRITE_5(value)	(gb->cpu_regs.L = (value))
+#define R8_WRITE_6(value)	(mmu_write_byte(gb, gb->cpu_regs.HL, (value)))
+#define R8_WRITE_7(value)	(gb->cpu_regs.A = (value))
+
+#define R16_0				(gb->cpu_regs.BC)
+#define R16_1				(gb->cpu_regs.DE)
+#define R16_2				(gb->cpu_regs.HL)
+#define R16_3				(gb->cpu_regs.SP)
+
+#define R16STK_READ_0()			(gb->cpu_regs.BC)
+#define R16STK_READ_1()			(gb->cpu_regs.DE)
+#define R16STK_READ_2()			(gb->cpu_regs.HL)
+#define R16STK_READ_3()			((uint16_t)((gb->cpu_regs.A << 8) | cpu_flags_resolve(gb)))
+
+#define R16STK_WRITE_0(value)	(gb->cpu_regs.BC = (value))
+#define R16STK_WRITE_1(value)	(gb->cpu_regs.DE = (value))
+#define R16STK_WRITE_2(value)	(gb->cpu_regs.HL = (value))
+#define R16STK_WRITE_3(value)	(gb->cpu_regs.A = (uint8_t)((value) >> 8), flags_set(gb, (uint8_t)(value))) // low nibble of F always reads 0
+
+#define COND_0()			(!flag_zero(gb))
+#define COND_1()			(flag_zero(gb))
+#define COND_2()			(!flag_carry(gb))
+#define COND_3()			(flag_carry(gb))
+
+// Expand X once per operand number (extra argument passed through first).
+#define FOR_EACH_R8(X, ARG)		X(ARG, 0) X(ARG, 1) X(ARG, 2) X(ARG, 3) X(ARG, 4) X(ARG, 5) X(ARG, 6) X(ARG, 7)
+#define FOR_EACH_R16(X)			X(0) X(1) X(2) X(3)
+#define FOR_EACH_COND(X)		X(0) X(1) X(2) X(3)
+#define FOR_EACH_RST(X)			X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7)
+
+// The eight accumulator ALU operations in bits 5-3 order.
+#define FOR_EACH_ALU_OP(X)		X(add, 0) X(adc, 1) X(sub, 2) X(sbc, 3) X(and, 4) X(xor, 5) X(or, 6) X(cp, 7)
+
+// The eight $CB rotates and shifts in bits 5-3 order.
+#define FOR_EACH_CB_SHIFT_OP(X)	X(rlc, 0) X(rrc, 1) X(rl, 2) X(rr, 3) X(sla, 4) X(sra, 5) X(swap, 6) X(srl, 7)
+
+// Bit numbers for BIT/RES/SET (bits 5-3). Same as FOR_EACH_R8, but a
+// separate macro so a row of FOR_EACH_R8 can be expanded inside it.
+#define FOR_EACH_BIT(X, ARG)	X(ARG, 0) X(ARG, 1) X(ARG, 2) X(ARG, 3) X(ARG, 4) X(ARG, 5) X(ARG, 6) X(ARG, 7)
+
+
+// ----------------------------------------------------------------------
+// Lazy Flags
+// ALU helpers call flags_record() with what they did instead of rebuilding
+// F one SET_BIT/CLR_BIT at a time. The byte is only worked out when it is
+// read: flag_zero()/flag_carry() answer conditional branches without
+// building the rest, cpu_flags_resolve() produces the whole of F.
+// ----------------------------------------------------------------------
+#define FLAG_Z		BIT(CPU_FLAG_ZERO_Z_BIT)
+#define FLAG_N		BIT(CPU_FLAG_SUB_N_BIT)
+#define FLAG_H		BIT(CPU_FLAG_HALF_H_BIT)
+#define FLAG_C		BIT(CPU_FLAG_CARRY_C_BIT)
+
+// Z from an 8-bit result, H from bit 4 of (a ^ b ^ result), C from bit 8 of result.
+#define FLAG_Z_FROM(result)			(((uint8_t)(result) == 0x00) ? FLAG_Z : 0x00)
+#define FLAG_H_FROM(a, b, result)	((((a) ^ (b) ^ (result)) & 0x10) << 1)
+#define FLAG_C_FROM(result)			(((result) & 0x100) >> 4)
+
+static void flags_record(gb_t *gb, uint8_t op, uint16_t operand_a, uint16_t operand_b, uint16_t result, uint8_t preserved)
+{
+	gb->cpu_lazy_flags.op = op;
+	gb->cpu_lazy_flags.operand_a = operand_a;
+	gb->cpu_lazy_flags.operand_b = operand_b;
+	gb->cpu_lazy_flags.result = result;
+	gb->cpu_lazy_flags.preserved = preserved;
+
+#if !CPU_LAZY_FLAGS
+	cpu_flags_resolve(gb);
+#endif
+}
 
-		 }
-		 break;
+// Replaces F outright, dropping anything pending.
+static void flags_set(gb_t *gb, uint8_t flags)
+{
+	gb->cpu_regs.F = flags & 0xF0;
+	gb->cpu_lazy_flags.op = CPU_LAZY_FLAGS_NONE;
+}
 
-		 case 0xD1:
-		 {
-			 int16_t r16stk = mmu_read_word(cpu_regs.SP);
-			 cpu_regs.SP += 2;
+uint8_t cpu_flags_resolve(gb_t *gb)
+{
+	uint16_t a = gb->cpu_lazy_flags.operand_a;
+	uint16_t b = gb->cpu_lazy_flags.operand_b;
+	uint16_t result = gb->cpu_lazy_flags.result;
+	uint8_t flags;
 
+	switch (gb->cpu_lazy_flags.op)
+	{
+		case CPU_LAZY_FLAGS_ADD:
+			flags = FLAG_Z_FROM(result) | FLAG_H_FROM(a, b, result) | FLAG_C_FROM(result);
+			break;
 
-			 cpu_regs.DE = r16stk;
+		case CPU_LAZY_FLAGS_SUB:
+			flags = FLAG_Z_FROM(result) | FLAG_N | FLAG_H_FROM(a, b, result) | FLAG_C_FROM(result);
+			break;
 
-		 }
-		 break;
+		case CPU_LAZY_FLAGS_AND:
+			flags = FLAG_Z_FROM(result) | FLAG_H;
+			break;
 
-		 case 0xE1:
-		 {
-			 int16_t r16stk = mmu_read_word(cpu_regs.SP);
-			 cpu_regs.SP += 2;
+		case CPU_LAZY_FLAGS_OR:
+			flags = FLAG_Z_FROM(result);
+			break;
 
+		case CPU_LAZY_FLAGS_INC:
+			flags = FLAG_Z_FROM(result) | (((result & 0x0F) == 0x00) ? FLAG_H : 0x00) | gb->cpu_lazy_flags.preserved;
+			break;
 
-			 cpu_regs.HL = r16stk;
-
-		 }
-		 break;
-
-		 case 0xF1:
-		 {
-			 int16_t r16stk = mmu_read_word(cpu_regs.SP);
-			 cpu_regs.SP += 2;
+		case CPU_LAZY_FLAGS_DEC:
+			flags = FLAG_Z_FROM(result) | FLAG_N | (((result & 0x0F) == 0x0F) ? FLAG_H : 0x00) | gb->cpu_lazy_flags.preserved;
+			break;
 
+		case CPU_LAZY_FLAGS_SHIFT:
+			flags = FLAG_Z_FROM(result) | gb->cpu_lazy_flags.preserved;
+			break;
 
-			 cpu_regs.AF = r16stk & 0xFFF0;
+		case CPU_LAZY_FLAGS_ADD16:
+			flags = gb->cpu_lazy_flags.preserved
+					| ((((a & 0x0FFF) + (b & 0x0FFF)) > 0x0FFF) ? FLAG_H : 0x00)
+					| ((((uint32_t)a + b) > 0xFFFF) ? FLAG_C : 0x00);
+			break;
 
-		 }
-		 break;
+		case CPU_LAZY_FLAGS_ADD_SP:
+			flags = FLAG_H_FROM(a, b, result) | FLAG_C_FROM(a ^ b ^ result);
+			break;
 
+		case CPU_LAZY_FLAGS_NONE:
+		default:
+			return gb->cpu_regs.F;
+	}
 
-//PUSH
+	flags_set(gb, flags);
+	return flags;
+}
 
-		 case 0xC5:
-		 {
-			 cpu_regs.SP -= 2;
-			 mmu_write_word(cpu_regs.SP, cpu_regs.BC);
-		 }
-		 break;
+static myBool flag_zero(gb_t *gb)
+{
+	switch (gb->cpu_lazy_flags.op)
+	{
+		case CPU_LAZY_FLAGS_NONE:	return CHK_BIT(gb->cpu_regs.F, CPU_FLAG_ZERO_Z_BIT) != 0;
+		case CPU_LAZY_FLAGS_ADD16:	return (gb->cpu_lazy_flags.preserved & FLAG_Z) != 0;
+		case CPU_LAZY_FLAGS_ADD_SP:	return myFalse;
+		default:					return (uint8_t)gb->cpu_lazy_flags.result == 0x00;
+	}
+}
 
-		 case 0xD5:
-		 {
-			 cpu_regs.SP -= 2;
-			 mmu_write_word(cpu_regs.SP, cpu_regs.DE);
-		 }
-		 break;
+static myBool flag_carry(gb_t *gb)
+{
+	switch (gb->cpu_lazy_flags.op)
+	{
+		case CPU_LAZY_FLAGS_NONE:	return CHK_BIT(gb->cpu_regs.F, CPU_FLAG_CARRY_C_BIT) != 0;
+		case CPU_LAZY_FLAGS_ADD:
+		case CPU_LAZY_FLAGS_SUB:	return (gb->cpu_lazy_flags.result & 0x100) != 0;
+		case CPU_LAZY_FLAGS_AND:
+		case CPU_LAZY_FLAGS_OR:		return myFalse;
+		case CPU_LAZY_FLAGS_ADD16:	return ((uint32_t)gb->cpu_lazy_flags.operand_a + gb->cpu_lazy_flags.operand_b) > 0xFFFF;
+		case CPU_LAZY_FLAGS_ADD_SP:	return ((gb->cpu_lazy_flags.operand_a ^ gb->cpu_lazy_flags.operand_b ^ gb->cpu_lazy_flags.result) & 0x100) != 0;
+		default:					return (gb->cpu_lazy_flags.preserved & FLAG_C) != 0;
+	}
+}
 
-		 case 0xE5:
-		 {
-			 cpu_regs.SP -= 2;
-			 mmu_write_word(cpu_regs.SP, cpu_regs.HL);
-		 }
-		 break;
 
-		 case 0xF5:
-		 {
-			 cpu_regs.SP -= 2;
-			 mmu_write_word(cpu_regs.SP, cpu_regs.AF);
+// ----------------------------------------------------------------------
+// ALU Helpers
+// Shared by the generated 8-bit and 16-bit arithmetic handlers.
+// ----------------------------------------------------------------------
+static void alu_add(gb_t *gb, uint8_t value)
+{
+	uint16_t result16 = (uint16_t)(gb->cpu_regs.A + value);
+	flags_record(gb, CPU_LAZY_FLAGS_ADD, gb->cpu_regs.A, value, result16, 0x00);
+	gb->cpu_regs.A = (uint8_t)result16;
+}
 
-		 }
-		 break;
-//end PUSH
+static void alu_adc(gb_t *gb, uint8_t value)
+{
+	uint16_t result16 = (uint16_t)(gb->cpu_regs.A + value + flag_carry(gb));
+	flags_record(gb, CPU_LAZY_FLAGS_ADD, gb->cpu_regs.A, value, result16, 0x00);
+	gb->cpu_regs.A = (uint8_t)result16;
+}
 
-//$CB prefix special case
-		 case 0xCB:
-		 {
-			 uint8_t prefixed_opcode = mmu_read_byte(cpu_regs.PC);
-			 cpu_regs.PC++;
-			 execute_prefix_instruction(prefixed_opcode);
-		 }
-		 break;
-//end $CB prefix special case
+static void alu_sub(gb_t *gb, uint8_t value)
+{
+	uint16_t result16 = (uint16_t)(gb->cpu_regs.A - value);
+	flags_record(gb, CPU_LAZY_FLAGS_SUB, gb->cpu_regs.A, value, result16, 0x00);
+	gb->cpu_regs.A = (uint8_t)result16;
+}
 
+static void alu_sbc(gb_t *gb, uint8_t value)
+{
+	uint16_t result16 = (uint16_t)(gb->cpu_regs.A - value - flag_carry(gb));
+	flags_record(gb, CPU_LAZY_FLAGS_SUB, gb->cpu_regs.A, value, result16, 0x00);
+	gb->cpu_regs.A = (uint8_t)result16;
+}
 
-		 case 0xE2:
-		 {
-			 mmu_write_byte(0xFF00 + cpu_regs.C, cpu_regs.A);
-		 }
-		 break;
+// CP is a SUB that throws the result away.
+static void alu_cp(gb_t *gb, uint8_t value)
+{
+	flags_record(gb, CPU_LAZY_FLAGS_SUB, gb->cpu_regs.A, value, (uint16_t)(gb->cpu_regs.A - value), 0x00);
+}
 
-		 case 0xE0:
-		 {
-			 uint8_t imm8 = mmu_read_byte(cpu_regs.PC++);
-			 mmu_write_byte(0xFF00 + imm8, cpu_regs.A);
-		 }
-		 break;
+static void alu_and(gb_t *gb, uint8_t value)
+{
+	gb->cpu_regs.A &= value;
+	flags_record(gb, CPU_LAZY_FLAGS_AND, 0, 0, gb->cpu_regs.A, 0x00);
+}
 
-		 case 0xEA:
-		 {
-			 uint16_t address = mmu_read_byte(cpu_regs.PC++);
-			 address |= (mmu_read_byte(cpu_regs.PC++) << 8);
-			 mmu_write_byte(address, cpu_regs.A);
-		 }
-		 break;
+static void alu_xor(gb_t *gb, uint8_t value)
+{
+	gb->cpu_regs.A ^= value;
+	flags_record(gb, CPU_LAZY_FLAGS_OR, 0, 0, gb->cpu_regs.A, 0x00);
+}
 
-		 case 0xF2:
-		 {
-			 cpu_regs.A = mmu_read_byte(0xFF00 + cpu_regs.C);
-		 }
-		 break;
+static void alu_or(gb_t *gb, uint8_t value)
+{
+	gb->cpu_regs.A |= value;
+	flags_record(gb, CPU_LAZY_FLAGS_OR, 0, 0, gb->cpu_regs.A, 0x00);
+}
 
-		 case 0xF0:
-		 {
-			 uint8_t imm8 = mmu_read_byte(cpu_regs.PC++);
-			 cpu_regs.A = mmu_read_byte(0xFF00 + imm8);
-		 }
-		 break;
+// INC r8: N=0, H on carry out of bit 3, Z from the result, C not affected.
+static uint8_t alu_inc(gb_t *gb, uint8_t old_value)
+{
+	uint8_t new_value = old_value + 1;
+	flags_record(gb, CPU_LAZY_FLAGS_INC, old_value, 1, new_value, flag_carry(gb) ? FLAG_C : 0x00);
+	return new_value;
+}
 
-		 case 0xFA:
-		 {
-			 uint16_t imm16 = mmu_read_byte(cpu_regs.PC++);
-			 imm16 |= (mmu_read_byte(cpu_regs.PC++) << 8);
-			 cpu_regs.A = mmu_read_byte(imm16);
-		 }
-		 break;
-
-		 case 0xE8:
-		 {
-			int8_t imm8 = (int8_t)mmu_read_byte(cpu_regs.PC++);
-			uint16_t original_SP = cpu_regs.SP;
-
-			cpu_regs.SP += imm8;
-
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-
-			if ((original_SP ^ cpu_regs.SP ^ imm8) & 0x1000)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
+// DEC r8: N=1, H on borrow from bit 4, Z from the result, C not affected.
+static uint8_t alu_dec(gb_t *gb, uint8_t old_value)
+{
+	uint8_t new_value = old_value - 1;
+	flags_record(gb, CPU_LAZY_FLAGS_DEC, old_value, 1, new_value, flag_carry(gb) ? FLAG_C : 0x00);
+	return new_value;
+}
 
+// ADD HL, r16: N=0, H on carry out of bit 11, C on carry out of bit 15, Z not affected.
+static void alu_add_hl(gb_t *gb, uint16_t value)
+{
+	uint16_t old_HL = gb->cpu_regs.HL;
+	gb->cpu_regs.HL = old_HL + value;
+	flags_record(gb, CPU_LAZY_FLAGS_ADD16, old_HL, value, gb->cpu_regs.HL, flag_zero(gb) ? FLAG_Z : 0x00);
+}
 
-			if ((original_SP ^ cpu_regs.SP ^ imm8) & 0x100)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
+// SP + signed imm8 (ADD SP,e8 and LD HL,SP+e8): Z=0, N=0, H/C from the low byte.
+static uint16_t alu_add_sp_imm8(gb_t *gb, int8_t imm8)
+{
+	uint16_t result = gb->cpu_regs.SP + imm8;
+	flags_record(gb, CPU_LAZY_FLAGS_ADD_SP, gb->cpu_regs.SP, (uint16_t)imm8, result, 0x00);
+	return result;
+}
 
-		 }
-		 break;
+// $CB rotates and shifts: Z from the result, N=0, H=0, C from the bit shifted out.
+static uint8_t alu_shift_result(gb_t *gb, uint8_t result, myBool carry_out)
+{
+	flags_record(gb, CPU_LAZY_FLAGS_SHIFT, 0, 0, result, carry_out ? FLAG_C : 0x00);
+	return result;
+}
 
-		 case 0xF8:
-		 {
-			uint16_t original_SP = cpu_regs.SP;
-			int8_t imm8 = (int8_t)mmu_read_byte(cpu_regs.PC++);
-			cpu_regs.HL = cpu_regs.SP + imm8;
+// Shift left by 1, and set bit 0 to the old bit 7.
+static uint8_t alu_rlc(gb_t *gb, uint8_t r8)
+{
+	return alu_shift_result(gb, (r8 << 1) | (r8 >> 7), r8 >> 7);
+}
 
+// Shift right by 1, and set bit 7 to the old bit 0.
+static uint8_t alu_rrc(gb_t *gb, uint8_t r8)
+{
+	return alu_shift_result(gb, (r8 >> 1) | (r8 << 7), r8 & 0x01);
+}
 
-			CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
+// Shift left by 1, and set bit 0 to the old carry.
+static uint8_t alu_rl(gb_t *gb, uint8_t r8)
+{
+	return alu_shift_result(gb, (r8 << 1) | (flag_carry(gb) ? 0x01 : 0x00), r8 >> 7);
+}
 
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
+// Shift right by 1, and set bit 7 to the old carry.
+static uint8_t alu_rr(gb_t *gb, uint8_t r8)
+{
+	return alu_shift_result(gb, (r8 >> 1) | (flag_carry(gb) ? 0x80 : 0x00), r8 & 0x01);
+}
 
-			if ((original_SP ^ cpu_regs.HL ^ imm8) & 0x1000)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-			}
+static uint8_t alu_sla(gb_t *gb, uint8_t r8)
+{
+	return alu_shift_result(gb, r8 << 1, r8 >> 7);
+}
 
+// Arithmetic shift: bit 7 keeps its value.
+static uint8_t alu_sra(gb_t *gb, uint8_t r8)
+{
+	return alu_shift_result(gb, (r8 >> 1) | (r8 & 0x80), r8 & 0x01);
+}
 
-			if ((original_SP ^ cpu_regs.HL ^ imm8) & 0x100)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
+// Exchange the high and low nibbles; C is cleared.
+static uint8_t alu_swap(gb_t *gb, uint8_t r8)
+{
+	return alu_shift_result(gb, (r8 >> 4) | (r8 << 4), myFalse);
+}
 
-		 }
-		 break;
+static uint8_t alu_srl(gb_t *gb, uint8_t r8)
+{
+	return alu_shift_result(gb, r8 >> 1, r8 & 0x01);
+}
 
-		 case 0xF9:
-		 {
-			 cpu_regs.SP = cpu_regs.HL;
-		 }
-		 break;
+// BIT b: Z is set if the tested bit is clear, N=0, H=1, C is kept.
+static void alu_bit(gb_t *gb, uint8_t tested_bit)
+{
+	flags_set(gb, (tested_bit ? 0x00 : FLAG_Z) | FLAG_H | (flag_carry(gb) ? FLAG_C : 0x00));
+}
 
-		 case 0xF3:
-		 {
-			 interrupt_master_enable = myFalse;
-		 }
-		 break;
+static void stack_push(gb_t *gb, uint16_t value)
+{
+	gb->cpu_regs.SP -= 2;
+	mmu_write_word(gb, gb->cpu_regs.SP, value);
+}
 
-		 case 0xFB:
-		 {
-			 interrupt_master_enable = myTrue;
-		 }
-		 break;
+static uint16_t stack_pop(gb_t *gb)
+{
+	uint16_t value = mmu_read_word(gb, gb->cpu_regs.SP);
+	gb->cpu_regs.SP += 2;
+	return value;
+}
 
-		 //'m to find my way to where i'm working
 
-		default:
-		{    // A default case for opcodes is critical for debugging.
-		    // If we hit this, it means the program is trying to execute an
-		    // instruction that is either unimplemented or invalid.
-		    printf("Error: Unhandled opcode 0x%02X at address 0x%04X\n", opcode, cpu_regs.PC);
-		    // You should then halt the program's execution to prevent
-		    // running invalid code and corrupting the emulator's state.
-		    exit(1);
-		}
-		break;
+// ----------------------------------------------------------------------
+// Generated Handlers
+// One function per opcode, produced from the bit-field macros above.
+// ----------------------------------------------------------------------
+
+// ld r16, imm16 (00rr0001)
+#define DEFINE_LD_R16_IMM16(RR) \
+	static void op_ld_r16_imm16_##RR(gb_t *gb, uint8_t opcode) { (void)opcode; R16_##RR = read_imm16(gb); }
+FOR_EACH_R16(DEFINE_LD_R16_IMM16)
+
+// inc r16 (00rr0011)
+#define DEFINE_INC_R16(RR) \
+	static void op_inc_r16_##RR(gb_t *gb, uint8_t opcode) { (void)opcode; R16_##RR++; }
+FOR_EACH_R16(DEFINE_INC_R16)
+
+// dec r16 (00rr1011)
+#define DEFINE_DEC_R16(RR) \
+	static void op_dec_r16_##RR(gb_t *gb, uint8_t opcode) { (void)opcode; R16_##RR--; }
+FOR_EACH_R16(DEFINE_DEC_R16)
+
+// add hl, r16 (00rr1001)
+#define DEFINE_ADD_HL_R16(RR) \
+	static void op_add_hl_r16_##RR(gb_t *gb, uint8_t opcode) { (void)opcode; alu_add_hl(gb, R16_##RR); }
+FOR_EACH_R16(DEFINE_ADD_HL_R16)
+
+// inc r8 (00ddd100)
+#define DEFINE_INC_R8(UNUSED, D) \
+	static void op_inc_r8_##D(gb_t *gb, uint8_t opcode) { (void)opcode; R8_WRITE_##D(alu_inc(gb, R8_READ_##D())); }
+FOR_EACH_R8(DEFINE_INC_R8, _)
+
+// dec r8 (00ddd101)
+#define DEFINE_DEC_R8(UNUSED, D) \
+	static void op_dec_r8_##D(gb_t *gb, uint8_t opcode) { (void)opcode; R8_WRITE_##D(alu_dec(gb, R8_READ_##D())); }
+FOR_EACH_R8(DEFINE_DEC_R8, _)
+
+// ld r8, imm8 (00ddd110)
+#define DEFINE_LD_R8_IMM8(UNUSED, D) \
+	static void op_ld_r8_imm8_##D(gb_t *gb, uint8_t opcode) { (void)opcode; R8_WRITE_##D(read_imm8(gb)); }
+FOR_EACH_R8(DEFINE_LD_R8_IMM8, _)
+
+// ld r8, r8 (01dddsss), 01110110 is HALT and is left out
+#define DEFINE_LD_R8_R8(D, S) \
+	static void op_ld_r8_r8_##D##S(gb_t *gb, uint8_t opcode) { (void)opcode; R8_WRITE_##D(R8_READ_##S()); }
+#define DEFINE_LD_R8_R8_ROW(UNUSED, D) FOR_EACH_R8(DEFINE_LD_R8_R8, D)
+DEFINE_LD_R8_R8_ROW(_, 0)
+DEFINE_LD_R8_R8_ROW(_, 1)
+DEFINE_LD_R8_R8_ROW(_, 2)
+DEFINE_LD_R8_R8_ROW(_, 3)
+DEFINE_LD_R8_R8_ROW(_, 4)
+DEFINE_LD_R8_R8_ROW(_, 5)
+DEFINE_LD_R8_R8(6, 0) DEFINE_LD_R8_R8(6, 1) DEFINE_LD_R8_R8(6, 2) DEFINE_LD_R8_R8(6, 3)
+DEFINE_LD_R8_R8(6, 4) DEFINE_LD_R8_R8(6, 5) DEFINE_LD_R8_R8(6, 7)
+DEFINE_LD_R8_R8_ROW(_, 7)
+
+// alu a, r8 (10ooosss)
+#define DEFINE_ALU_R8(OP, S) \
+	static void op_##OP##_r8_##S(gb_t *gb, uint8_t opcode) { (void)opcode; alu_##OP(gb, R8_READ_##S()); }
+#define DEFINE_ALU_R8_ROW(OP, IDX) FOR_EACH_R8(DEFINE_ALU_R8, OP)
+FOR_EACH_ALU_OP(DEFINE_ALU_R8_ROW)
+
+// alu a, imm8 (11ooo110)
+#define DEFINE_ALU_IMM8(OP, IDX) \
+	static void op_##OP##_imm8(gb_t *gb, uint8_t opcode) { (void)opcode; alu_##OP(gb, read_imm8(gb)); }
+FOR_EACH_ALU_OP(DEFINE_ALU_IMM8)
+
+// jr cc, imm8 (001cc000)
+#define DEFINE_JR_CC(CC) \
+	static void op_jr_cc_##CC(gb_t *gb, uint8_t opcode) \
+	{ \
+		int8_t imm8 = (int8_t)read_imm8(gb); \
+		if (COND_##CC()) \
+		{ \
+			gb->cpu_regs.PC += imm8; \
+			BRANCH_TAKEN(opcode); \
+		} \
+	}
+FOR_EACH_COND(DEFINE_JR_CC)
+
+// ret cc (110cc000)
+#define DEFINE_RET_CC(CC) \
+	static void op_ret_cc_##CC(gb_t *gb, uint8_t opcode) \
+	{ \
+		if (COND_##CC()) \
+		{ \
+			gb->cpu_regs.PC = stack_pop(gb); \
+			BRANCH_TAKEN(opcode); \
+		} \
 	}
+FOR_EACH_COND(DEFINE_RET_CC)
+
+// jp cc, imm16 (110cc010)
+#define DEFINE_JP_CC(CC) \
+	static void op_jp_cc_##CC(gb_t *gb, uint8_t opcode) \
+	{ \
+		uint16_t imm16 = read_imm16(gb); \
+		if (COND_##CC()) \
+		{ \
+			gb->cpu_regs.PC = imm16; \
+			BRANCH_TAKEN(opcode); \
+		} \
+	}
+FOR_EACH_COND(DEFINE_JP_CC)
+
+// call cc, imm16 (110cc100)
+#define DEFINE_CALL_CC(CC) \
+	static void op_call_cc_##CC(gb_t *gb, uint8_t opcode) \
+	{ \
+		uint16_t imm16 = read_imm16(gb); \
+		if (COND_##CC()) \
+		{ \
+			stack_push(gb, gb->cpu_regs.PC); \
+			gb->cpu_regs.PC = imm16; \
+			BRANCH_TAKEN(opcode); \
+		} \
+	}
+FOR_EACH_COND(DEFINE_CALL_CC)
+
+// pop r16stk (11rr0001)
+#define DEFINE_POP(RR) \
+	static void op_pop_##RR(gb_t *gb, uint8_t opcode) { (void)opcode; uint16_t value = stack_pop(gb); R16STK_WRITE_##RR(value); }
+FOR_EACH_R16(DEFINE_POP)
+
+// push r16stk (11rr0101)
+#define DEFINE_PUSH(RR) \
+	static void op_push_##RR(gb_t *gb, uint8_t opcode) { (void)opcode; stack_push(gb, R16STK_READ_##RR()); }
+FOR_EACH_R16(DEFINE_PUSH)
+
+// rst tgt3 (11ttt111), jumps to ttt * 8
+#define DEFINE_RST(T) \
+	static void op_rst_##T(gb_t *gb, uint8_t opcode) \
+	{ \
+		(void)opcode; \
+		stack_push(gb, gb->cpu_regs.PC); \
+		gb->cpu_regs.PC = (T) * 8; \
+	}
+FOR_EACH_RST(DEFINE_RST)
 
 
+// ----------------------------------------------------------------------
+// Individual Handlers
+// Opcodes without a regular operand field.
+// ----------------------------------------------------------------------
+static void op_nop(gb_t *gb, uint8_t opcode)
+{
+	// No operation needed
+	(void)gb;
+	(void)opcode;
 }
 
-static uint16_t read_imm16()
+static void op_ld_mem_bc_a(gb_t *gb, uint8_t opcode) // ld (BC), A
 {
-    uint8_t lsb = mmu_read_byte(cpu_regs.PC);
-    cpu_regs.PC++; // Increment PC after reading LSB
-    uint8_t msb = mmu_read_byte(cpu_regs.PC);
-    cpu_regs.PC++; // Increment PC after reading MSB
-    return lsb | (msb << 8); // Combine bytes (little-endian)
+	(void)opcode;
+	mmu_write_byte(gb, gb->cpu_regs.BC, gb->cpu_regs.A);
 }
 
-static void write_imm16(uint16_t address, uint16_t value)
+static void op_ld_mem_de_a(gb_t *gb, uint8_t opcode) // ld (DE), A
 {
-    // Write the Low Byte of SP to target_address
-    mmu_write_byte(address, (uint8_t)(value & 0x00FF));
-
-    // Write the High Byte of SP to target_address + 1
-    mmu_write_byte(address + 1, (uint8_t)((value >> 8) & 0x00FF));
+	(void)opcode;
+	mmu_write_byte(gb, gb->cpu_regs.DE, gb->cpu_regs.A);
 }
 
+static void op_ld_mem_hli_a(gb_t *gb, uint8_t opcode) // ld (HL+), A
+{
+	(void)opcode;
+	mmu_write_byte(gb, gb->cpu_regs.HL++, gb->cpu_regs.A);
+}
 
-// Assuming cpu_regs and mmu_read_byte are accessible globally or passed appropriately.
-// For simplicity, assuming cpu_regs is a global struct or extern.
-// You might need to adjust based on your actual CPU struct and MMU function.
-
-// Example CPU registers struct (adjust to your actual definition)
-// extern struct CPU_Registers {
-//     uint8_t B, C, D, E, H, L, A;
-//     uint8_t F; // Flags register
-//     uint16_t SP, PC;
-//     // ... other fields
-// } cpu_regs;
+static void op_ld_mem_hld_a(gb_t *gb, uint8_t opcode) // ld (HL-), A
+{
+	(void)opcode;
+	mmu_write_byte(gb, gb->cpu_regs.HL--, gb->cpu_regs.A);
+}
 
-// Example MMU read function (adjust to your actual definition)
-// extern uint8_t mmu_read_byte(uint16_t address);
-uint8_t get_register_value(uint8_t reg_code)
+static void op_ld_a_mem_bc(gb_t *gb, uint8_t opcode) // ld a, (BC)
 {
-    switch (reg_code)
-    {
-        case 0x0: return cpu_regs.B;
-        case 0x1: return cpu_regs.C;
-        case 0x2: return cpu_regs.D;
-        case 0x3: return cpu_regs.E;
-        case 0x4: return cpu_regs.H;
-        case 0x5: return cpu_regs.L;
-        case 0x6: return mmu_read_byte(cpu_regs.HL); // (HL) refers to memory at HL
-        case 0x7: return cpu_regs.A;
-        default:
-            // This case should ideally not be reached with valid opcodes
-            // You might want to add error logging or assertion here.
-            return 0xFF; // Return a dummy value or indicate an error
-    }
+	(void)opcode;
+	gb->cpu_regs.A = mmu_read_byte(gb, gb->cpu_regs.BC);
 }
 
-// Assuming cpu_regs and mmu_write_byte are accessible globally or passed appropriately.
-// Example CPU registers struct (adjust to your actual definition)
-// extern struct CPU_Registers {
-//     uint8_t B, C, D, E, H, L, A;
-//     uint8_t F; // Flags register
-//     uint16_t SP, PC;
-//     uint16_t HL; // Assuming HL is a direct member or computed from H/L
-//     // ... other fields
-// } cpu_regs;
+static void op_ld_a_mem_de(gb_t *gb, uint8_t opcode) // ld a, (DE)
+{
+	(void)opcode;
+	gb->cpu_regs.A = mmu_read_byte(gb, gb->cpu_regs.DE);
+}
 
-// Example MMU write function (adjust to your actual definition)
-// extern void mmu_write_byte(uint16_t address, uint8_t value);
-void set_register_value(uint8_t reg_code, uint8_t value)
+static void op_ld_a_mem_hli(gb_t *gb, uint8_t opcode) // ld a, (HL+)
 {
-    switch (reg_code)
-    {
-        case 0x0: cpu_regs.B = value; break;
-        case 0x1: cpu_regs.C = value; break;
-        case 0x2: cpu_regs.D = value; break;
-        case 0x3: cpu_regs.E = value; break;
-        case 0x4: cpu_regs.H = value; break;
-        case 0x5: cpu_regs.L = value; break;
-        case 0x6: mmu_write_byte(cpu_regs.HL, value); break; // (HL) refers to memory at HL
-        case 0x7: cpu_regs.A = value; break;
-        default:
-            // This case should ideally not be reached with valid opcodes
-            // You might want to add error logging or assertion here.
-            break;
-    }
+	(void)opcode;
+	gb->cpu_regs.A = mmu_read_byte(gb, gb->cpu_regs.HL++);
 }
 
-void execute_prefix_instruction (uint8_t prefixed_opcode)
+static void op_ld_a_mem_hld(gb_t *gb, uint8_t opcode) // ld a, (HL-)
 {
-	switch (prefixed_opcode)
-	{
-		case 0x00: case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06: case 0x07:
-		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint8_t r8 = get_register_value(reg_code);
+	(void)opcode;
+	gb->cpu_regs.A = mmu_read_byte(gb, gb->cpu_regs.HL--);
+}
 
-			uint8_t bit7 = (r8 >> 7);
+static void op_ld_mem_imm16_sp(gb_t *gb, uint8_t opcode) // LD (imm16), SP
+{
+	(void)opcode;
+	uint16_t target_address = read_imm16(gb);
+	write_imm16(gb, target_address, gb->cpu_regs.SP);
+}
 
-			if (bit7)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
+static void op_rlca(gb_t *gb, uint8_t opcode) // Rotate Left Circular Accumulator
+{
+	(void)opcode;
 
-			// Perform the rotate: shift left by 1, and set bit 0 to the old bit 7.
-			r8 = (r8 << 1) | bit7;
+	// Z, N and H are cleared; C takes the old bit 7.
+	uint8_t value = gb->cpu_regs.A;
+	gb->cpu_regs.A = (value << 1 | value >> 7);
+	flags_set(gb, (value >> 7) ? FLAG_C : 0x00);
+}
 
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
+static void op_rrca(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
 
-			if (r8 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+	// Z, N and H are cleared; C takes the old bit 0.
+	uint8_t value = gb->cpu_regs.A;
+	gb->cpu_regs.A = (value >> 1 | value << 7);
+	flags_set(gb, (value & 0x01) ? FLAG_C : 0x00);
+}
 
-			set_register_value(reg_code, r8);
-		}
-		break;
+static void op_rla(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
 
-		case 0x08: case 0x09: case 0x0A: case 0x0B: case 0x0C: case 0x0D: case 0x0E: case 0x0F:
-		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint8_t r8 = get_register_value(reg_code);
+	// Bit 0 takes the old carry, C takes the old bit 7.
+	uint8_t value = gb->cpu_regs.A;
+	gb->cpu_regs.A = (value << 1) | (flag_carry(gb) ? 0x01 : 0x00);
+	flags_set(gb, (value >> 7) ? FLAG_C : 0x00);
+}
 
-			uint8_t bit0 = (r8 & 0x01) << 7;
+static void op_rra(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
 
-			if (bit0 == 0x80)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
+	// Bit 7 takes the old carry, C takes the old bit 0.
+	uint8_t value = gb->cpu_regs.A;
+	gb->cpu_regs.A = (value >> 1) | (flag_carry(gb) ? 0x80 : 0x00);
+	flags_set(gb, (value & 0x01) ? FLAG_C : 0x00);
+}
 
-			// Perform the rotate: shift right by 1, and set bit 7 to the old bit 0.
-			r8 = (r8 >> 1) | bit0;
+static void op_daa(gb_t *gb, uint8_t opcode) // DAA - Decimal Adjust Accumulator
+{
+	(void)opcode;
 
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
+	// DAA needs N, H and C from the instruction before it.
+	uint8_t flags_from_previous_instruction = cpu_flags_resolve(gb);
 
-			if (r8 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+	// N is kept; H is always cleared; C is only ever set here, never cleared.
+	uint8_t new_flags = flags_from_previous_instruction & (FLAG_N | FLAG_C);
 
-			set_register_value(reg_code, r8);
+	// Branch based on whether the previous operation was subtraction (N=1) or addition (N=0).
+	if (flags_from_previous_instruction & FLAG_N)
+	{
+		/**
+		 * Subtraction Logic (N flag was SET):
+		 * Adjustments depend ONLY on the H and C flags from the previous instruction.
+		 */
+		if (flags_from_previous_instruction & FLAG_H)
+		{
+			gb->cpu_regs.A -= 0x06;
 		}
-		break;
 
-		case 0x10: case 0x11: case 0x12: case 0x13: case 0x14: case 0x15: case 0x16: case 0x17:
+		if (flags_from_previous_instruction & FLAG_C)
 		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint16_t r16 = get_register_value(reg_code);
-			uint8_t old_carry = CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-
-
-
-			// Perform the rotate: shift left by 1, and set bit 0 to the old bit 7.
-			r16 = (r16 << 1) | old_carry;
-
-			if (r16 > 0x00FF)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
-
-			if (r16 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-
-			set_register_value(reg_code, (uint8_t)(r16 & 0x00FF));
+			gb->cpu_regs.A -= 0x60;
 		}
-		break;
-
-		case 0x18: case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E: case 0x1F:
+	}
+	else // N_FLAG is CLEAR, meaning an ADDITION was performed.
+	{
+		// Adjust upper nibble first, on the value A had BEFORE any adjustment.
+		if ((flags_from_previous_instruction & FLAG_C) || (gb->cpu_regs.A > 0x99))
 		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint8_t r8 = get_register_value(reg_code);
-			uint8_t bit0 = CHK_BIT(r8, 0);
-			uint8_t old_carry = CHK_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT) << 7;
+			gb->cpu_regs.A += 0x60;
+			new_flags |= FLAG_C;
+		}
 
-			r8 = (r8 >> 1) | old_carry;
+		// Adjust lower nibble (bits 0-3) if H flag set OR lower nibble > 0x09.
+		if ((flags_from_previous_instruction & FLAG_H) || ((gb->cpu_regs.A & 0x0F) > 0x09))
+		{
+			gb->cpu_regs.A += 0x06;
+		}
+	}
 
-			if (bit0)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
+	flags_set(gb, new_flags | FLAG_Z_FROM(gb->cpu_regs.A));
+}
 
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
+static void op_cpl(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
 
-			if (r8 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+	gb->cpu_regs.A = ~gb->cpu_regs.A;
 
-			set_register_value(reg_code, r8);
-		}
-		break;
+	// Z and C are kept, N and H are set.
+	flags_set(gb, cpu_flags_resolve(gb) | FLAG_N | FLAG_H);
+}
 
-		case 0x20: case 0x21: case 0x22: case 0x23: case 0x24: case 0x25: case 0x26: case 0x27:
-		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint16_t r16 = get_register_value(reg_code);
-			uint8_t bit7 = CHK_BIT(r16, 7);
+static void op_scf(gb_t *gb, uint8_t opcode) // Set Carry Flag
+{
+	(void)opcode;
 
-			if (bit7)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
+	// Z is kept, N and H are cleared, C is set.
+	flags_set(gb, (flag_zero(gb) ? FLAG_Z : 0x00) | FLAG_C);
+}
 
-			r16 = (r16 << 1);
+static void op_ccf(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
 
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
+	// Z is kept, N and H are cleared, C is flipped.
+	flags_set(gb, (flag_zero(gb) ? FLAG_Z : 0x00) | (flag_carry(gb) ? 0x00 : FLAG_C));
+}
 
-			if (r16 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+static void op_jr(gb_t *gb, uint8_t opcode) // jr imm8
+{
+	(void)opcode;
 
-			set_register_value(reg_code, (uint8_t)(r16 & 0x00FF));
-		}
-		break;
+	int8_t imm8 = (int8_t)read_imm8(gb);
+	gb->cpu_regs.PC += imm8;
+}
 
-		case 0x28: case 0x29: case 0x2A: case 0x2B: case 0x2C: case 0x2D: case 0x2E: case 0x2F:
-		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint8_t r8 = get_register_value(reg_code);
-			uint8_t bit0 = CHK_BIT(r8, 0);
-			uint8_t bit7 = CHK_BIT(r8, 7) << 7;
+static void op_stop(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
 
+	// STOP is encoded as 0x10 0x00; skip the padding byte.
+	gb->emulator_is_stopped = myTrue;
+	(void)read_imm8(gb);
+}
 
-			if (bit0)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
+static void op_halt(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
 
-			r8 = (r8 >> 1);
+	gb->cpu_is_halted = myTrue;
+}
 
-			r8 = r8 | bit7;
+static void op_ret(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
 
+	gb->cpu_regs.PC = stack_pop(gb);
+}
 
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
+static void op_reti(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
 
-			if (r8 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+	gb->cpu_regs.PC = stack_pop(gb);
 
-			set_register_value(reg_code, r8);
-		}
-		break;
+	// IMPORTANT: Re-enable interrupts here.
+	gb->interrupt_master_enable = myTrue;
+	cpu_interrupts_changed(gb);
+}
 
-		case 0x30: case 0x31: case 0x32: case 0x33: case 0x34: case 0x35: case 0x36: case 0x37:
-		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint8_t r8 = get_register_value(reg_code);
-			uint8_t new_r8, new_MSN;
+static void op_jp(gb_t *gb, uint8_t opcode) // jp imm16
+{
+	(void)opcode;
 
-			// takes the existing least sig nibble masks it moves it 4 to the left to make it the new MSN
-			new_MSN = (r8 & 0x0F) << 4;
+	gb->cpu_regs.PC = read_imm16(gb);
+}
 
-			// bit shift the current MSN and the bit wise ors the new MSN into new r8
-			new_r8 = (r8 >> 4) | new_MSN;
+static void op_jp_hl(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
 
-			CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
+	gb->cpu_regs.PC = gb->cpu_regs.HL;
+}
 
-			if (new_r8 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+static void op_call(gb_t *gb, uint8_t opcode) // call imm16
+{
+	(void)opcode;
 
-			set_register_value(reg_code, new_r8);
-		}
-		break;
+	uint16_t imm16 = read_imm16(gb);
+	stack_push(gb, gb->cpu_regs.PC);
+	gb->cpu_regs.PC = imm16;
+}
 
-		case 0x38: case 0x39: case 0x3A: case 0x3B: case 0x3C: case 0x3D: case 0x3E: case 0x3F:
-		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint8_t r8 = get_register_value(reg_code);
-			uint8_t bit0 = CHK_BIT(r8, 0);
+static void op_prefix_cb(gb_t *gb, uint8_t opcode) // $CB prefix special case
+{
+	(void)opcode;
 
+	uint8_t prefixed_opcode = read_imm8(gb);
 
-			if (bit0)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_CARRY_C_BIT);
-			}
+	gb->cpu_step_cycles += cpu_cb_cycles_table[prefixed_opcode];
+	cpu_cb_opcode_table[prefixed_opcode](gb, prefixed_opcode);
+}
 
-			r8 = (r8 >> 1);
+static void op_ldh_mem_c_a(gb_t *gb, uint8_t opcode) // ld (0xFF00 + C), A
+{
+	(void)opcode;
+	mmu_write_byte(gb, 0xFF00 + gb->cpu_regs.C, gb->cpu_regs.A);
+}
 
-			CLR_BIT(r8, 7);
+static void op_ldh_mem_imm8_a(gb_t *gb, uint8_t opcode) // ld (0xFF00 + imm8), A
+{
+	(void)opcode;
+	uint8_t imm8 = read_imm8(gb);
+	mmu_write_byte(gb, 0xFF00 + imm8, gb->cpu_regs.A);
+}
 
+static void op_ld_mem_imm16_a(gb_t *gb, uint8_t opcode) // ld (imm16), A
+{
+	(void)opcode;
+	uint16_t address = read_imm16(gb);
+	mmu_write_byte(gb, address, gb->cpu_regs.A);
+}
 
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			CLR_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
+static void op_ldh_a_mem_c(gb_t *gb, uint8_t opcode) // ld A, (0xFF00 + C)
+{
+	(void)opcode;
+	gb->cpu_regs.A = mmu_read_byte(gb, 0xFF00 + gb->cpu_regs.C);
+}
 
-			if (r8 == 0x00)
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+static void op_ldh_a_mem_imm8(gb_t *gb, uint8_t opcode) // ld A, (0xFF00 + imm8)
+{
+	(void)opcode;
+	uint8_t imm8 = read_imm8(gb);
+	gb->cpu_regs.A = mmu_read_byte(gb, 0xFF00 + imm8);
+}
 
-			set_register_value(reg_code, r8);
-		}
-		break;
-
-		case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47: // bit 0
-		case 0x48: case 0x49: case 0x4A: case 0x4B: case 0x4C: case 0x4D: case 0x4E: case 0x4F: // bit 1
-		case 0x50: case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57: // bit 2
-		case 0x58: case 0x59: case 0x5A: case 0x5B: case 0x5C: case 0x5D: case 0x5E: case 0x5F: // bit 3
-		case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66: case 0x67: // bit 4
-		case 0x68: case 0x69: case 0x6A: case 0x6B: case 0x6C: case 0x6D: case 0x6E: case 0x6F: // bit 5
-		case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77: // bit 6
-		case 0x78: case 0x79: case 0x7A: case 0x7B: case 0x7C: case 0x7D: case 0x7E: case 0x7F: // bit 7
-		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint8_t bit_number = (opcode & 0x38) >> 3;
-			uint8_t r8 = get_register_value(reg_code);
+static void op_ld_a_mem_imm16(gb_t *gb, uint8_t opcode) // ld A, (imm16)
+{
+	(void)opcode;
+	uint16_t address = read_imm16(gb);
+	gb->cpu_regs.A = mmu_read_byte(gb, address);
+}
 
+static void op_add_sp_imm8(gb_t *gb, uint8_t opcode) // add SP, e8
+{
+	(void)opcode;
+	int8_t imm8 = (int8_t)read_imm8(gb);
+	gb->cpu_regs.SP = alu_add_sp_imm8(gb, imm8);
+}
 
-			CLR_BIT(cpu_regs.F, CPU_FLAG_SUB_N_BIT);
-			SET_BIT(cpu_regs.F, CPU_FLAG_HALF_H_BIT);
+static void op_ld_hl_sp_imm8(gb_t *gb, uint8_t opcode) // ld HL, SP + e8
+{
+	(void)opcode;
+	int8_t imm8 = (int8_t)read_imm8(gb);
+	gb->cpu_regs.HL = alu_add_sp_imm8(gb, imm8);
+}
 
-			if (CHK_BIT(r8, bit_number))
-			{
-				CLR_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
-			else
-			{
-				SET_BIT(cpu_regs.F, CPU_FLAG_ZERO_Z_BIT);
-			}
+static void op_ld_sp_hl(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
+	gb->cpu_regs.SP = gb->cpu_regs.HL;
+}
 
-		}
-		break;
-
-		case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87: // bit 0
-		case 0x88: case 0x89: case 0x8A: case 0x8B: case 0x8C: case 0x8D: case 0x8E: case 0x8F: // bit 1
-		case 0x90: case 0x91: case 0x92: case 0x93: case 0x94: case 0x95: case 0x96: case 0x97: // bit 2
-		case 0x98: case 0x99: case 0x9A: case 0x9B: case 0x9C: case 0x9D: case 0x9E: case 0x9F: // bit 3
-		case 0xA0: case 0xA1: case 0xA2: case 0xA3: case 0xA4: case 0xA5: case 0xA6: case 0xA7: // bit 4
-		case 0xA8: case 0xA9: case 0xAA: case 0xAB: case 0xAC: case 0xAD: case 0xAE: case 0xAF: // bit 5
-		case 0xB0: case 0xB1: case 0xB2: case 0xB3: case 0xB4: case 0xB5: case 0xB6: case 0xB7: // bit 6
-		case 0xB8: case 0xB9: case 0xBA: case 0xBB: case 0xBC: case 0xBD: case 0xBE: case 0xBF: // bit 7
-		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint8_t bit_number = (opcode & 0x38) >> 3;
-			uint8_t r8 = get_register_value(reg_code);
+static void op_di(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
+	gb->interrupt_master_enable = myFalse;
+	cpu_interrupts_changed(gb);
+}
 
-			CLR_BIT(r8, bit_number);
+static void op_ei(gb_t *gb, uint8_t opcode)
+{
+	(void)opcode;
+	gb->interrupt_master_enable = myTrue;
+	cpu_interrupts_changed(gb);
+}
 
-			set_register_value(reg_code, r8);
+static void op_illegal(gb_t *gb, uint8_t opcode)
+{
+	// If we hit this, the program is trying to execute one of the
+	// eleven opcodes the LR35902 does not implement. The real CPU locks
+	// up; this instance stops with PC on the opcode, and gb_run_cycles /
+	// gb_run_frame report GB_STOP_ILLEGAL_OPCODE. Other instances in the
+	// process carry on.
+	gb->cpu_regs.PC = gb->cpu_regs.PC - 1;
+	printf("Error: Unhandled opcode 0x%02X at address 0x%04X\n", opcode, gb->cpu_regs.PC);
+	gb->cpu_is_locked_up = myTrue;
+	gb->running = myFalse;
+
+	// A locked-up CPU takes no interrupts either, including one that
+	// cpu_step would otherwise dispatch at the end of this step.
+	gb->interrupt_master_enable = myFalse;
+	cpu_interrupts_changed(gb);
+}
 
-		}
-		break;
-
-		case 0xC0: case 0xC1: case 0xC2: case 0xC3: case 0xC4: case 0xC5: case 0xC6: case 0xC7: // bit 0
-		case 0xC8: case 0xC9: case 0xCA: case 0xCB: case 0xCC: case 0xCD: case 0xCE: case 0xCF: // bit 1
-		case 0xD0: case 0xD1: case 0xD2: case 0xD3: case 0xD4: case 0xD5: case 0xD6: case 0xD7: // bit 2
-		case 0xD8: case 0xD9: case 0xDA: case 0xDB: case 0xDC: case 0xDD: case 0xDE: case 0xDF: // bit 3
-		case 0xE0: case 0xE1: case 0xE2: case 0xE3: case 0xE4: case 0xE5: case 0xE6: case 0xE7: // bit 4
-		case 0xE8: case 0xE9: case 0xEA: case 0xEB: case 0xEC: case 0xED: case 0xEE: case 0xEF: // bit 5
-		case 0xF0: case 0xF1: case 0xF2: case 0xF3: case 0xF4: case 0xF5: case 0xF6: case 0xF7: // bit 6
-		case 0xF8: case 0xF9: case 0xFA: case 0xFB: case 0xFC: case 0xFD: case 0xFE: case 0xFF: // bit 7
-		{
-			uint8_t opcode = prefixed_opcode;
-			uint8_t reg_code = opcode & 0x07;
-			uint8_t bit_number = (opcode & 0x38) >> 3;
-			uint8_t r8 = get_register_value(reg_code);
 
-			SET_BIT(r8, bit_number);
+// ----------------------------------------------------------------------
+// $CB Prefix Handlers
+// Generated per operand like the main page, so the register (and the bit
+// number) is fixed in each handler. Only the (HL) forms, operand 6, go
+// through the MMU.
+// ----------------------------------------------------------------------
+
+// rot r8 ($CB 00ooorrr)
+#define DEFINE_CB_SHIFT(OP, R) \
+	static void op_cb_##OP##_##R(gb_t *gb, uint8_t prefixed_opcode) { (void)prefixed_opcode; R8_WRITE_##R(alu_##OP(gb, R8_READ_##R())); }
+#define DEFINE_CB_SHIFT_ROW(OP, IDX) FOR_EACH_R8(DEFINE_CB_SHIFT, OP)
+FOR_EACH_CB_SHIFT_OP(DEFINE_CB_SHIFT_ROW)
+
+// bit b, r8 ($CB 01bbbrrr)
+#define DEFINE_CB_BIT(B, R) \
+	static void op_cb_bit_##B##R(gb_t *gb, uint8_t prefixed_opcode) { (void)prefixed_opcode; alu_bit(gb, R8_READ_##R() & BIT(B)); }
+#define DEFINE_CB_BIT_ROW(UNUSED, B) FOR_EACH_R8(DEFINE_CB_BIT, B)
+FOR_EACH_BIT(DEFINE_CB_BIT_ROW, _)
+
+// res b, r8 ($CB 10bbbrrr)
+#define DEFINE_CB_RES(B, R) \
+	static void op_cb_res_##B##R(gb_t *gb, uint8_t prefixed_opcode) { (void)prefixed_opcode; R8_WRITE_##R(R8_READ_##R() & (uint8_t)~BIT(B)); }
+#define DEFINE_CB_RES_ROW(UNUSED, B) FOR_EACH_R8(DEFINE_CB_RES, B)
+FOR_EACH_BIT(DEFINE_CB_RES_ROW, _)
+
+// set b, r8 ($CB 11bbbrrr)
+#define DEFINE_CB_SET(B, R) \
+	static void op_cb_set_##B##R(gb_t *gb, uint8_t prefixed_opcode) { (void)prefixed_opcode; R8_WRITE_##R(R8_READ_##R() | BIT(B)); }
+#define DEFINE_CB_SET_ROW(UNUSED, B) FOR_EACH_R8(DEFINE_CB_SET, B)
+FOR_EACH_BIT(DEFINE_CB_SET_ROW, _)
+
+
+// ----------------------------------------------------------------------
+// Dispatch Tables
+// Entries are placed by building each opcode from its bit fields.
+// ----------------------------------------------------------------------
+#define OPCODE_R16(BASE, RR)			((BASE) | ((RR) << 4))
+#define OPCODE_R8_DST(BASE, D)			((BASE) | ((D) << 3))
+#define OPCODE_R8_PAIR(BASE, D, S)		((BASE) | ((D) << 3) | (S))
+#define OPCODE_COND(BASE, CC)			((BASE) | ((CC) << 3))
+
+#define ENTRY_LD_R16_IMM16(RR)		[OPCODE_R16(0x01, RR)] = op_ld_r16_imm16_##RR,
+#define ENTRY_INC_R16(RR)			[OPCODE_R16(0x03, RR)] = op_inc_r16_##RR,
+#define ENTRY_ADD_HL_R16(RR)		[OPCODE_R16(0x09, RR)] = op_add_hl_r16_##RR,
+#define ENTRY_DEC_R16(RR)			[OPCODE_R16(0x0B, RR)] = op_dec_r16_##RR,
+#define ENTRY_POP(RR)				[OPCODE_R16(0xC1, RR)] = op_pop_##RR,
+#define ENTRY_PUSH(RR)				[OPCODE_R16(0xC5, RR)] = op_push_##RR,
+#define ENTRY_INC_R8(UNUSED, D)		[OPCODE_R8_DST(0x04, D)] = op_inc_r8_##D,
+#define ENTRY_DEC_R8(UNUSED, D)		[OPCODE_R8_DST(0x05, D)] = op_dec_r8_##D,
+#define ENTRY_LD_R8_IMM8(UNUSED, D)	[OPCODE_R8_DST(0x06, D)] = op_ld_r8_imm8_##D,
+#define ENTRY_LD_R8_R8(D, S)		[OPCODE_R8_PAIR(0x40, D, S)] = op_ld_r8_r8_##D##S,
+#define ENTRY_LD_R8_R8_ROW(UNUSED, D)	FOR_EACH_R8(ENTRY_LD_R8_R8, D)
+#define ENTRY_ALU_R8(OP, S)			[0x80 | (ALU_INDEX_##OP << 3) | (S)] = op_##OP##_r8_##S,
+#define ENTRY_ALU_R8_ROW(OP, IDX)	FOR_EACH_R8(ENTRY_ALU_R8, OP)
+#define ENTRY_ALU_IMM8(OP, IDX)		[0xC6 | ((IDX) << 3)] = op_##OP##_imm8,
+#define ENTRY_JR_CC(CC)				[OPCODE_COND(0x20, CC)] = op_jr_cc_##CC,
+#define ENTRY_RET_CC(CC)			[OPCODE_COND(0xC0, CC)] = op_ret_cc_##CC,
+#define ENTRY_JP_CC(CC)				[OPCODE_COND(0xC2, CC)] = op_jp_cc_##CC,
+#define ENTRY_CALL_CC(CC)			[OPCODE_COND(0xC4, CC)] = op_call_cc_##CC,
+#define ENTRY_RST(T)				[OPCODE_R8_DST(0xC7, T)] = op_rst_##T,
+
+#define ALU_INDEX_add	0
+#define ALU_INDEX_adc	1
+#define ALU_INDEX_sub	2
+#define ALU_INDEX_sbc	3
+#define ALU_INDEX_and	4
+#define ALU_INDEX_xor	5
+#define ALU_INDEX_or	6
+#define ALU_INDEX_cp	7
+
+static const cpu_opcode_handler_t cpu_opcode_table[256] =
+{
+	// Block 0 (00xxxxxx)
+	[0x00] = op_nop,
+	[0x02] = op_ld_mem_bc_a,
+	[0x12] = op_ld_mem_de_a,
+	[0x22] = op_ld_mem_hli_a,
+	[0x32] = op_ld_mem_hld_a,
+	[0x0A] = op_ld_a_mem_bc,
+	[0x1A] = op_ld_a_mem_de,
+	[0x2A] = op_ld_a_mem_hli,
+	[0x3A] = op_ld_a_mem_hld,
+	[0x08] = op_ld_mem_imm16_sp,
+	[0x07] = op_rlca,
+	[0x0F] = op_rrca,
+	[0x17] = op_rla,
+	[0x1F] = op_rra,
+	[0x27] = op_daa,
+	[0x2F] = op_cpl,
+	[0x37] = op_scf,
+	[0x3F] = op_ccf,
+	[0x18] = op_jr,
+	[0x10] = op_stop,
+	FOR_EACH_R16(ENTRY_LD_R16_IMM16)
+	FOR_EACH_R16(ENTRY_INC_R16)
+	FOR_EACH_R16(ENTRY_DEC_R16)
+	FOR_EACH_R16(ENTRY_ADD_HL_R16)
+	FOR_EACH_R8(ENTRY_INC_R8, _)
+	FOR_EACH_R8(ENTRY_DEC_R8, _)
+	FOR_EACH_R8(ENTRY_LD_R8_IMM8, _)
+	FOR_EACH_COND(ENTRY_JR_CC)
+
+	// Block 1 (01dddsss): ld r8, r8 with HALT in place of ld (HL), (HL)
+	ENTRY_LD_R8_R8_ROW(_, 0)
+	ENTRY_LD_R8_R8_ROW(_, 1)
+	ENTRY_LD_R8_R8_ROW(_, 2)
+	ENTRY_LD_R8_R8_ROW(_, 3)
+	ENTRY_LD_R8_R8_ROW(_, 4)
+	ENTRY_LD_R8_R8_ROW(_, 5)
+	ENTRY_LD_R8_R8(6, 0) ENTRY_LD_R8_R8(6, 1) ENTRY_LD_R8_R8(6, 2) ENTRY_LD_R8_R8(6, 3)
+	ENTRY_LD_R8_R8(6, 4) ENTRY_LD_R8_R8(6, 5) ENTRY_LD_R8_R8(6, 7)
+	ENTRY_LD_R8_R8_ROW(_, 7)
+	[0x76] = op_halt,
+
+	// Block 2 (10ooosss): alu a, r8
+	FOR_EACH_ALU_OP(ENTRY_ALU_R8_ROW)
+
+	// Block 3 (11xxxxxx)
+	FOR_EACH_ALU_OP(ENTRY_ALU_IMM8)
+	FOR_EACH_COND(ENTRY_RET_CC)
+	FOR_EACH_COND(ENTRY_JP_CC)
+	FOR_EACH_COND(ENTRY_CALL_CC)
+	FOR_EACH_R16(ENTRY_POP)
+	FOR_EACH_R16(ENTRY_PUSH)
+	FOR_EACH_RST(ENTRY_RST)
+	[0xC9] = op_ret,
+	[0xD9] = op_reti,
+	[0xC3] = op_jp,
+	[0xE9] = op_jp_hl,
+	[0xCD] = op_call,
+	[0xCB] = op_prefix_cb,
+	[0xE2] = op_ldh_mem_c_a,
+	[0xE0] = op_ldh_mem_imm8_a,
+	[0xEA] = op_ld_mem_imm16_a,
+	[0xF2] = op_ldh_a_mem_c,
+	[0xF0] = op_ldh_a_mem_imm8,
+	[0xFA] = op_ld_a_mem_imm16,
+	[0xE8] = op_add_sp_imm8,
+	[0xF8] = op_ld_hl_sp_imm8,
+	[0xF9] = op_ld_sp_hl,
+	[0xF3] = op_di,
+	[0xFB] = op_ei,
+
+	// Unused opcodes
+	[0xD3] = op_illegal, [0xDB] = op_illegal, [0xDD] = op_illegal,
+	[0xE3] = op_illegal, [0xE4] = op_illegal, [0xEB] = op_illegal,
+	[0xEC] = op_illegal, [0xED] = op_illegal, [0xF4] = op_illegal,
+	[0xFC] = op_illegal, [0xFD] = op_illegal,
+};
+
+// $CB page: bits 7-6 pick the group, bits 5-3 the operation or bit number,
+// bits 2-0 the register.
+#define CB_ENTRY_SHIFT(OP, R)			[(CB_SHIFT_INDEX_##OP << 3) | (R)] = op_cb_##OP##_##R,
+#define CB_ENTRY_SHIFT_ROW(OP, IDX)		FOR_EACH_R8(CB_ENTRY_SHIFT, OP)
+#define CB_ENTRY_BIT(B, R)				[0x40 | ((B) << 3) | (R)] = op_cb_bit_##B##R,
+#define CB_ENTRY_BIT_ROW(UNUSED, B)		FOR_EACH_R8(CB_ENTRY_BIT, B)
+#define CB_ENTRY_RES(B, R)				[0x80 | ((B) << 3) | (R)] = op_cb_res_##B##R,
+#define CB_ENTRY_RES_ROW(UNUSED, B)		FOR_EACH_R8(CB_ENTRY_RES, B)
+#define CB_ENTRY_SET(B, R)				[0xC0 | ((B) << 3) | (R)] = op_cb_set_##B##R,
+#define CB_ENTRY_SET_ROW(UNUSED, B)		FOR_EACH_R8(CB_ENTRY_SET, B)
+#define CB_SHIFT_INDEX_rlc	0
+#define CB_SHIFT_INDEX_rrc	1
+#define CB_SHIFT_INDEX_rl	2
+#define CB_SHIFT_INDEX_rr	3
+#define CB_SHIFT_INDEX_sla	4
+#define CB_SHIFT_INDEX_sra	5
+#define CB_SHIFT_INDEX_swap	6
+#define CB_SHIFT_INDEX_srl	7
+
+static const cpu_opcode_handler_t cpu_cb_opcode_table[256] =
+{
+	// 00ooorrr: rotates and shifts
+	FOR_EACH_CB_SHIFT_OP(CB_ENTRY_SHIFT_ROW)
 
-			set_register_value(reg_code, r8);
+	// 01bbbrrr / 10bbbrrr / 11bbbrrr: bit, res, set
+	FOR_EACH_BIT(CB_ENTRY_BIT_ROW, _)
+	FOR_EACH_BIT(CB_ENTRY_RES_ROW, _)
+	FOR_EACH_BIT(CB_ENTRY_SET_ROW, _)
+};
 
-		}
-		break;
 
-		default:
-		{}break;
+// Inside a block the immediates were extracted at decode time and PC
+// already points past the instruction.
+static uint8_t read_imm8(gb_t *gb)
+{
+	if (gb->current_instruction != NULL)
+	{
+		return (uint8_t)gb->current_instruction->immediate;
 	}
+
+	uint8_t imm8 = mmu_read_byte(gb, gb->cpu_regs.PC);
+	gb->cpu_regs.PC++;
+	return imm8;
 }
 
+static uint16_t read_imm16(gb_t *gb)
+{
+	if (gb->current_instruction != NULL)
+	{
+		return gb->current_instruction->immediate;
+	}
 
+    uint16_t imm16 = mmu_read_word(gb, gb->cpu_regs.PC);
+    gb->cpu_regs.PC += 2; // Past the LSB and MSB
+    return imm16;
+}
 
+static void write_imm16(gb_t *gb, uint16_t address, uint16_t value)
+{
+    // Low byte of SP to target_address, high byte to target_address + 1
+    mmu_write_word(gb, address, value);
+}
@@ -3,7 +3,7 @@
  *
  * Defines the structure for the Game Boy CPU registers (Sharp LR35902).
  * Uses anonymous unions and structs for efficient access to 8-bit and 16-bit registers.
- * Includes definitions for CPU flags and declares the global CPU state structure.
+ * Includes definitions for CPU flags and the CPU state structure (held in gb_t).
  */
 
 
@@ -12,8 +12,15 @@
 #define COMPONENTS_CPU_H_
 
 #include <stdint.h>
+#include "..\headers\mystdbool.h"
 #include "..\BitOps\bit_macros.h"
 
+// Emulator instance (gb.h). Every component works on one of these.
+#ifndef GB_T_DECLARED
+#define GB_T_DECLARED
+typedef struct gb_s gb_t;
+#endif
+
 // ----------------------------------------------------------------------
 // CPU Flag Definitions
 // These constants define the bit positions for the CPU's Flag Register (F).
@@ -24,6 +31,118 @@
 #define CPU_FLAG_HALF_H_BIT		(5)	// 0x20 (Set if there was a carry/borrow in the lower nibble)
 #define CPU_FLAG_CARRY_C_BIT	(4)	// 0x10 (Set if there was a carry/borrow in the high byte)
 
+// ----------------------------------------------------------------------
+// Lazy Flag Evaluation
+// When CPU_LAZY_FLAGS is 1, ALU instructions only record their operands,
+// result and kind in cpu_lazy_flags. Z/N/H/C are worked out when something
+// reads them: conditional branches, ADC/SBC, PUSH AF, DAA, saving state.
+// Set it to 0 to resolve F straight after every ALU instruction.
+// ----------------------------------------------------------------------
+#ifndef CPU_LAZY_FLAGS
+#define CPU_LAZY_FLAGS			(1)
+#endif
+
+typedef enum
+{
+	CPU_LAZY_FLAGS_NONE = 0,	// F already holds the flags
+	CPU_LAZY_FLAGS_ADD,			// ADD/ADC: result = a + b + carry
+	CPU_LAZY_FLAGS_SUB,			// SUB/SBC/CP: result = a - b - carry
+	CPU_LAZY_FLAGS_AND,			// AND: H set, N and C clear
+	CPU_LAZY_FLAGS_OR,			// OR/XOR: N, H and C clear
+	CPU_LAZY_FLAGS_INC,			// INC r8: C kept in preserved
+	CPU_LAZY_FLAGS_DEC,			// DEC r8: C kept in preserved
+	CPU_LAZY_FLAGS_SHIFT,		// $CB rotates/shifts/SWAP: C (carry out) in preserved
+	CPU_LAZY_FLAGS_ADD16,		// ADD HL, r16: Z kept in preserved
+	CPU_LAZY_FLAGS_ADD_SP		// ADD SP, e8 / LD HL, SP+e8: Z and N clear
+} cpu_lazy_op_t;
+
+typedef struct
+{
+	uint8_t op;					// cpu_lazy_op_t of the last flag-setting instruction
+	uint8_t preserved;			// F bits the instruction left alone (already in place)
+	uint16_t operand_a;			// First operand (A, HL or SP)
+	uint16_t operand_b;			// Second operand
+	uint16_t result;			// Unmasked result, so bit 8 holds the carry/borrow
+} cpu_lazy_flags_t;
+
+
+// ----------------------------------------------------------------------
+// Block Cache
+// cpu_step runs straight-line runs of predecoded instructions ("blocks")
+// looked up by (bank, PC). Blocks decoded from WRAM or HRAM are tied to
+// the 64-byte granules they were read from: cpu_block_code_granules marks
+// granules holding cached code, and a write to a marked granule retires
+// every block decoded from it. The MMU runs each WRAM/HRAM write through
+// CPU_BLOCK_CACHE_NOTE_WRITE so unmarked granules cost one load.
+// ----------------------------------------------------------------------
+#define CPU_BLOCK_CACHE_ENTRIES			(1024)	// Direct mapped, power of two
+#define CPU_BLOCK_MAX_INSTRUCTIONS		(16)	// 16 * 3 bytes never spans more than two granules
+#define CPU_BLOCK_GRANULE_SHIFT			(6)
+#define CPU_BLOCK_GRANULE_COUNT			(0x10000 >> CPU_BLOCK_GRANULE_SHIFT)
+
+// Blocks run this many times before the JIT (when enabled) translates them.
+#define CPU_JIT_HOT_THRESHOLD			(16)
+
+// The JIT only exists for x86-64 Linux; elsewhere cpu_jit_set_enabled() fails.
+#if defined(__linux__) && defined(__x86_64__)
+#define CPU_JIT_SUPPORTED				(1)
+#else
+#define CPU_JIT_SUPPORTED				(0)
+#endif
+
+// Idle loops: a block that loads LY, STAT or IF into A, only tests A and
+// branches back to its own start gives the same result every time round
+// until the PPU next changes something. When CPU_IDLE_LOOP_SKIP is 1,
+// cpu_step runs one pass of such a loop and then charges every further
+// pass up to that point in one go instead of executing them.
+#ifndef CPU_IDLE_LOOP_SKIP
+#define CPU_IDLE_LOOP_SKIP				(1)
+#endif
+
+typedef void (*cpu_opcode_handler_t)(gb_t *gb, uint8_t opcode);
+
+typedef struct
+{
+	cpu_opcode_handler_t handler;	// Resolved handler ($CB page included)
+	uint16_t immediate;				// imm8 in the low byte, or imm16
+	uint8_t opcode;					// Handed to the handler (the $CB byte for prefixed ones)
+	uint8_t length;					// Bytes, so PC can be advanced before the handler runs
+	uint8_t cycles;					// Not-taken cost
+	myBool prefixed;				// opcode is from the $CB page
+} cpu_decoded_instruction_t;
+
+typedef struct
+{
+	uint16_t start_pc;
+	uint16_t end_pc;				// One past the last byte decoded
+	uint16_t bank;					// Switchable ROM bank for 0x4000-0x7FFF, 0 elsewhere
+	uint16_t cycles;				// Summed not-taken costs of every instruction
+	uint8_t instruction_count;		// 0 marks an empty entry
+	myBool in_ram;					// Decoded from WRAM/HRAM, so it can be overwritten
+	myBool idle_loop;				// A side-effect-free LY/STAT/IF polling loop
+	uint32_t granule_generation[2];	// Generations of the first and last granule when decoded
+
+	// JIT state. exit_pc lists the successors known at decode time
+	// (branch target and/or fall-through); link[n] is the translated
+	// body of the block at exit_pc[n] once the two have been chained.
+	uint16_t executions;			// Interpreted runs since decode
+	uint8_t exit_count;
+	uint16_t exit_pc[2];
+	uint16_t link_bank[2];			// Bank the linked successor was decoded for
+	void *link[2];
+	void *native_entry;				// Translated code, NULL until compiled
+	void *native_body;				// Same code past the prologue, where chained blocks jump in
+
+	cpu_decoded_instruction_t instructions[CPU_BLOCK_MAX_INSTRUCTIONS];
+} cpu_block_t;
+
+#define CPU_BLOCK_CACHE_NOTE_WRITE(gb, address) \
+	do { \
+		if ((gb)->cpu_block_code_granules[(uint16_t)(address) >> CPU_BLOCK_GRANULE_SHIFT]) \
+		{ \
+			cpu_block_cache_invalidate((gb), (address)); \
+		} \
+	} while (0)
 
 // ----------------------------------------------------------------------
 // CPU_State Structure
@@ -80,15 +199,38 @@ typedef struct {
 } CPU_State;
 
 
-// ----------------------------------------------------------------------
-// Global CPU State Declaration
-// The actual instance of the CPU state (cpu_regs) is defined in cpu.c
-// and declared here as 'extern' so other components can access it.
-// ----------------------------------------------------------------------
-extern CPU_State cpu_regs;
+extern void cpu_init(gb_t *gb);
+extern void cpu_run(gb_t *gb);
+
+// Executes one predecoded block (a single instruction outside cached
+// regions, the wait up to the next PPU event when halted), services a pending interrupt
+// and returns the T-cycles used, branch and dispatch costs included.
+extern uint16_t cpu_step(gb_t *gb);
+
+// Recomputes gb->cpu_interrupts_pending after IE, IF or IME has changed.
+extern void cpu_interrupts_changed(gb_t *gb);
+
+// Called by the PPU as each frame ends: latches and restarts the
+// skipped-cycle counter.
+extern void cpu_idle_end_frame(gb_t *gb);
+
+// Retires every cached block decoded from the granule holding address.
+extern void cpu_block_cache_invalidate(gb_t *gb, uint16_t address);
+
+// Drops the whole block cache (e.g. after loading a new ROM).
+extern void cpu_block_cache_flush(gb_t *gb);
+
+// Runs one decoded instruction through its interpreter handler
+// (PC must point at the instruction). The JIT calls this for anything
+// it does not translate itself.
+extern void cpu_execute_instruction(gb_t *gb, const cpu_decoded_instruction_t *instruction);
 
+// Switches blocks between the JIT and the interpreter. Returns myFalse
+// (and stays interpreted) when the JIT is unavailable on this host.
+extern myBool cpu_jit_set_enabled(gb_t *gb, myBool enable);
 
-extern void cpu_init();
-extern void cpu_run();
+// Works out any pending lazy flags, stores them in gb->cpu_regs.F and returns F.
+// Call before reading cpu_regs.F/AF from outside the CPU (e.g. saving state).
+extern uint8_t cpu_flags_resolve(gb_t *gb);
 
 #endif /* COMPONENTS_CPU_H_ */
@@ -0,0 +1,227 @@
+/*
+ * gb.c
+ *
+ * Creation and teardown of emulator instances.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gb.h"
+#include "jit_x64.h"
+#include "cartridge.h"
+
+// The arena's cache-line alignment only holds if the instance itself is
+// allocated on a cache line boundary.
+static gb_t *gb_allocate(void)
+{
+	gb_t *gb;
+
+#if defined(_WIN32)
+	gb = (gb_t *)_aligned_malloc(sizeof(gb_t), GB_CACHE_LINE_SIZE);
+#else
+	if (posix_memalign((void **)&gb, GB_CACHE_LINE_SIZE, sizeof(gb_t)) != 0)
+	{
+		gb = NULL;
+	}
+#endif
+
+	if (gb == NULL)
+	{
+		printf("Error: Could not allocate emulator instance.\n");
+		return NULL;
+	}
+
+	// Zero is the power-on value of every field; the init functions
+	// only set what differs from that.
+	memset(gb, 0, sizeof(gb_t));
+	return gb;
+}
+
+static void gb_free(gb_t *gb)
+{
+#if defined(_WIN32)
+	_aligned_free(gb);
+#else
+	free(gb);
+#endif
+}
+
+// Brings the host side back in line with a freshly written arena: the
+// page table follows the MBC registers, and blocks, translations and
+// decoded tiles made from the old memory contents are dropped.
+static void gb_rebuild_host_state(gb_t *gb)
+{
+	mmu_map_memory(gb);
+	cpu_block_cache_flush(gb);
+	ppu_tile_cache_flush(gb);
+
+	gb->jit_last_block = NULL;
+	gb->current_instruction = NULL;
+	gb->run_cycles_overshoot = 0;
+}
+
+gb_t *gb_create(void)
+{
+	gb_t *gb = gb_allocate();
+
+	if (gb == NULL)
+	{
+		return NULL;
+	}
+
+	mmu_init(gb);
+	cpu_init(gb);
+	ppu_init(gb);
+
+	return gb;
+}
+
+void gb_destroy(gb_t *gb)
+{
+	if (gb == NULL)
+	{
+		return;
+	}
+
+	cartridge_unload(gb);
+	jit_release(gb);
+	gb_free(gb);
+}
+
+void gb_reset(gb_t *gb)
+{
+	memset(gb, 0, GB_ARENA_FIXED_SIZE);
+
+	cartridge_reset(gb);
+	mmu_init(gb);
+	cpu_init(gb);
+	ppu_init(gb);
+
+	gb_rebuild_host_state(gb);
+}
+
+gb_t *gb_clone(const gb_t *gb)
+{
+	gb_t *clone = gb_allocate();
+
+	if (clone == NULL)
+	{
+		return NULL;
+	}
+
+	memcpy(clone, gb, gb_snapshot_size(gb));
+	cartridge_share(clone, gb);
+	clone->running = gb->running;
+	gb_rebuild_host_state(clone);
+
+	// The clone gets a code buffer of its own (translations bake in the
+	// addresses of the instance's fields).
+	if (gb->cpu_jit_enabled)
+	{
+		cpu_jit_set_enabled(clone, myTrue);
+	}
+
+	return clone;
+}
+
+size_t gb_snapshot_size(const gb_t *gb)
+{
+	return GB_ARENA_FIXED_SIZE + gb->cartridge.ram_size;
+}
+
+void gb_snapshot(const gb_t *gb, void *buffer)
+{
+	memcpy(buffer, gb, gb_snapshot_size(gb));
+}
+
+void gb_restore(gb_t *gb, const void *buffer)
+{
+	memcpy(gb, buffer, gb_snapshot_size(gb));
+	gb_rebuild_host_state(gb);
+}
+
+// ----------------------------------------------------------------------
+// gb_run
+// Steps the CPU and PPU until budget T-cycles have run, or (when
+// stop_at_vblank is set) the PPU has finished a frame, or the CPU can
+// no longer run.
+// ----------------------------------------------------------------------
+static gb_run_result_t gb_run(gb_t *gb, uint32_t budget, myBool stop_at_vblank)
+{
+	gb_run_result_t result;
+	uint16_t step_cycles;
+
+	result.cycles = 0;
+	result.reason = GB_STOP_BUDGET;
+
+	gb->ppu_state.frame_ready = myFalse;
+
+	while (result.cycles < budget)
+	{
+		if (!gb->running)
+		{
+			result.reason = gb->cpu_is_locked_up ? GB_STOP_ILLEGAL_OPCODE : GB_STOP_NOT_RUNNING;
+			break;
+		}
+
+		if (gb->emulator_is_stopped)
+		{
+			result.reason = GB_STOP_CPU_STOPPED;
+			break;
+		}
+
+		gb->cpu_skip_limit = budget - result.cycles;
+		step_cycles = cpu_step(gb);
+		ppu_step(gb, step_cycles);
+		result.cycles += step_cycles;
+
+		if (stop_at_vblank && gb->ppu_state.frame_ready)
+		{
+			result.reason = GB_STOP_VBLANK;
+			break;
+		}
+
+		// Reported by this call even if it also used up the budget.
+		if (gb->cpu_is_locked_up)
+		{
+			result.reason = GB_STOP_ILLEGAL_OPCODE;
+			break;
+		}
+	}
+
+	gb->cpu_skip_limit = 0;
+
+	return result;
+}
+
+gb_run_result_t gb_run_cycles(gb_t *gb, uint32_t cycles)
+{
+	gb_run_result_t result;
+
+	// Pay back what the previous call ran over first.
+	if (gb->run_cycles_overshoot >= cycles)
+	{
+		gb->run_cycles_overshoot -= cycles;
+		result.cycles = 0;
+		result.reason = GB_STOP_BUDGET;
+		return result;
+	}
+
+	cycles -= gb->run_cycles_overshoot;
+	gb->run_cycles_overshoot = 0;
+
+	result = gb_run(gb, cycles, myFalse);
+
+	if (result.cycles > cycles)
+	{
+		gb->run_cycles_overshoot = result.cycles - cycles;
+	}
+
+	return result;
+}
+
+gb_run_result_t gb_run_frame(gb_t *gb)
+{
+	return gb_run(gb, PPU_FRAME_CYCLES, myTrue);
+}
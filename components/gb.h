@@ -0,0 +1,233 @@
+/*
+ * gb.h
+ *
+ * The emulator instance. Everything that used to be a process-wide
+ * global in cpu.c, mmu.c, ppu.c and jit_x64.c lives in one gb_t, and
+ * every component function takes the instance it works on as its first
+ * argument, so several machines can run side by side in one process.
+ *
+ * All guest state sits in one arena at the head of gb_t, so a snapshot,
+ * a restore or a clone is one memcpy plus rebuilding the host side.
+ */
+
+#ifndef COMPONENTS_GB_H_
+#define COMPONENTS_GB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "..\headers\mystdbool.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "ppu.h"
+#include "cartridge.h"
+
+// Hot parts of the arena start on their own cache line.
+#define GB_CACHE_LINE_SIZE		(64)
+
+struct gb_s
+{
+	// ==================================================================
+	// Guest State Arena
+	// Everything the emulated machine can see, and nothing else, in this
+	// fixed order from offset 0 of gb_t up to and including external_ram.
+	// It holds no pointers, so copying it is a complete snapshot:
+	//
+	//   0xFF00-0xFFFF   I/O, HRAM and IE back to back, as on the bus,
+	//                   then IF and the CPU registers and flags
+	//   0xC000-0xDFFF   WRAM, all eight CGB banks (new cache line)
+	//   0xFE00-0xFEFF   OAM and the unusable area
+	//                   MBC registers
+	//   0x8000-0x9FFF   VRAM, both CGB banks (new cache line), then
+	//                   the PPU state
+	//   0xA000-0xBFFF   Cartridge RAM (new cache line), last so that
+	//                   only cartridge.ram_size bytes of it need copying
+	//
+	// Host-side state (image, page table, block cache, JIT) follows and
+	// is rebuilt from the arena after a restore; see gb_restore().
+	// ==================================================================
+	_Alignas(GB_CACHE_LINE_SIZE)
+	uint8_t i_o_register[MMU_I_O_REGISTER_SIZE];    // 0xFF00 - 0xFF7F (I/O Registers)
+	uint8_t high_ram[MMU_HIGH_RAM_SIZE];            // 0xFF80 - 0xFFFE (High RAM)
+	uint8_t interrupt_enable;                       // 0xFFFF (Interrupt Enable Register)
+	uint8_t m_interrupt_flags;
+
+	// ------------------------------------------------------------------
+	// CPU
+	// ------------------------------------------------------------------
+	CPU_State cpu_regs;
+	cpu_lazy_flags_t cpu_lazy_flags;
+
+	myBool emulator_is_stopped;
+	myBool cpu_is_halted;
+	myBool cpu_is_locked_up;			// Executed an illegal opcode; only a reset recovers
+	myBool interrupt_master_enable;
+
+	// IE & IF over the five interrupt sources while IME is set, 0 otherwise,
+	// so cpu_step only has to test one byte after each block. Whatever writes
+	// IE, IF or IME calls cpu_interrupts_changed() to keep it current.
+	uint8_t cpu_interrupts_pending;
+
+	// ------------------------------------------------------------------
+	// Memory
+	// ------------------------------------------------------------------
+	_Alignas(GB_CACHE_LINE_SIZE)
+	uint8_t work_ram_a[MMU_WORK_RAM_A_SIZE];        // 0xC000 - 0xCFFF (4 KiB Work RAM Bank 0)
+	uint8_t work_ram_b[MMU_WORK_RAM_B_BANK_COUNT * MMU_WORK_RAM_B_SIZE];    // 0xD000 - 0xDFFF (Work RAM Banks 1-7, SVBK picks)
+	uint8_t oam[MMU_OAM_SIZE];                      // 0xFE00 - 0xFE9F (Object Attribute Memory)
+	uint8_t not_usable[MMU_NOT_USABLE_SIZE];        // 0xFEA0 - 0xFEFF (Not Usable Area)
+
+	// MBC bank and clock registers (the image itself is host state below).
+	cartridge_registers_t cartridge_registers;
+
+	_Alignas(GB_CACHE_LINE_SIZE)
+	uint8_t v_ram[MMU_V_RAM_BANK_COUNT * MMU_V_RAM_SIZE];   // 0x8000 - 0x9FFF (Video RAM Banks 0-1, VBK picks)
+
+	// ------------------------------------------------------------------
+	// PPU
+	// ------------------------------------------------------------------
+	ppu_state_t ppu_state;
+
+	// 0xA000 - 0xBFFF (Cartridge RAM, every bank). Must stay last.
+	_Alignas(GB_CACHE_LINE_SIZE)
+	uint8_t external_ram[CARTRIDGE_MAX_RAM_SIZE];
+
+	// ==================================================================
+	// Host State
+	// ==================================================================
+
+	// ROM (0x0000 - 0x7FFF) image and the cartridge's fixed properties.
+	cartridge_t cartridge;
+
+	// Base pointer of each 256-byte page, NULL where mmu.c has to handle
+	// the access itself. Points into the arena or the cartridge image.
+	const uint8_t *mmu_read_page[MMU_PAGE_COUNT];
+	uint8_t *mmu_write_page[MMU_PAGE_COUNT];
+
+	// The real page table while an OAM DMA transfer holds the bus. The
+	// live one then sends everything below 0xFF00 to the handlers, which
+	// refuse it; the transfer itself reads its source through this copy.
+	const uint8_t *mmu_dma_read_page[MMU_PAGE_COUNT];
+	uint8_t *mmu_dma_write_page[MMU_PAGE_COUNT];
+
+	// What VRAM and OAM pages point at while the PPU has them locked:
+	// reads find 0xFF, writes land where nothing reads them back.
+	uint8_t mmu_open_bus_page[MMU_PAGE_SIZE];
+	uint8_t mmu_discard_page[MMU_PAGE_SIZE];
+
+	// VRAM tiles decoded for the renderer (see ppu.h).
+	ppu_tile_cache_t ppu_tile_cache;
+
+	// Bank currently mapped at 0x4000-0x7FFF, kept up to date by the MBC.
+	uint16_t mmu_rom_bank_number;
+
+	// T-cycles used by the block (or single instruction) currently executing.
+	// cpu_step seeds it with the summed not-taken costs, conditional handlers
+	// add the taken surcharge and the $CB handler adds the prefixed cost.
+	uint16_t cpu_step_cycles;
+
+	myBool running;
+
+	// T-cycles idle-loop skipping has charged without executing, this frame
+	// so far and over the whole of the previous frame.
+	uint32_t cpu_idle_skipped_cycles;
+	uint32_t cpu_idle_skipped_cycles_last_frame;
+
+	// Upper bound on a single HALT/idle-loop fast-forward, 0 for none.
+	// gb_run_cycles sets it to what is left of its budget.
+	uint32_t cpu_skip_limit;
+
+	// ------------------------------------------------------------------
+	// Block Cache
+	// ------------------------------------------------------------------
+	cpu_block_t cpu_block_cache[CPU_BLOCK_CACHE_ENTRIES];
+
+	// Non-zero for granules that cached RAM blocks were decoded from.
+	uint8_t cpu_block_code_granules[CPU_BLOCK_GRANULE_COUNT];
+
+	// Bumped each time a marked granule is written; blocks compare against it.
+	uint32_t block_granule_generation[CPU_BLOCK_GRANULE_COUNT];
+
+	// Set by cpu_block_cache_invalidate so the running block can check itself.
+	myBool cpu_block_cache_written;
+
+	// Instruction being executed from a block (NULL outside blocks).
+	const cpu_decoded_instruction_t *current_instruction;
+
+	// ------------------------------------------------------------------
+	// JIT
+	// ------------------------------------------------------------------
+	myBool cpu_jit_enabled;
+	uint8_t *jit_code_buffer;
+	uint8_t *jit_emit_cursor;
+	uint8_t *jit_emit_limit;
+
+	// Block the last translated run ended in (NULL after an interpreted step).
+	cpu_block_t *jit_last_block;
+
+	// ------------------------------------------------------------------
+	// Bounded Execution
+	// ------------------------------------------------------------------
+	// T-cycles the last gb_run_cycles call ran past its budget (a step
+	// cannot be split); the next call runs that much less.
+	uint32_t run_cycles_overshoot;
+
+#if MMU_INSTRUMENTATION
+	// ------------------------------------------------------------------
+	// Access Counters (not part of a snapshot; see mmu_stats_export)
+	// ------------------------------------------------------------------
+	mmu_stats_t mmu_stats;
+#endif
+};
+
+// Bytes of the arena ahead of the cartridge RAM.
+#define GB_ARENA_FIXED_SIZE		(offsetof(gb_t, external_ram))
+
+// Why gb_run_cycles / gb_run_frame returned.
+typedef enum
+{
+	GB_STOP_BUDGET = 0,		// The requested cycles have run
+	GB_STOP_VBLANK,			// The PPU entered V-Blank (a frame is in screen_buffer)
+	GB_STOP_CPU_STOPPED,	// A STOP instruction ran; clear emulator_is_stopped to resume
+	GB_STOP_NOT_RUNNING,	// gb->running is myFalse
+	GB_STOP_ILLEGAL_OPCODE	// The CPU hit an undefined opcode (at PC) and locked up; gb_reset recovers
+} gb_stop_reason_t;
+
+typedef struct
+{
+	uint32_t cycles;			// T-cycles actually run by this call
+	gb_stop_reason_t reason;
+} gb_run_result_t;
+
+// Allocates an instance in its power-on state. Returns NULL if out of memory.
+gb_t *gb_create(void);
+
+// Releases an instance and everything it owns (JIT code buffer included).
+void gb_destroy(gb_t *gb);
+
+// Puts the machine back in its power-on state with the same cartridge
+// inserted. Cartridge RAM is kept, as the battery would keep it.
+void gb_reset(gb_t *gb);
+
+// A new instance in exactly gb's state, sharing its cartridge image.
+// Returns NULL if out of memory.
+gb_t *gb_clone(const gb_t *gb);
+
+// Bytes gb_snapshot writes: the arena up to the end of the cartridge's RAM.
+size_t gb_snapshot_size(const gb_t *gb);
+
+// Copies the arena into buffer (gb_snapshot_size bytes).
+void gb_snapshot(const gb_t *gb, void *buffer);
+
+// Loads a snapshot taken from an instance running the same cartridge.
+void gb_restore(gb_t *gb, const void *buffer);
+
+// Runs gb for cycles T-cycles and returns. Steps are never split, so a
+// call can run past its budget by part of a step; that overshoot is
+// taken off the next call, keeping a sequence of calls on schedule.
+gb_run_result_t gb_run_cycles(gb_t *gb, uint32_t cycles);
+
+// Runs gb up to the start of the next V-Blank. With the LCD off there is
+// no V-Blank, so it stops after one frame's worth of cycles instead.
+gb_run_result_t gb_run_frame(gb_t *gb);
+
+#endif /* COMPONENTS_GB_H_ */
@@ -0,0 +1,506 @@
+/*
+ * jit_x64.c
+ *
+ * Translates cached CPU blocks into x86-64 machine code.
+ *
+ * Each block becomes one function working directly on one gb_t's cpu_regs
+ * (held in RBX) and cpu_lazy_flags. Those addresses are baked into the
+ * code, so every instance owns its own code buffer. Register loads, 16-bit increments, ADD/SUB/
+ * AND/XOR/OR/CP and unconditional JP/JR are emitted inline; every other
+ * instruction is a call to cpu_execute_instruction with its decoded form,
+ * so the translator never has to know more opcodes than it is worth.
+ *
+ * At the end of a block the exits recorded at decode time are compared
+ * against PC. When one matches and cpu.c has linked it, the code jumps
+ * straight into the next translated block, provided the step is still
+ * inside JIT_CHAIN_CYCLE_BUDGET, no interrupt is waiting, no OAM DMA
+ * transfer is running and (for the switchable ROM area) the same bank is
+ * still mapped.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "..\headers\mystdbool.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "jit_x64.h"
+#include "gb.h"
+
+#if CPU_JIT_SUPPORTED
+
+#include <sys/mman.h>
+
+// Byte offsets into CPU_State for r8 operand numbers (6 is (HL), never inlined).
+static const uint8_t jit_r8_offset[8] =
+{
+	offsetof(CPU_State, B), offsetof(CPU_State, C), offsetof(CPU_State, D), offsetof(CPU_State, E),
+	offsetof(CPU_State, H), offsetof(CPU_State, L), 0xFF, offsetof(CPU_State, A)
+};
+
+// Byte offsets into CPU_State for r16 operand numbers.
+static const uint8_t jit_r16_offset[4] =
+{
+	offsetof(CPU_State, BC), offsetof(CPU_State, DE), offsetof(CPU_State, HL), offsetof(CPU_State, SP)
+};
+
+// ----------------------------------------------------------------------
+// Emitters
+// Registers used: RBX = &gb->cpu_regs for the whole block, RAX/RCX/RDX/RSI/RDI/R11
+// as scratch (all caller-saved, so calls into C need no spilling).
+// ----------------------------------------------------------------------
+static void emit8(gb_t *gb, uint8_t value)
+{
+	*gb->jit_emit_cursor++ = value;
+}
+
+static void emit16(gb_t *gb, uint16_t value)
+{
+	emit8(gb, (uint8_t)value);
+	emit8(gb, (uint8_t)(value >> 8));
+}
+
+static void emit32(gb_t *gb, uint32_t value)
+{
+	emit16(gb, (uint16_t)value);
+	emit16(gb, (uint16_t)(value >> 16));
+}
+
+static void emit64(gb_t *gb, uint64_t value)
+{
+	emit32(gb, (uint32_t)value);
+	emit32(gb, (uint32_t)(value >> 32));
+}
+
+// mov reg64, imm64 (REX.W B8+r; reg 0=RAX 1=RCX 2=RDX 3=RBX 6=RSI 7=RDI, 11=R11)
+static void emit_mov_imm64(gb_t *gb, uint8_t reg, const void *value)
+{
+	emit8(gb, (reg >= 8) ? 0x49 : 0x48);
+	emit8(gb, 0xB8 + (reg & 0x07));
+	emit64(gb, (uint64_t)(uintptr_t)value);
+}
+
+#define JIT_RAX		(0)
+#define JIT_RCX		(1)
+#define JIT_RDX		(2)
+#define JIT_RBX		(3)
+#define JIT_RSI		(6)
+#define JIT_RDI		(7)
+#define JIT_R11		(11)
+
+// jcc/jmp rel32 with the displacement left for emit_patch.
+static uint8_t *emit_jcc(gb_t *gb, uint8_t condition)
+{
+	emit8(gb, 0x0F);
+	emit8(gb, condition);
+	emit32(gb, 0);
+	return gb->jit_emit_cursor - 4;
+}
+
+#define JIT_JE		(0x84)
+#define JIT_JNE		(0x85)
+#define JIT_JAE		(0x83)
+
+static void emit_patch(gb_t *gb, uint8_t *displacement)
+{
+	int32_t distance = (int32_t)(gb->jit_emit_cursor - (displacement + 4));
+
+	displacement[0] = (uint8_t)distance;
+	displacement[1] = (uint8_t)(distance >> 8);
+	displacement[2] = (uint8_t)(distance >> 16);
+	displacement[3] = (uint8_t)(distance >> 24);
+}
+
+// mov word [rbx + PC], imm16
+static void emit_store_pc(gb_t *gb, uint16_t pc)
+{
+	emit8(gb, 0x66); emit8(gb, 0xC7); emit8(gb, 0x43); emit8(gb, offsetof(CPU_State, PC));
+	emit16(gb, pc);
+}
+
+// add word [cpu_step_cycles], imm16
+static void emit_add_cycles(gb_t *gb, uint16_t cycles)
+{
+	if (cycles == 0)
+	{
+		return;
+	}
+
+	emit_mov_imm64(gb, JIT_RAX, &gb->cpu_step_cycles);
+	emit8(gb, 0x66); emit8(gb, 0x81); emit8(gb, 0x00);
+	emit16(gb, cycles);
+}
+
+// jit_last_block = block; pop rbx; ret
+static void emit_return(gb_t *gb, cpu_block_t *block)
+{
+	emit_mov_imm64(gb, JIT_RAX, &gb->jit_last_block);
+	emit_mov_imm64(gb, JIT_RCX, block);
+	emit8(gb, 0x48); emit8(gb, 0x89); emit8(gb, 0x08);
+	emit8(gb, 0x5B);
+	emit8(gb, 0xC3);
+}
+
+// Calls back into the interpreter for one instruction.
+static void emit_interpreted(gb_t *gb, const cpu_decoded_instruction_t *instruction)
+{
+	emit_mov_imm64(gb, JIT_RDI, gb);
+	emit_mov_imm64(gb, JIT_RSI, instruction);
+	emit_mov_imm64(gb, JIT_RAX, (const void *)cpu_execute_instruction);
+	emit8(gb, 0xFF); emit8(gb, 0xD0);
+}
+
+#if CPU_LAZY_FLAGS
+// A op= ECX, recording the result in cpu_lazy_flags the way the
+// interpreter's alu_* helpers do. alu is the bits 5-3 operation number.
+static void emit_alu(gb_t *gb, uint8_t alu)
+{
+	static const uint8_t lazy_kind[8] =
+	{
+		CPU_LAZY_FLAGS_ADD, 0, CPU_LAZY_FLAGS_SUB, 0,
+		CPU_LAZY_FLAGS_AND, CPU_LAZY_FLAGS_OR, CPU_LAZY_FLAGS_OR, CPU_LAZY_FLAGS_SUB
+	};
+
+	// movzx eax, byte [rbx + A]
+	emit8(gb, 0x0F); emit8(gb, 0xB6); emit8(gb, 0x43); emit8(gb, offsetof(CPU_State, A));
+	emit_mov_imm64(gb, JIT_R11, &gb->cpu_lazy_flags);
+
+	// mov byte [r11 + op], kind / mov byte [r11 + preserved], 0
+	emit8(gb, 0x41); emit8(gb, 0xC6); emit8(gb, 0x43); emit8(gb, offsetof(cpu_lazy_flags_t, op)); emit8(gb, lazy_kind[alu]);
+	emit8(gb, 0x41); emit8(gb, 0xC6); emit8(gb, 0x43); emit8(gb, offsetof(cpu_lazy_flags_t, preserved)); emit8(gb, 0x00);
+
+	if (alu == 0 || alu == 2 || alu == 7)
+	{
+		// mov word [r11 + operand_a], ax / mov word [r11 + operand_b], cx
+		emit8(gb, 0x66); emit8(gb, 0x41); emit8(gb, 0x89); emit8(gb, 0x43); emit8(gb, offsetof(cpu_lazy_flags_t, operand_a));
+		emit8(gb, 0x66); emit8(gb, 0x41); emit8(gb, 0x89); emit8(gb, 0x4B); emit8(gb, offsetof(cpu_lazy_flags_t, operand_b));
+
+		// add eax, ecx / sub eax, ecx (the low 16 bits keep the carry/borrow in bit 8)
+		emit8(gb, (alu == 0) ? 0x01 : 0x29); emit8(gb, 0xC8);
+	}
+	else
+	{
+		// and/xor/or eax, ecx
+		emit8(gb, (alu == 4) ? 0x21 : (alu == 5) ? 0x31 : 0x09); emit8(gb, 0xC8);
+
+		// mov word [r11 + operand_a], 0 / mov word [r11 + operand_b], 0
+		emit8(gb, 0x66); emit8(gb, 0x41); emit8(gb, 0xC7); emit8(gb, 0x43); emit8(gb, offsetof(cpu_lazy_flags_t, operand_a)); emit16(gb, 0);
+		emit8(gb, 0x66); emit8(gb, 0x41); emit8(gb, 0xC7); emit8(gb, 0x43); emit8(gb, offsetof(cpu_lazy_flags_t, operand_b)); emit16(gb, 0);
+	}
+
+	// mov word [r11 + result], ax
+	emit8(gb, 0x66); emit8(gb, 0x41); emit8(gb, 0x89); emit8(gb, 0x43); emit8(gb, offsetof(cpu_lazy_flags_t, result));
+
+	// CP leaves A alone; everything else stores it: mov byte [rbx + A], al
+	if (alu != 7)
+	{
+		emit8(gb, 0x88); emit8(gb, 0x43); emit8(gb, offsetof(CPU_State, A));
+	}
+}
+#endif
+
+// Emits instruction inline if it is one of the forms handled here.
+// pc_stale is set when cpu_regs.PC no longer matches the guest position.
+static myBool emit_native(gb_t *gb, const cpu_decoded_instruction_t *instruction, uint16_t address, myBool *pc_stale)
+{
+	uint8_t opcode = instruction->opcode;
+	uint8_t destination = (opcode >> 3) & 0x07;
+	uint8_t source = opcode & 0x07;
+
+	if (instruction->prefixed)
+	{
+		return myFalse;
+	}
+
+	if (opcode == 0x00) // nop
+	{
+		*pc_stale = myTrue;
+		return myTrue;
+	}
+
+	if (opcode >= 0x40 && opcode <= 0x7F && destination != 6 && source != 6) // ld r8, r8
+	{
+		emit8(gb, 0x0F); emit8(gb, 0xB6); emit8(gb, 0x43); emit8(gb, jit_r8_offset[source]);
+		emit8(gb, 0x88); emit8(gb, 0x43); emit8(gb, jit_r8_offset[destination]);
+		*pc_stale = myTrue;
+		return myTrue;
+	}
+
+	if ((opcode & 0xC7) == 0x06 && destination != 6) // ld r8, imm8
+	{
+		emit8(gb, 0xC6); emit8(gb, 0x43); emit8(gb, jit_r8_offset[destination]);
+		emit8(gb, (uint8_t)instruction->immediate);
+		*pc_stale = myTrue;
+		return myTrue;
+	}
+
+	if ((opcode & 0xCF) == 0x01) // ld r16, imm16
+	{
+		emit8(gb, 0x66); emit8(gb, 0xC7); emit8(gb, 0x43); emit8(gb, jit_r16_offset[(opcode >> 4) & 0x03]);
+		emit16(gb, instruction->immediate);
+		*pc_stale = myTrue;
+		return myTrue;
+	}
+
+	if ((opcode & 0xC7) == 0x03) // inc r16 / dec r16
+	{
+		emit8(gb, 0x66); emit8(gb, 0xFF);
+		emit8(gb, (opcode & 0x08) ? 0x4B : 0x43);
+		emit8(gb, jit_r16_offset[(opcode >> 4) & 0x03]);
+		*pc_stale = myTrue;
+		return myTrue;
+	}
+
+#if CPU_LAZY_FLAGS
+	// ADC and SBC need the incoming carry, so they stay interpreted.
+	if (destination != 1 && destination != 3)
+	{
+		if (opcode >= 0x80 && opcode <= 0xBF && source != 6) // alu A, r8
+		{
+			// movzx ecx, byte [rbx + r8]
+			emit8(gb, 0x0F); emit8(gb, 0xB6); emit8(gb, 0x4B); emit8(gb, jit_r8_offset[source]);
+			emit_alu(gb, destination);
+			*pc_stale = myTrue;
+			return myTrue;
+		}
+
+		if ((opcode & 0xC7) == 0xC6) // alu A, imm8
+		{
+			// mov ecx, imm32
+			emit8(gb, 0xB9); emit32(gb, (uint8_t)instruction->immediate);
+			emit_alu(gb, destination);
+			*pc_stale = myTrue;
+			return myTrue;
+		}
+	}
+#endif
+
+	if (opcode == 0xC3) // jp imm16
+	{
+		emit_store_pc(gb, instruction->immediate);
+		*pc_stale = myFalse;
+		return myTrue;
+	}
+
+	if (opcode == 0x18) // jr imm8
+	{
+		emit_store_pc(gb, (uint16_t)(address + 2 + (int8_t)instruction->immediate));
+		*pc_stale = myFalse;
+		return myTrue;
+	}
+
+	return myFalse;
+}
+
+// Jumps to the linked successor for one exit if every chaining condition
+// holds. Failed checks jump to the shared return, recorded in done_jumps.
+static void emit_chain_exit(gb_t *gb, cpu_block_t *block, uint8_t exit, uint8_t **done_jumps, uint8_t *done_count)
+{
+	uint16_t target = block->exit_pc[exit];
+	uint8_t *next_exit;
+
+	// cmp word [rbx + PC], target / jne next exit
+	emit8(gb, 0x66); emit8(gb, 0x81); emit8(gb, 0x7B); emit8(gb, offsetof(CPU_State, PC)); emit16(gb, target);
+	next_exit = emit_jcc(gb, JIT_JNE);
+
+	// rax = link[exit]; test rax, rax / je done
+	emit_mov_imm64(gb, JIT_RAX, &block->link[exit]);
+	emit8(gb, 0x48); emit8(gb, 0x8B); emit8(gb, 0x00);
+	emit8(gb, 0x48); emit8(gb, 0x85); emit8(gb, 0xC0);
+	done_jumps[(*done_count)++] = emit_jcc(gb, JIT_JE);
+
+	// Code at 0x4000-0x7FFF was linked for one particular bank.
+	if (target >= MMU_ADDRESS_ROM_BANK_01_NN_START && target <= MMU_ADDRESS_ROM_BANK_01_NN_END)
+	{
+		emit_mov_imm64(gb, JIT_RCX, &gb->mmu_rom_bank_number);
+		emit8(gb, 0x0F); emit8(gb, 0xB7); emit8(gb, 0x09);					// movzx ecx, word [rcx]
+		emit_mov_imm64(gb, JIT_RDX, &block->link_bank[exit]);
+		emit8(gb, 0x66); emit8(gb, 0x3B); emit8(gb, 0x0A);					// cmp cx, word [rdx]
+		done_jumps[(*done_count)++] = emit_jcc(gb, JIT_JNE);
+	}
+
+	// Give control back once the step has run a scanline's worth.
+	emit_mov_imm64(gb, JIT_RCX, &gb->cpu_step_cycles);
+	emit8(gb, 0x0F); emit8(gb, 0xB7); emit8(gb, 0x09);						// movzx ecx, word [rcx]
+	emit8(gb, 0x81); emit8(gb, 0xF9); emit32(gb, JIT_CHAIN_CYCLE_BUDGET);	// cmp ecx, budget
+	done_jumps[(*done_count)++] = emit_jcc(gb, JIT_JAE);
+
+	// Let cpu_step dispatch any interrupt that is now due.
+	emit_mov_imm64(gb, JIT_RCX, &gb->cpu_interrupts_pending);
+	emit8(gb, 0x80); emit8(gb, 0x39); emit8(gb, 0x00);						// cmp byte [rcx], 0
+	done_jumps[(*done_count)++] = emit_jcc(gb, JIT_JNE);
+
+	// An OAM DMA transfer only advances between steps.
+	emit_mov_imm64(gb, JIT_RCX, &gb->ppu_state.dma_active);
+	emit8(gb, 0x80); emit8(gb, 0x39); emit8(gb, 0x00);						// cmp byte [rcx], 0
+	done_jumps[(*done_count)++] = emit_jcc(gb, JIT_JNE);
+
+	// jmp rax
+	emit8(gb, 0xFF); emit8(gb, 0xE0);
+
+	emit_patch(gb, next_exit);
+}
+
+// ----------------------------------------------------------------------
+// Public Interface
+// ----------------------------------------------------------------------
+myBool jit_init(gb_t *gb)
+{
+	if (gb->jit_code_buffer == NULL)
+	{
+		void *buffer = mmap(NULL, JIT_CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+							MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+		if (buffer == MAP_FAILED)
+		{
+			return myFalse;
+		}
+
+		gb->jit_code_buffer = (uint8_t *)buffer;
+	}
+
+	jit_reset(gb);
+	return myTrue;
+}
+
+void jit_reset(gb_t *gb)
+{
+	gb->jit_emit_cursor = gb->jit_code_buffer;
+	gb->jit_emit_limit = gb->jit_code_buffer + JIT_CODE_BUFFER_SIZE;
+	gb->jit_last_block = NULL;
+}
+
+myBool jit_compile(gb_t *gb, cpu_block_t *block)
+{
+	uint8_t *done_jumps[10];		// Five per exit
+	uint8_t done_count = 0;
+	uint16_t address = block->start_pc;
+	uint16_t cycles_so_far = 0;
+	myBool pc_stale = myFalse;
+
+	if (gb->jit_code_buffer == NULL || (gb->jit_emit_limit - gb->jit_emit_cursor) < JIT_MAX_BLOCK_CODE_SIZE)
+	{
+		return myFalse;
+	}
+
+	// Prologue: push rbx; mov rbx, &gb->cpu_regs
+	block->native_entry = gb->jit_emit_cursor;
+	emit8(gb, 0x53);
+	emit_mov_imm64(gb, JIT_RBX, &gb->cpu_regs);
+
+	// Chained blocks enter here with RBX already set up.
+	block->native_body = gb->jit_emit_cursor;
+
+	if (block->in_ram)
+	{
+		// mov byte [cpu_block_cache_written], 0
+		emit_mov_imm64(gb, JIT_RAX, &gb->cpu_block_cache_written);
+		emit8(gb, 0xC6); emit8(gb, 0x00); emit8(gb, 0x00);
+	}
+
+	for (uint8_t index = 0; index < block->instruction_count; index++)
+	{
+		const cpu_decoded_instruction_t *instruction = &block->instructions[index];
+
+		cycles_so_far += instruction->cycles;
+
+		if (!emit_native(gb, instruction, address, &pc_stale))
+		{
+			if (pc_stale)
+			{
+				emit_store_pc(gb, address);
+				pc_stale = myFalse;
+			}
+
+			emit_interpreted(gb, instruction);
+
+			// RAM blocks stop as soon as any cached code has been written,
+			// in case it was their own. PC is already past this instruction.
+			if (block->in_ram && index + 1 < block->instruction_count)
+			{
+				uint8_t *keep_going;
+
+				emit_mov_imm64(gb, JIT_RAX, &gb->cpu_block_cache_written);
+				emit8(gb, 0x80); emit8(gb, 0x38); emit8(gb, 0x00);			// cmp byte [rax], 0
+				keep_going = emit_jcc(gb, JIT_JE);
+				emit_add_cycles(gb, cycles_so_far);
+				emit_return(gb, block);
+				emit_patch(gb, keep_going);
+			}
+		}
+
+		address += instruction->length;
+	}
+
+	if (pc_stale)
+	{
+		emit_store_pc(gb, block->end_pc);
+	}
+
+	emit_add_cycles(gb, block->cycles);
+
+	for (uint8_t exit = 0; exit < block->exit_count; exit++)
+	{
+		emit_chain_exit(gb, block, exit, done_jumps, &done_count);
+	}
+
+	for (uint8_t jump = 0; jump < done_count; jump++)
+	{
+		emit_patch(gb, done_jumps[jump]);
+	}
+
+	emit_return(gb, block);
+
+	return myTrue;
+}
+
+void jit_enter(gb_t *gb, cpu_block_t *block)
+{
+	(void)gb;
+	((void (*)(void))block->native_entry)();
+}
+
+void jit_release(gb_t *gb)
+{
+	if (gb->jit_code_buffer != NULL)
+	{
+		munmap(gb->jit_code_buffer, JIT_CODE_BUFFER_SIZE);
+		gb->jit_code_buffer = NULL;
+	}
+
+	jit_reset(gb);
+}
+
+#else
+
+// No translator on this host: cpu_jit_set_enabled() reports the failure
+// and every block stays interpreted.
+myBool jit_init(gb_t *gb)
+{
+	(void)gb;
+	return myFalse;
+}
+
+void jit_reset(gb_t *gb)
+{
+	gb->jit_last_block = NULL;
+}
+
+myBool jit_compile(gb_t *gb, cpu_block_t *block)
+{
+	(void)gb;
+	(void)block;
+	return myFalse;
+}
+
+void jit_enter(gb_t *gb, cpu_block_t *block)
+{
+	(void)gb;
+	(void)block;
+}
+
+void jit_release(gb_t *gb)
+{
+	gb->jit_last_block = NULL;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * jit_x64.h
+ *
+ * Optional x86-64 (Linux) translator for cached CPU blocks.
+ * cpu.c decides when a block is hot and hands it over; everything the
+ * translator does not handle itself is called back into the interpreter.
+ * Translations embed the addresses of one gb_t, so each instance has its
+ * own code buffer.
+ */
+
+#ifndef COMPONENTS_JIT_X64_H_
+#define COMPONENTS_JIT_X64_H_
+
+#include <stdint.h>
+#include "..\headers\mystdbool.h"
+#include "cpu.h"
+
+// ----------------------------------------------------------------------
+// JIT Configuration
+// ----------------------------------------------------------------------
+#define JIT_CODE_BUFFER_SIZE		(4 * 1024 * 1024)
+
+// Worst case for one translated block (16 instructions plus exits).
+#define JIT_MAX_BLOCK_CODE_SIZE		(2048)
+
+// Chained blocks keep running without returning to cpu_step until the
+// step has used this many T-cycles (one scanline), so the rest of the
+// machine is never left far behind.
+#define JIT_CHAIN_CYCLE_BUDGET		(456)
+
+// Maps gb's code buffer. Returns myFalse if translated code cannot run here.
+// gb->jit_last_block is the block the last translated run ended in
+// (NULL after an interpreted step).
+extern myBool jit_init(gb_t *gb);
+
+// Translates block and sets its native_entry/native_body.
+// Returns myFalse when the code buffer is full.
+extern myBool jit_compile(gb_t *gb, cpu_block_t *block);
+
+// Throws away every translation and starts the code buffer over.
+extern void jit_reset(gb_t *gb);
+
+// Runs a translated block (and any blocks chained after it).
+extern void jit_enter(gb_t *gb, cpu_block_t *block);
+
+// Unmaps gb's code buffer (called when the instance is destroyed).
+extern void jit_release(gb_t *gb);
+
+#endif /* COMPONENTS_JIT_X64_H_ */
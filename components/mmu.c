@@ -12,403 +12,760 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "..\headers\mystdbool.h"
 
 #include "mmu.h"
+#include "cpu.h"
 #include "ppu.h"
+#include "cartridge.h"
+#include "gb.h"
 #include "..\BitOps\bit_macros.h"
 
 // ----------------------------------------------------------------------
-// Global Memory Arrays
-// These arrays represent the physical memory regions of the Game Boy.
-// They correspond to the sizes defined in mmu.h.
+// Page Table
+// Every 256-byte page of the address space has a read and a write base
+// pointer in gb->mmu_read_page / gb->mmu_write_page. Plain memory is
+// reached through them with one indexed load; a NULL entry sends the
+// access to the handlers below (I/O, IE, OAM, MBC registers, Echo writes,
+// external RAM while it is disabled).
+//
+// While an OAM DMA transfer runs, the real table is kept aside in
+// gb->mmu_dma_read_page / gb->mmu_dma_write_page (and mapping changes go
+// there), and the live one is NULL below 0xFF00.
 // ----------------------------------------------------------------------
-uint8_t rom_bank_00[MMU_ROM_BANK_00_SIZE];      // 0x0000 - 0x3FFF (16 KiB)
-uint8_t rom_bank_01[MMU_ROM_BANK_01_SIZE];      // 0x4000 - 0x7FFF (16 KiB, switchable bank 1-NN)
-uint8_t v_ram[MMU_V_RAM_SIZE];                  // 0x8000 - 0x9FFF (8 KiB Video RAM)
-uint8_t external_ram[MMU_EXTERNAL_RAM_SIZE];    // 0xA000 - 0xBFFF (8 KiB External RAM)
-uint8_t work_ram_a[MMU_WORK_RAM_A_SIZE];        // 0xC000 - 0xCFFF (4 KiB Work RAM Bank 0)
-uint8_t work_ram_b[MMU_WORK_RAM_B_SIZE];        // 0xD000 - 0xDFFF (4 KiB Work RAM Bank 1)
-uint8_t oam[MMU_OAM_SIZE];                      // 0xFE00 - 0xFE9F (Object Attribute Memory)
-uint8_t not_usable[MMU_NOT_USABLE_SIZE];        // 0xFEA0 - 0xFEFF (Not Usable Area)
-uint8_t i_o_register[MMU_I_O_REGISTER_SIZE];    // 0xFF00 - 0xFF7F (I/O Registers)
-uint8_t high_ram[MMU_HIGH_RAM_SIZE];            // 0xFF80 - 0xFFFE (High RAM)
-uint8_t interrupt_enable;                       // 0xFFFF (Interrupt Enable Register)
-uint8_t m_interrupt_flags;
-
-myBool pending_DMA = myFalse;
+
+void mmu_map_pages(gb_t *gb, uint16_t start, uint16_t end, const uint8_t *read_base, uint8_t *write_base)
+{
+	const uint8_t **read_table = gb->ppu_state.dma_active ? gb->mmu_dma_read_page : gb->mmu_read_page;
+	uint8_t **write_table = gb->ppu_state.dma_active ? gb->mmu_dma_write_page : gb->mmu_write_page;
+
+	for (uint16_t page = start >> MMU_PAGE_SHIFT; page <= (end >> MMU_PAGE_SHIFT); page++)
+	{
+		uint16_t offset = (uint16_t)((page << MMU_PAGE_SHIFT) - start);
+
+		read_table[page] = (read_base != NULL) ? read_base + offset : NULL;
+		write_table[page] = (write_base != NULL) ? write_base + offset : NULL;
+	}
+}
+
+// Points every live page below 0xFF00 at the handlers for a DMA transfer.
+static void mmu_dma_lock_bus(gb_t *gb)
+{
+	for (uint16_t page = 0; page < (MMU_ADDRESS_I_O_REGISTER_START >> MMU_PAGE_SHIFT); page++)
+	{
+		gb->mmu_read_page[page] = NULL;
+		gb->mmu_write_page[page] = NULL;
+	}
+}
 
 // ----------------------------------------------------------------------
-// mmu_read_byte
-// Reads a single byte from the specified 16-bit memory address.
-// Routes the address to the correct memory region (ROM, RAM, VRAM, etc.).
+// CGB Banks
+// VBK and SVBK live in gb->i_o_register like any other register, so a
+// snapshot carries them; the page table is rebuilt from them. DMG
+// cartridges always see VRAM bank 0 and WRAM bank 1.
 // ----------------------------------------------------------------------
-uint8_t mmu_read_byte(uint16_t address)
+static uint8_t *mmu_v_ram_bank(gb_t *gb)
 {
-	// Initialize return_value to 0xFF, which is standard behavior for reads from
-    // unmapped or invalid memory addresses on the Game Boy.
-	uint8_t return_value = 0xFF;
-	uint16_t offset = 0x0000;
+	uint8_t bank = gb->cartridge.cgb_mode ? (MMU_IO_REGISTER(gb, MMU_ADDRESS_VBK_REGISTER) & MMU_VBK_BANK_MASK) : 0;
+
+	return gb->v_ram + (uint32_t)bank * MMU_V_RAM_SIZE;
+}
 
-	// Check if the address is the Interrupt Enable Register (0xFFFF)
-	if (address == MMU_ADDRESS_INTERRUPT_ENABLE_REGISTER)
+static uint8_t *mmu_work_ram_b_bank(gb_t *gb)
+{
+	uint8_t bank = gb->cartridge.cgb_mode ? (MMU_IO_REGISTER(gb, MMU_ADDRESS_SVBK_REGISTER) & MMU_SVBK_BANK_MASK) : 1;
+
+	if (bank == 0)
 	{
-		return_value = interrupt_enable;
+		bank = 1;
 	}
 
-	else if (address == MMU_ADDRESS_INTERRUPT_FLAG_REGISTER)
+	return gb->work_ram_b + (uint32_t)(bank - 1) * MMU_WORK_RAM_B_SIZE;
+}
+
+// Echo RAM reads straight from WRAM. Writes take the handler so the
+// block cache hears about them under the WRAM address.
+static void mmu_map_work_ram_b(gb_t *gb)
+{
+	uint8_t *bank_base = mmu_work_ram_b_bank(gb);
+
+	mmu_map_pages(gb, MMU_ADDRESS_WORK_RAM_B_START, MMU_ADDRESS_WORK_RAM_B_END, bank_base, bank_base);
+	mmu_map_pages(gb, MMU_ADDRESS_ECHO_RAM_START + MMU_WORK_RAM_A_SIZE, MMU_ADDRESS_ECHO_RAM_END, bank_base, NULL);
+}
+
+// ----------------------------------------------------------------------
+// Video Memory Locking
+// The CPU cannot reach VRAM while the PPU is drawing (mode 3), nor OAM
+// from the OAM scan (mode 2) to the end of drawing: reads give 0xFF and
+// writes are dropped. Instead of every access testing the mode, the PPU
+// calls mmu_map_video_memory on each mode change and locked pages are
+// pointed at the open-bus and discard pages.
+// ----------------------------------------------------------------------
+static myBool mmu_v_ram_locked(gb_t *gb)
+{
+	return (gb->ppu_state.lcd_enabled && gb->ppu_state.current_mode == PPU_MODE_DRAWING) ? myTrue : myFalse;
+}
+
+static myBool mmu_oam_locked(gb_t *gb)
+{
+	return (gb->ppu_state.lcd_enabled
+			&& (gb->ppu_state.current_mode == PPU_MODE_OAM_SCAN || gb->ppu_state.current_mode == PPU_MODE_DRAWING)) ? myTrue : myFalse;
+}
+
+// Points every page in [start, end] at the same open-bus and discard pages.
+static void mmu_map_open_bus(gb_t *gb, uint16_t start, uint16_t end)
+{
+	for (uint32_t address = start; address <= end; address += MMU_PAGE_SIZE)
 	{
-		return_value = m_interrupt_flags | 0b11100000;
+		mmu_map_pages(gb, (uint16_t)address, (uint16_t)(address + MMU_PAGE_OFFSET_MASK), gb->mmu_open_bus_page, gb->mmu_discard_page);
 	}
-	// Check if the address is within the ROM region (0x0000 - 0x7FFF)
-	else if (address <= MMU_ADDRESS_ROM_BANK_END)
+}
+
+// Writes to the tile data of bank 0 take the handler so the PPU's tile
+// cache hears about them; everything else in VRAM is direct.
+static void mmu_map_v_ram(gb_t *gb)
+{
+	uint8_t *bank_base = mmu_v_ram_bank(gb);
+
+	if (mmu_v_ram_locked(gb))
 	{
-		// Check for ROM Bank 00 (0x0000 - 0x3FFF)
-		if (address <= MMU_ADDRESS_ROM_BANK_00_END)
-		{
-			// Calculate offset relative to ROM Bank 00 start
-			offset = address - MMU_ADDRESS_ROM_BANK_00_START;
-			return_value = rom_bank_00[offset];
-		}
-		// If not Bank 00, it must be the switchable ROM Bank (0x4000 - 0x7FFF)
-		else
-		{
-			// Calculate offset relative to ROM Bank 01 start
-			offset = address - MMU_ADDRESS_ROM_BANK_01_NN_START;
-			// Note: This implementation assumes Bank 01 is always selected for simplicity.
-            // Proper emulation requires handling the switchable bank.
-			return_value = rom_bank_01[offset];
-		}
+		mmu_map_open_bus(gb, MMU_ADDRESS_V_RAM_START, MMU_ADDRESS_V_RAM_END);
+		return;
 	}
-	// Check for Video RAM (VRAM) (0x8000 - 0x9FFF)
-	else if(address <= MMU_ADDRESS_V_RAM_END)
+
+	mmu_map_pages(gb, MMU_ADDRESS_V_RAM_START, MMU_ADDRESS_V_RAM_END, bank_base, bank_base);
+
+	if (bank_base == gb->v_ram)
 	{
-		offset = address - MMU_ADDRESS_V_RAM_START;
-		return_value = v_ram[offset];
+		mmu_map_pages(gb, PPU_TILE_DATA_ADDRESS, PPU_TILE_DATA_ADDRESS_END, bank_base, NULL);
 	}
-	// Check for External RAM (0xA000 - 0xBFFF)
-	else if(address <= MMU_ADDRESS_EXTERNAL_RAM_END)
+}
+
+// OAM and the unusable area share page 0xFE, back to back in the arena,
+// so unlocked reads are direct. Writes always take the handler, which
+// drops those to the unusable area.
+static void mmu_map_oam(gb_t *gb)
+{
+	if (mmu_oam_locked(gb))
 	{
-		offset = address - MMU_ADDRESS_EXTERNAL_RAM_START;
-		return_value = external_ram[offset];
+		mmu_map_open_bus(gb, MMU_ADDRESS_OAM_START, MMU_ADDRESS_NOT_USABLE_END);
+		return;
 	}
-	// Check for Work RAM (WRAM A and B) (0xC000 - 0xDFFF)
-	else if(address <= MMU_ADDRESS_WORK_RAM_END)
+
+	mmu_map_pages(gb, MMU_ADDRESS_OAM_START, MMU_ADDRESS_NOT_USABLE_END, gb->oam, NULL);
+}
+
+void mmu_map_video_memory(gb_t *gb)
+{
+	mmu_map_v_ram(gb);
+	mmu_map_oam(gb);
+}
+
+void mmu_map_memory(gb_t *gb)
+{
+	memset(gb->mmu_open_bus_page, 0xFF, sizeof(gb->mmu_open_bus_page));
+
+	// ROM and external RAM follow the cartridge's current banks.
+	cartridge_map(gb);
+
+	mmu_map_v_ram(gb);
+	mmu_map_pages(gb, MMU_ADDRESS_WORK_RAM_A_START, MMU_ADDRESS_WORK_RAM_A_END, gb->work_ram_a, gb->work_ram_a);
+	mmu_map_pages(gb, MMU_ADDRESS_ECHO_RAM_START, MMU_ADDRESS_ECHO_RAM_START + MMU_WORK_RAM_A_SIZE - 1, gb->work_ram_a, NULL);
+	mmu_map_work_ram_b(gb);
+
+	mmu_map_oam(gb);
+
+	// 0xFF00-0xFFFF mixes I/O, HRAM and IE.
+	mmu_map_pages(gb, MMU_ADDRESS_I_O_REGISTER_START, MMU_ADDRESS_INTERRUPT_ENABLE_REGISTER, NULL, NULL);
+
+	// A restored snapshot can be mid-transfer.
+	if (gb->ppu_state.dma_active)
 	{
-		// Check for WRAM Bank A (0xC000 - 0xCFFF)
-		if (address <= MMU_ADDRESS_WORK_RAM_A_END)
-		{
-			offset = address - MMU_ADDRESS_WORK_RAM_A_START;
-			return_value = work_ram_a[offset];
-		}
-		// Check for WRAM Bank B (0xD000 - 0xDFFF)
-		else
-		{
-			offset = address - MMU_ADDRESS_WORK_RAM_B_START;
-			return_value = work_ram_b[offset];
-		}
+		mmu_dma_lock_bus(gb);
+	}
+}
+
+// ----------------------------------------------------------------------
+// mmu_init
+// The memory arrays start zeroed with the instance; only the page
+// table needs setting up (with no cartridge inserted yet).
+// ----------------------------------------------------------------------
+void mmu_init(gb_t *gb)
+{
+	mmu_map_memory(gb);
+}
 
+// ----------------------------------------------------------------------
+// I/O Register Handlers (0xFF00 - 0xFF7F)
+// One read and one write entry per register, indexed by the offset from
+// 0xFF00. A NULL entry is a plain register: the access goes straight to
+// gb->i_o_register. Only registers with side effects or masked bits get
+// a function, so LDH traffic costs at most one indirect call.
+// ----------------------------------------------------------------------
+typedef uint8_t (*mmu_io_read_t)(gb_t *gb, uint8_t offset);
+typedef void (*mmu_io_write_t)(gb_t *gb, uint8_t offset, uint8_t value);
+
+#define IO_OFFSET(address)		((address) - MMU_ADDRESS_I_O_REGISTER_START)
+
+// LY (0xFF44) reads the PPU's own line counter.
+static uint8_t mmu_io_read_ly(gb_t *gb, uint8_t offset)
+{
+	(void)offset;
+	return gb->ppu_state.internal_ly_counter;
+}
+
+// IF (0xFF0F): bits 5-7 are not wired and read back as 1.
+static uint8_t mmu_io_read_interrupt_flags(gb_t *gb, uint8_t offset)
+{
+	(void)offset;
+	return gb->m_interrupt_flags | 0b11100000;
+}
+
+static void mmu_io_write_interrupt_flags(gb_t *gb, uint8_t offset, uint8_t value)
+{
+	(void)offset;
+	gb->m_interrupt_flags = value;
+	cpu_interrupts_changed(gb);
+}
+
+// LCDC (0xFF40)
+static void mmu_io_write_lcdc(gb_t *gb, uint8_t offset, uint8_t value)
+{
+	myBool lcd_enabled = (value & PPU_LCDC_LCD_PPU_ENABLE) ? myTrue : myFalse;
+
+	gb->i_o_register[offset] = value;
+
+	// With the LCD off the CPU can reach VRAM and OAM in any mode.
+	if (lcd_enabled != gb->ppu_state.lcd_enabled)
+	{
+		gb->ppu_state.lcd_enabled = lcd_enabled;
+		mmu_map_video_memory(gb);
 	}
-	// Check for Echo RAM (0xE000 - 0xFDFF)
-    // This is a mirror of WRAM (0xC000 - 0xDFFF).
-    // The offset must map the E000 address back to the C000 range.
-	else if(address <= MMU_ADDRESS_ECHO_RAM_END)
+}
+
+// STAT (0xFF41): the mode and LY=LYC bits belong to the PPU.
+static void mmu_io_write_stat(gb_t *gb, uint8_t offset, uint8_t value)
+{
+	gb->i_o_register[offset] = (gb->i_o_register[offset] & PPU_REGISTER_STAT_READ_ONLY_MASK)
+							   | (value & PPU_REGISTER_STAT_WRITABLE_MASK);
+}
+
+// LY (0xFF44) is driven by the PPU; CPU writes are ignored.
+static void mmu_io_write_read_only(gb_t *gb, uint8_t offset, uint8_t value)
+{
+	(void)gb;
+	(void)offset;
+	(void)value;
+}
+
+// DMA (0xFF46): the value is kept, so reading it returns the last source.
+static void mmu_io_write_dma(gb_t *gb, uint8_t offset, uint8_t value)
+{
+	gb->i_o_register[offset] = value;
+	mmu_dma_start(gb, value);
+}
+
+// BGP, OBP0, OBP1 (0xFF47 - 0xFF49) are kept decoded for the renderer.
+static void mmu_io_write_bgp(gb_t *gb, uint8_t offset, uint8_t value)
+{
+	ppu_decode_palette(value, gb->ppu_state.bg_palette);
+	gb->i_o_register[offset] = value;
+}
+
+static void mmu_io_write_obp0(gb_t *gb, uint8_t offset, uint8_t value)
+{
+	ppu_decode_palette(value, gb->ppu_state.obj_palette_0);
+	gb->i_o_register[offset] = value;
+}
+
+static void mmu_io_write_obp1(gb_t *gb, uint8_t offset, uint8_t value)
+{
+	ppu_decode_palette(value, gb->ppu_state.obj_palette_1);
+	gb->i_o_register[offset] = value;
+}
+
+// VBK (0xFF4F): bits 1-7 read back as 1.
+static uint8_t mmu_io_read_vbk(gb_t *gb, uint8_t offset)
+{
+	if (!gb->cartridge.cgb_mode)
+	{
+		return 0xFF;
+	}
+
+	return gb->i_o_register[offset] | (uint8_t)~MMU_VBK_BANK_MASK;
+}
+
+static void mmu_io_write_vbk(gb_t *gb, uint8_t offset, uint8_t value)
+{
+	if (!gb->cartridge.cgb_mode)
+	{
+		return;
+	}
+
+	gb->i_o_register[offset] = value & MMU_VBK_BANK_MASK;
+	mmu_map_v_ram(gb);
+}
+
+// SVBK (0xFF70): bits 3-7 read back as 1.
+static uint8_t mmu_io_read_svbk(gb_t *gb, uint8_t offset)
+{
+	if (!gb->cartridge.cgb_mode)
+	{
+		return 0xFF;
+	}
+
+	return gb->i_o_register[offset] | (uint8_t)~MMU_SVBK_BANK_MASK;
+}
+
+static void mmu_io_write_svbk(gb_t *gb, uint8_t offset, uint8_t value)
+{
+	const uint8_t *bank_before;
+
+	if (!gb->cartridge.cgb_mode)
+	{
+		return;
+	}
+
+	bank_before = mmu_work_ram_b_bank(gb);
+	gb->i_o_register[offset] = value & MMU_SVBK_BANK_MASK;
+
+	if (mmu_work_ram_b_bank(gb) == bank_before)
+	{
+		return;
+	}
+
+	mmu_map_work_ram_b(gb);
+
+	// Blocks decoded from the bank going out of view are not the code
+	// at those addresses any more.
+	for (uint32_t address = MMU_ADDRESS_WORK_RAM_B_START; address <= MMU_ADDRESS_WORK_RAM_B_END; address += 1 << CPU_BLOCK_GRANULE_SHIFT)
+	{
+		CPU_BLOCK_CACHE_NOTE_WRITE(gb, address);
+	}
+}
+
+static const mmu_io_read_t mmu_io_read_table[MMU_I_O_REGISTER_SIZE] =
+{
+	[IO_OFFSET(MMU_ADDRESS_INTERRUPT_FLAG_REGISTER)]	= mmu_io_read_interrupt_flags,
+	[IO_OFFSET(PPU_REGISTER_LY_ADDRESS)]				= mmu_io_read_ly,
+	[IO_OFFSET(MMU_ADDRESS_VBK_REGISTER)]				= mmu_io_read_vbk,
+	[IO_OFFSET(MMU_ADDRESS_SVBK_REGISTER)]				= mmu_io_read_svbk,
+};
+
+static const mmu_io_write_t mmu_io_write_table[MMU_I_O_REGISTER_SIZE] =
+{
+	[IO_OFFSET(MMU_ADDRESS_INTERRUPT_FLAG_REGISTER)]	= mmu_io_write_interrupt_flags,
+	[IO_OFFSET(PPU_REGISTER_LCDC_ADDRESS)]				= mmu_io_write_lcdc,
+	[IO_OFFSET(PPU_REGISTER_STAT_ADDRESS)]				= mmu_io_write_stat,
+	[IO_OFFSET(PPU_REGISTER_LY_ADDRESS)]				= mmu_io_write_read_only,
+	[IO_OFFSET(PPU_REGISTER_DMA_ADDRESS)]				= mmu_io_write_dma,
+	[IO_OFFSET(PPU_REGISTER_BGP_ADDRESS)]				= mmu_io_write_bgp,
+	[IO_OFFSET(PPU_REGISTER_OBP0_ADDRESS)]				= mmu_io_write_obp0,
+	[IO_OFFSET(PPU_REGISTER_OBP1_ADDRESS)]				= mmu_io_write_obp1,
+	[IO_OFFSET(MMU_ADDRESS_VBK_REGISTER)]				= mmu_io_write_vbk,
+	[IO_OFFSET(MMU_ADDRESS_SVBK_REGISTER)]				= mmu_io_write_svbk,
+};
+
+// ----------------------------------------------------------------------
+// mmu_read_handler
+// Reads from the pages without a read pointer: 0xFF00-0xFFFF, and the
+// cartridge windows while they have nothing mapped.
+// ----------------------------------------------------------------------
+static uint8_t mmu_read_handler(gb_t *gb, uint16_t address)
+{
+	// Initialize return_value to 0xFF, which is standard behavior for reads from
+    // unmapped or invalid memory addresses on the Game Boy.
+	uint8_t return_value = 0xFF;
+	uint16_t offset = 0x0000;
+
+	// I/O Registers (0xFF00 - 0xFF7F) come first: every LDH lands here.
+	if (address >= MMU_ADDRESS_I_O_REGISTER_START && address <= MMU_ADDRESS_I_O_REGISTER_END)
 	{
-		// The mirror offset is 0x2000 (0xE000 - 0xC000)
-        uint16_t wram_mirrored_address = address - 0x2000;
+		offset = address - MMU_ADDRESS_I_O_REGISTER_START;
+		MMU_STATS_IO_READ(gb, offset);
 
-        // We reuse the WRAM logic here to determine which WRAM bank to access (A or B)
-        if (wram_mirrored_address <= MMU_ADDRESS_WORK_RAM_A_END)
+		if (mmu_io_read_table[offset] != NULL)
 		{
-			offset = wram_mirrored_address - MMU_ADDRESS_WORK_RAM_A_START;
-			return_value = work_ram_a[offset];
+			return_value = mmu_io_read_table[offset](gb, (uint8_t)offset);
 		}
 		else
 		{
-			offset = wram_mirrored_address - MMU_ADDRESS_WORK_RAM_B_START;
-			return_value = work_ram_b[offset];
+			return_value = gb->i_o_register[offset];
 		}
 	}
+	// High RAM (HRAM) (0xFF80 - 0xFFFE)
+	else if (address >= MMU_ADDRESS_HIGH_RAM_START && address <= MMU_ADDRESS_HIGH_RAM_END)
+	{
+		offset = address - MMU_ADDRESS_HIGH_RAM_START;
+		return_value = gb->high_ram[offset];
+	}
+	// Interrupt Enable Register (0xFFFF)
+	else if (address == MMU_ADDRESS_INTERRUPT_ENABLE_REGISTER)
+	{
+		return_value = gb->interrupt_enable;
+	}
+	// Cartridge ROM without an image inserted reads as open bus.
+	else if (address <= MMU_ADDRESS_ROM_BANK_END)
+	{
+		return_value = 0xFF;
+	}
+	// External RAM disabled, absent or showing an MBC3 clock register.
+	else if (address >= MMU_ADDRESS_EXTERNAL_RAM_START && address <= MMU_ADDRESS_EXTERNAL_RAM_END)
+	{
+		return_value = cartridge_read_ram(gb, address);
+	}
+	// Every other page below OAM has a page pointer and never gets here.
+	else if (address < MMU_ADDRESS_OAM_START)
+	{
+		return_value = 0xFF;
+	}
 	// Check for OAM (0xFE00 - 0xFE9F)
 	else if(address <= MMU_ADDRESS_OAM_END)
 	{
 		offset = address - MMU_ADDRESS_OAM_START;
-		return_value = oam[offset];
+		return_value = gb->oam[offset];
 	}
 	// Check for Not Usable Memory (0xFEA0 - 0xFEFF)
-	else if(address <= MMU_ADDRESS_NOT_USABLE_END)
+	else
 	{
         // Reads from this area often return 0xFF. If 'not_usable' is initialized to 0xFF,
         // the default return value handles this.
 		offset = address - MMU_ADDRESS_NOT_USABLE_START;
-		return_value = not_usable[offset];
+		return_value = gb->not_usable[offset];
 	}
-	// Check for I/O Registers (0xFF00 - 0xFF7F)
-	else if(address <= MMU_ADDRESS_I_O_REGISTER_END)
-	{
-		if (address < PPU_REGISTER_LCDC_ADDRESS )
-		{
-			offset = address - MMU_ADDRESS_I_O_REGISTER_START;
-			return_value = i_o_register[offset];
-		}
-		else if(address <= PPU_REGISTER_WX_ADDRESS)
-		{
-			if(address == PPU_REGISTER_LY_ADDRESS)
-			{
-	            // LY is read-only by the CPU, its value is controlled by the PPU itself.
-	            // Return the current scanline value from the PPU's internal state.
-				return_value = ppu_state.internal_ly_counter;
-			}
-			else
-			{
-				// For other PPU registers (LCDC, STAT, SCX, SCY, etc.),
-				// simply return the value stored in your I/O register array.
-				return_value = i_o_register[address - 0xFF00];
-			}
-		}
-		else
-		{
-			offset = address - MMU_ADDRESS_I_O_REGISTER_START;
-			return_value = i_o_register[offset];
-		}
-
-	}
-	// Check for High RAM (HRAM) (0xFF80 - 0xFFFE)
-	else if(address <= MMU_ADDRESS_HIGH_RAM_END)
-	{
-		offset = address - MMU_ADDRESS_HIGH_RAM_START;
-		return_value = high_ram[offset];
-	}
-    // If the address is not recognized by any of the above, return_value remains 0xFF (initialized at the start).
 
 	return return_value;
 }
 
 // ----------------------------------------------------------------------
-// mmu_write_byte
-// Writes a single byte to the specified 16-bit memory address.
+// mmu_read_byte
+// Reads a single byte from the specified 16-bit memory address.
+// One page-table lookup for plain memory, the handler for the rest.
 // ----------------------------------------------------------------------
-void mmu_write_byte(uint16_t address, uint8_t value)
+uint8_t mmu_read_byte(gb_t *gb, uint16_t address)
 {
-	uint16_t offset = 0x0000;
+	const uint8_t *page = gb->mmu_read_page[address >> MMU_PAGE_SHIFT];
 
-	// Handle Interrupt Enable Register (0xFFFF)
-	if (address == MMU_ADDRESS_INTERRUPT_ENABLE_REGISTER)
-	{
-		interrupt_enable = value;
-	}
-
-    // Handle Interrupt Flag Register (0xFF0F)
-    else if (address == MMU_ADDRESS_INTERRUPT_FLAG_REGISTER)
-    {
-        // Writes to the Interrupt Flag register (0xFF0F)
-        // directly set the flags that can be triggered by the CPU.
-        // Bits 5-7 are always read as 1 and are not writable.
-        m_interrupt_flags = value;
-    }
-
-//	// ROM (0x0000 - 0x7FFF)
-//	// Writes to this region are typically ignored by the MMU (handled by MBCs if present).
-//	else if (address <= MMU_ADDRESS_ROM_BANK_END)
-//	{
-//		if (address <= MMU_ADDRESS_ROM_BANK_00_END)
-//		{
-//			offset = address - MMU_ADDRESS_ROM_BANK_00_START;
-//			// rom_bank_00[offset] = value; // Write ignored
-//		}
-//		else
-//		{
-//			offset = address - MMU_ADDRESS_ROM_BANK_01_NN_START;
-//			// rom_bank_01[offset] = value; // Write ignored
-//		}
-//	}
-	// Video RAM (VRAM) (0x8000 - 0x9FFF)
-	else if(address <= MMU_ADDRESS_V_RAM_END)
+	MMU_STATS_READ(gb, address);
+
+	if (page != NULL)
 	{
-		offset = address - MMU_ADDRESS_V_RAM_START;
-		v_ram[offset] = value;
+		return page[address & MMU_PAGE_OFFSET_MASK];
 	}
-	// External RAM (0xA000 - 0xBFFF)
-	else if(address <= MMU_ADDRESS_EXTERNAL_RAM_END)
+
+	// Only 0xFF00-0xFFFF is reachable while OAM DMA holds the bus.
+	if (address < MMU_ADDRESS_I_O_REGISTER_START && gb->ppu_state.dma_active)
 	{
-		offset = address - MMU_ADDRESS_EXTERNAL_RAM_START;
-		external_ram[offset] = value;
+		return 0xFF;
 	}
-	// Work RAM (WRAM A and B) (0xC000 - 0xDFFF)
-	else if(address <= MMU_ADDRESS_WORK_RAM_END)
+
+	return mmu_read_handler(gb, address);
+}
+
+// ----------------------------------------------------------------------
+// mmu_write_handler
+// Writes to the pages without a write pointer: MBC registers, VRAM tile
+// data, external RAM while unmapped, Echo RAM and 0xFE00-0xFFFF.
+// ----------------------------------------------------------------------
+static void mmu_write_handler(gb_t *gb, uint16_t address, uint8_t value)
+{
+	uint16_t offset = 0x0000;
+
+	// I/O Registers (0xFF00 - 0xFF7F) come first: every LDH lands here.
+	if (address >= MMU_ADDRESS_I_O_REGISTER_START && address <= MMU_ADDRESS_I_O_REGISTER_END)
 	{
-		// WRAM Bank A (0xC000 - 0xCFFF)
-		if (address <= MMU_ADDRESS_WORK_RAM_A_END)
+		offset = address - MMU_ADDRESS_I_O_REGISTER_START;
+		MMU_STATS_IO_WRITE(gb, offset);
+
+		if (mmu_io_write_table[offset] != NULL)
 		{
-			offset = address - MMU_ADDRESS_WORK_RAM_A_START;
-			work_ram_a[offset] = value;
+			mmu_io_write_table[offset](gb, (uint8_t)offset, value);
 		}
-		// WRAM Bank B (0xD000 - 0xDFFF)
 		else
 		{
-			offset = address - MMU_ADDRESS_WORK_RAM_B_START;
-			work_ram_b[offset] = value;
+			gb->i_o_register[offset] = value;
 		}
+	}
+	// High RAM (HRAM) (0xFF80 - 0xFFFE)
+	else if (address >= MMU_ADDRESS_HIGH_RAM_START && address <= MMU_ADDRESS_HIGH_RAM_END)
+	{
+		offset = address - MMU_ADDRESS_HIGH_RAM_START;
+		gb->high_ram[offset] = value;
 
+		// HRAM often holds the OAM DMA routine; retire it if rewritten.
+		CPU_BLOCK_CACHE_NOTE_WRITE(gb, address);
+	}
+	// Interrupt Enable Register (0xFFFF)
+	else if (address == MMU_ADDRESS_INTERRUPT_ENABLE_REGISTER)
+	{
+		gb->interrupt_enable = value;
+		cpu_interrupts_changed(gb);
+	}
+	// ROM (0x0000 - 0x7FFF)
+	// Writes to this region are MBC register writes.
+	else if (address <= MMU_ADDRESS_ROM_BANK_END)
+	{
+		cartridge_write_control(gb, address, value);
+	}
+	// VRAM bank 0 tile data (0x8000 - 0x97FF). Only reached while VRAM is
+	// unlocked and bank 0 is selected; the PPU decodes the tile again.
+	else if (address <= PPU_TILE_DATA_ADDRESS_END)
+	{
+		offset = address - MMU_ADDRESS_V_RAM_START;
+		gb->v_ram[offset] = value;
+		PPU_TILE_CACHE_NOTE_WRITE(gb, offset);
+	}
+	// External RAM (0xA000 - 0xBFFF) while disabled, absent or an MBC3 clock register.
+	else if (address >= MMU_ADDRESS_EXTERNAL_RAM_START && address <= MMU_ADDRESS_EXTERNAL_RAM_END)
+	{
+		cartridge_write_ram(gb, address, value);
 	}
 	// Echo RAM (0xE000 - 0xFDFF)
 	// Writes to Echo RAM are mirrored to WRAM (0xC000 - 0xDFFF)
-	else if(address <= MMU_ADDRESS_ECHO_RAM_END)
+	else if(address >= MMU_ADDRESS_ECHO_RAM_START && address <= MMU_ADDRESS_ECHO_RAM_END)
 	{
 		// Calculate the corresponding WRAM address by subtracting the mirror offset (0x2000)
 		uint16_t wram_mirrored_address = address - 0x2000;
 
-		// Route the write to the appropriate WRAM bank (A or B)
-		if (wram_mirrored_address <= MMU_ADDRESS_WORK_RAM_A_END)
-		{
-			offset = wram_mirrored_address - MMU_ADDRESS_WORK_RAM_A_START;
-			work_ram_a[offset] = value;
-		}
-		else
-		{
-			offset = wram_mirrored_address - MMU_ADDRESS_WORK_RAM_B_START;
-			work_ram_b[offset] = value;
-		}
+		// The WRAM page is always mapped (DMA never gets this far), and
+		// points at whichever bank SVBK has selected.
+		gb->mmu_write_page[wram_mirrored_address >> MMU_PAGE_SHIFT][wram_mirrored_address & MMU_PAGE_OFFSET_MASK] = value;
+
+		CPU_BLOCK_CACHE_NOTE_WRITE(gb, wram_mirrored_address);
 	}
 	// OAM (0xFE00 - 0xFE9F)
-	else if(address <= MMU_ADDRESS_OAM_END)
+	else if(address >= MMU_ADDRESS_OAM_START && address <= MMU_ADDRESS_OAM_END)
 	{
 		offset = address - MMU_ADDRESS_OAM_START;
-		oam[offset] = value;
-	}
-//	// Not Usable Memory (0xFEA0 - 0xFEFF)
-//	// Writes to this region are ignored.
-//	else if(address <= MMU_ADDRESS_NOT_USABLE_END)
-//	{
-//		offset = address - MMU_ADDRESS_NOT_USABLE_START;
-//		// not_usable[offset] = value; // Write ignored
-//	}
-	// I/O Registers (0xFF00 - 0xFF7F)
-	else if(address <= MMU_ADDRESS_I_O_REGISTER_END)
-	{
-		uint8_t offset = address - MMU_ADDRESS_I_O_REGISTER_START;
-
-		// Handle the special-case registers first.
-		// These either have unique write behavior or side effects that prevent
-		// the standard value assignment at the end of the block.
-		if (address == PPU_REGISTER_STAT_ADDRESS)
-		{
-			uint8_t preserved_bits = i_o_register[offset] & PPU_REGISTER_STAT_READ_ONLY_MASK;
-			uint8_t new_writable_bites = value & PPU_REGISTER_STAT_WRITABLE_MASK;
-			i_o_register[offset] = preserved_bits | new_writable_bites;
-			return; // Exit after special handling, as the final write is not needed
-		}
-		else if (address == PPU_REGISTER_LY_ADDRESS)
-		{
-			// LY is read-only by the CPU, so writes are ignored.
-			printf("READ-ONLY location! Unexpected write attempt to PPU_REGISTER_LY_ADDRESS");
-			return; // Exit as nothing should be written to memory
-		}
-		else if (address == PPU_REGISTER_DMA_ADDRESS)
-		{
-			// DMA write triggers a transfer, it doesn't just store a value.
-			// You would call a DMA function here.
-			// The value is often stored, but the key action is the transfer itself.
-			i_o_register[offset] = value;
-			pending_DMA = myTrue;
-			// CALL ppu_initiate_dma_transfer(value) // Placeholder for future DMA logic
-			return; // Exit after the DMA action
-		}
+		gb->oam[offset] = value;
+	}
+	// Not Usable Memory (0xFEA0 - 0xFEFF)
+	// Writes to this region are ignored.
+}
 
-		// Handle registers with a side effect (palette decoding).
-		// The value still needs to be written to memory, so we don't return here.
-		if (address == PPU_REGISTER_BGP_ADDRESS)
-		{
-			ppu_decode_palette(value, ppu_state.bg_palette);
-		}
-		else if (address == PPU_REGISTER_OBP0_ADDRESS)
-		{
-			ppu_decode_palette(value, ppu_state.obj_palette_0);
-		}
-		else if (address == PPU_REGISTER_OBP1_ADDRESS)
-		{
-			ppu_decode_palette(value, ppu_state.obj_palette_1);
-		}
+// ----------------------------------------------------------------------
+// mmu_write_byte
+// Writes a single byte to the specified 16-bit memory address.
+// One page-table lookup for plain memory, the handler for the rest.
+// ----------------------------------------------------------------------
+void mmu_write_byte(gb_t *gb, uint16_t address, uint8_t value)
+{
+	uint8_t *page = gb->mmu_write_page[address >> MMU_PAGE_SHIFT];
 
-		// For all other I/O registers in this block, simply store the value.
-		// This includes the palette registers and all other PPU registers (LCDC, SCX, SCY, etc.).
-		i_o_register[offset] = value;
+	MMU_STATS_WRITE(gb, address);
 
+	if (page != NULL)
+	{
+		page[address & MMU_PAGE_OFFSET_MASK] = value;
+
+		// Retire any cached code decoded from here (only WRAM granules are ever marked).
+		CPU_BLOCK_CACHE_NOTE_WRITE(gb, address);
+		return;
 	}
-	// High RAM (HRAM) (0xFF80 - 0xFFFE)
-	else if(address <= MMU_ADDRESS_HIGH_RAM_END)
+
+	if (address < MMU_ADDRESS_I_O_REGISTER_START && gb->ppu_state.dma_active)
 	{
-		offset = address - MMU_ADDRESS_HIGH_RAM_START;
-		high_ram[offset] = value;
+		return;
 	}
-    // Writes to other addresses (e.g., beyond 0xFFFF) are ignored implicitly.
+
+	mmu_write_handler(gb, address, value);
 }
 
-void mmu_load_rom(const char* filename)
+void mmu_load_rom(gb_t *gb, const char* filename)
 {
-    FILE *file_ptr;
-    // We open the file in binary read mode ("rb")
-    file_ptr = fopen(filename, "rb");
+	// The whole image is kept; the MBC maps its banks into the page table.
+	cartridge_load(gb, filename);
 
-    if (file_ptr == NULL)
-    {
-        printf("Error: Could not open ROM file: %s\n", filename);
-        // In a full implementation, you might exit or return an error code.
-        return;
-    }
+    // Blocks decoded from the previous ROM are no longer valid.
+    cpu_block_cache_flush(gb);
+}
 
-    // --- Loading ROM Bank 00 (0x0000 - 0x3FFF, first 16 KiB) ---
-    // fread(destination, size_of_element, number_of_elements, file_pointer)
-    // We read exactly MMU_ROM_BANK_00_SIZE bytes into rom_bank_00
-    size_t bytes_read_bank_00 = fread(rom_bank_00, 1, MMU_ROM_BANK_00_SIZE, file_ptr);
+// ----------------------------------------------------------------------
+// 16-bit Accesses
+// When both bytes sit in the same directly mapped page the word is moved
+// with one unaligned little-endian load or store. Across a page boundary,
+// or where a page has no pointer (I/O, MBC registers, DMA lock), it is
+// two byte accesses as before.
+// ----------------------------------------------------------------------
+static inline uint16_t mmu_load_le16(const uint8_t *source)
+{
+	uint16_t value;
 
-    if (bytes_read_bank_00 != MMU_ROM_BANK_00_SIZE)
-    {
-        printf("Warning: Did not read full ROM Bank 00. Read %zu bytes.\n", bytes_read_bank_00);
-        // For a basic ROM (no MBC), Bank 00 is crucial.
-    }
+	memcpy(&value, source, sizeof(value));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	value = (uint16_t)((value << 8) | (value >> 8));
+#endif
+	return value;
+}
 
-    // --- Loading ROM Bank 01 (0x4000 - 0x7FFF, next 16 KiB) ---
-    // We check if the ROM file is large enough to contain Bank 01 data
-    size_t bytes_read_bank_01 = 0;
+static inline void mmu_store_le16(uint8_t *target, uint16_t value)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	value = (uint16_t)((value << 8) | (value >> 8));
+#endif
+	memcpy(target, &value, sizeof(value));
+}
 
-    // Check if the file still has data after reading Bank 00
-    if (!feof(file_ptr))
-    {
-        // Read the next 16 KiB into rom_bank_01
-        bytes_read_bank_01 = fread(rom_bank_01, 1, MMU_ROM_BANK_01_SIZE, file_ptr);
-    }
+uint16_t mmu_read_word(gb_t *gb, uint16_t address)
+{
+	const uint8_t *page = gb->mmu_read_page[address >> MMU_PAGE_SHIFT];
 
-    if (bytes_read_bank_01 < MMU_ROM_BANK_01_SIZE)
-    {
-        // This is normal for simple 32 KiB ROMs (Bank 01 is often switchable, but we load it here)
-        // If the ROM is larger than 32 KiB, we'll need MBC handling later.
-        printf("Note: Did not read full ROM Bank 01. Read %zu bytes.\n", bytes_read_bank_01);
-    }
+	if (page != NULL && (address & MMU_PAGE_OFFSET_MASK) != MMU_PAGE_OFFSET_MASK)
+	{
+		MMU_STATS_READ(gb, address);
+		MMU_STATS_READ(gb, address + 1);
+		return mmu_load_le16(page + (address & MMU_PAGE_OFFSET_MASK));
+	}
 
-    // Close the file stream
-    fclose(file_ptr);
+	// Read the low byte, then the high byte from the next address (little-endian).
+	return (uint16_t)(mmu_read_byte(gb, address) | (mmu_read_byte(gb, address + 1) << 8));
 }
 
-uint16_t mmu_read_word(uint16_t address)
+void mmu_write_word(gb_t *gb, uint16_t address, uint16_t value)
 {
-	    // Read the low byte from the current address
-	    uint8_t low_byte = mmu_read_byte(address);
+	uint8_t *page = gb->mmu_write_page[address >> MMU_PAGE_SHIFT];
 
-	    // Read the high byte from the next address
-	    uint8_t high_byte = mmu_read_byte(address + 1);
+	if (page != NULL && (address & MMU_PAGE_OFFSET_MASK) != MMU_PAGE_OFFSET_MASK)
+	{
+		mmu_store_le16(page + (address & MMU_PAGE_OFFSET_MASK), value);
+		MMU_STATS_WRITE(gb, address);
+		MMU_STATS_WRITE(gb, address + 1);
+
+		// The two bytes can straddle two code granules.
+		CPU_BLOCK_CACHE_NOTE_WRITE(gb, address);
+		CPU_BLOCK_CACHE_NOTE_WRITE(gb, address + 1);
+		return;
+	}
 
-	    // Combine them into a 16-bit word (little-endian)
-	    return (high_byte << 8) | low_byte;
+	// Write the low byte, then the high byte to the next address.
+	mmu_write_byte(gb, address, (uint8_t)(value & 0x00FF));
+	mmu_write_byte(gb, address + 1, (uint8_t)(value >> 8));
 }
 
-void mmu_write_word(uint16_t address, uint16_t value)
+// ----------------------------------------------------------------------
+// OAM DMA
+// ----------------------------------------------------------------------
+
+// Copies source bytes into OAM until bytes_due are there. The source is
+// read through the real page table, as the CPU would see it with no
+// transfer running.
+static void mmu_dma_copy(gb_t *gb, uint8_t bytes_due)
 {
-	    // Read the low byte from the current address
-		mmu_write_byte(address++, (uint8_t) (value & 0x00FF));
+	uint16_t source = (uint16_t)(gb->ppu_state.dma_source_page << MMU_PAGE_SHIFT);
+	const uint8_t *page = gb->mmu_dma_read_page[gb->ppu_state.dma_source_page];
 
-	    // Read the high byte from the next address
-		mmu_write_byte(address, (uint8_t) (value >> 8));
+	if (bytes_due <= gb->ppu_state.dma_bytes_copied)
+	{
+		return;
+	}
 
+	for (uint8_t index = gb->ppu_state.dma_bytes_copied; index < bytes_due; index++)
+	{
+		gb->oam[index] = (page != NULL) ? page[index] : mmu_read_handler(gb, source + index);
+	}
+
+	gb->ppu_state.dma_bytes_copied = bytes_due;
 }
 
+void mmu_dma_start(gb_t *gb, uint8_t source_page)
+{
+	// Sources above 0xDFFF see WRAM again, as Echo RAM does.
+	if (source_page >= (MMU_ADDRESS_ECHO_RAM_START >> MMU_PAGE_SHIFT))
+	{
+		source_page -= (MMU_ADDRESS_ECHO_RAM_START - MMU_ADDRESS_WORK_RAM_A_START) >> MMU_PAGE_SHIFT;
+	}
+
+	// A write during a transfer restarts it; the bus is already locked.
+	if (!gb->ppu_state.dma_active)
+	{
+		memcpy(gb->mmu_dma_read_page, gb->mmu_read_page, sizeof(gb->mmu_dma_read_page));
+		memcpy(gb->mmu_dma_write_page, gb->mmu_write_page, sizeof(gb->mmu_dma_write_page));
+		gb->ppu_state.dma_active = myTrue;
+		mmu_dma_lock_bus(gb);
+	}
+
+	gb->ppu_state.dma_source_page = source_page;
+	gb->ppu_state.dma_cycles_left = MMU_DMA_CYCLES;
+	gb->ppu_state.dma_bytes_copied = 0;
+
+#if !MMU_DMA_ACCURATE
+	// Nothing but the CPU could see OAM fill up, and the CPU is locked
+	// out, so the whole block goes now (one memcpy for a plain page).
+	if (gb->mmu_dma_read_page[source_page] != NULL)
+	{
+		memcpy(gb->oam, gb->mmu_dma_read_page[source_page], MMU_DMA_LENGTH);
+		gb->ppu_state.dma_bytes_copied = MMU_DMA_LENGTH;
+	}
+	else
+	{
+		mmu_dma_copy(gb, MMU_DMA_LENGTH);
+	}
+#endif
+}
+
+void mmu_dma_step(gb_t *gb, uint32_t cycles)
+{
+	if (cycles < gb->ppu_state.dma_cycles_left)
+	{
+		gb->ppu_state.dma_cycles_left -= (uint16_t)cycles;
+		mmu_dma_copy(gb, (uint8_t)((MMU_DMA_CYCLES - gb->ppu_state.dma_cycles_left) / 4));
+		return;
+	}
+
+	mmu_dma_copy(gb, MMU_DMA_LENGTH);
+
+	// Hand the bus back.
+	gb->ppu_state.dma_cycles_left = 0;
+	gb->ppu_state.dma_active = myFalse;
+	memcpy(gb->mmu_read_page, gb->mmu_dma_read_page, sizeof(gb->mmu_read_page));
+	memcpy(gb->mmu_write_page, gb->mmu_dma_write_page, sizeof(gb->mmu_write_page));
+}
+
+#if MMU_INSTRUMENTATION
+// ----------------------------------------------------------------------
+// Access Instrumentation
+// ----------------------------------------------------------------------
+void mmu_stats_reset(gb_t *gb)
+{
+	memset(&gb->mmu_stats, 0, sizeof(gb->mmu_stats));
+}
+
+myBool mmu_stats_export(gb_t *gb, const char *filename)
+{
+	FILE *file = fopen(filename, "w");
+	uint32_t index;
+
+	if (file == NULL)
+	{
+		printf("Error: Could not open heatmap file %s for writing.\n", filename);
+		return myFalse;
+	}
+
+	for (index = 0; index < MMU_PAGE_COUNT; index++)
+	{
+		fprintf(file, "%04X %04X %llu %llu %llu\n",
+				(unsigned)(index << MMU_PAGE_SHIFT),
+				(unsigned)((index << MMU_PAGE_SHIFT) | MMU_PAGE_OFFSET_MASK),
+				(unsigned long long)gb->mmu_stats.page_reads[index],
+				(unsigned long long)gb->mmu_stats.page_writes[index],
+				(unsigned long long)gb->mmu_stats.page_executes[index]);
+	}
+
+	for (index = 0; index < MMU_I_O_REGISTER_SIZE; index++)
+	{
+		fprintf(file, "%04X %llu %llu\n",
+				(unsigned)(MMU_ADDRESS_I_O_REGISTER_START + index),
+				(unsigned long long)gb->mmu_stats.io_reads[index],
+				(unsigned long long)gb->mmu_stats.io_writes[index]);
+	}
+
+	if (fclose(file) != 0)
+	{
+		printf("Error: Could not write heatmap file %s.\n", filename);
+		return myFalse;
+	}
+
+	return myTrue;
+}
+#endif
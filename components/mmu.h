@@ -2,7 +2,7 @@
  * mmu.h
  *
  * Defines the constants for the Game Boy memory map and declares
- * the external memory arrays and MMU access function prototypes.
+ * the MMU access function prototypes. The memory arrays live in gb_t.
  *
  * Created on: 12 Jul 2025
  * Author: hawke
@@ -14,8 +14,14 @@
 #define COMPONENTS_MMU_H_
 
 #include <stdint.h>
+#include "..\headers\mystdbool.h"
 #include "..\BitOps\bit_macros.h"
 
+#ifndef GB_T_DECLARED
+#define GB_T_DECLARED
+typedef struct gb_s gb_t;
+#endif
+
 // ----------------------------------------------------------------------
 // MMU Address and Size Constants
 // ----------------------------------------------------------------------
@@ -37,6 +43,7 @@
 #define MMU_ADDRESS_V_RAM_START 			(0x8000)
 #define MMU_ADDRESS_V_RAM_END 				(0x9FFF)
 #define MMU_V_RAM_SIZE						(MMU_ADDRESS_V_RAM_END - MMU_ADDRESS_V_RAM_START + 1)
+#define MMU_V_RAM_BANK_COUNT				(2)
 
 // External RAM (8 KiB, switchable via cartridge mapper)
 #define MMU_ADDRESS_EXTERNAL_RAM_START 		(0xA000)
@@ -52,6 +59,7 @@
 #define MMU_ADDRESS_WORK_RAM_B_START		(0xD000)
 #define MMU_ADDRESS_WORK_RAM_B_END 			(0xDFFF)
 #define MMU_WORK_RAM_B_SIZE					(MMU_ADDRESS_WORK_RAM_B_END - MMU_ADDRESS_WORK_RAM_B_START + 1)
+#define MMU_WORK_RAM_B_BANK_COUNT			(7)		// Banks 1-7; DMG only has bank 1
 
 // Combined WRAM region end address
 #define MMU_ADDRESS_WORK_RAM_END			(0xDFFF)
@@ -80,6 +88,12 @@
 #define MMU_ADDRESS_HIGH_RAM_END 			(0xFFFE)
 #define MMU_HIGH_RAM_SIZE					(MMU_ADDRESS_HIGH_RAM_END - MMU_ADDRESS_HIGH_RAM_START + 1)
 
+// Page table: one read and one write pointer per 256-byte page.
+#define MMU_PAGE_SHIFT						(8)
+#define MMU_PAGE_COUNT						(0x10000 >> MMU_PAGE_SHIFT)
+#define MMU_PAGE_OFFSET_MASK				((1 << MMU_PAGE_SHIFT) - 1)
+#define MMU_PAGE_SIZE						(1 << MMU_PAGE_SHIFT)
+
 //Interrupt Flag
 #define MMU_ADDRESS_INTERRUPT_FLAG_REGISTER			(0XFF0F)
 #define MMU_INTERRUPT_FLAG_JOYPAD			BIT(4)
@@ -87,6 +101,7 @@
 #define MMU_INTERRUPT_FLAG_TIMER			BIT(2)
 #define MMU_INTERRUPT_FLAG_LCD				BIT(1)
 #define MMU_INTERRUPT_FLAG_VBLANK			BIT(0)
+#define MMU_INTERRUPT_FLAG_ALL				(0x1F)	// The five sources; bits 5-7 always read back as 1
 
 // Interrupt Enable Register (IE) (0xFFFF)
 #define MMU_ADDRESS_INTERRUPT_ENABLE_REGISTER		(0xFFFF)
@@ -96,6 +111,14 @@
 #define MMU_INTERRUPT_ENABLE_LCD			BIT(1)
 #define MMU_INTERRUPT_ENABLE_VBLANK			BIT(0)
 
+// CGB Bank Registers
+// Only seen by colour cartridges (cartridge.cgb_mode); on DMG they read
+// 0xFF and ignore writes. Switching a bank only repoints pages.
+#define MMU_ADDRESS_VBK_REGISTER			(0xFF4F)	// Bit 0: VRAM bank at 0x8000
+#define MMU_ADDRESS_SVBK_REGISTER			(0xFF70)	// Bits 0-2: WRAM bank at 0xD000 (0 selects 1)
+#define MMU_VBK_BANK_MASK					(0x01)
+#define MMU_SVBK_BANK_MASK					(0x07)
+
 // PPU Registers
 #define PPU_REGISTER_LCDC_ADDRESS			(0xFF40) // R/W
 #define PPU_REGISTER_STAT_ADDRESS			(0xFF41) // R/W
@@ -110,6 +133,11 @@
 #define PPU_REGISTER_WY_ADDRESS				(0xFF4A) // R/W
 #define PPU_REGISTER_WX_ADDRESS				(0xFF4B) // R/W
 
+// Storage of an I/O register, for the component that drives it (the PPU
+// updating STAT, for instance). CPU accesses go through mmu_read_byte /
+// mmu_write_byte and the per-register handlers in mmu.c instead.
+#define MMU_IO_REGISTER(gb, address)		((gb)->i_o_register[(address) - MMU_ADDRESS_I_O_REGISTER_START])
+
 // PPU Register Masks
 //#define PPU_REGISTER_LCDC_ADDRESS			(0xFF40) // R/W
 #define PPU_REGISTER_STAT_READ_ONLY_MASK	(0x87) 	// read only
@@ -127,33 +155,106 @@
 
 
 // ----------------------------------------------------------------------
-// External Memory Array Declarations
-// These arrays are defined in mmu.c and declared here as extern
-// so other components can access them (e.g., the CPU or PPU).
+// OAM DMA
+// Writing 0xFF46 copies 160 bytes from (value << 8) to OAM. For the 160
+// M-cycles that takes, the CPU can only reach 0xFF00-0xFFFF; everything
+// else reads 0xFF and ignores writes.
 // ----------------------------------------------------------------------
-extern uint8_t rom_bank_00[MMU_ROM_BANK_00_SIZE];
-extern uint8_t rom_bank_01[MMU_ROM_BANK_01_SIZE];
-extern uint8_t v_ram[MMU_V_RAM_SIZE];
-extern uint8_t external_ram[MMU_EXTERNAL_RAM_SIZE];
-extern uint8_t work_ram_a[MMU_WORK_RAM_A_SIZE];
-extern uint8_t work_ram_b[MMU_WORK_RAM_B_SIZE];
-extern uint8_t oam[MMU_OAM_SIZE];
-extern uint8_t not_usable[MMU_NOT_USABLE_SIZE];
-extern uint8_t i_o_register[MMU_I_O_REGISTER_SIZE];
-extern uint8_t high_ram[MMU_HIGH_RAM_SIZE];
-extern uint8_t interrupt_enable;
+#define MMU_DMA_LENGTH						(MMU_OAM_SIZE)
+#define MMU_DMA_CYCLES						(MMU_DMA_LENGTH * 4)	// One byte per M-cycle
+
+// With MMU_DMA_ACCURATE 0 the whole block is copied the moment 0xFF46 is
+// written and the transfer then only holds the bus. With 1 it copies one
+// byte per M-cycle like the hardware, for code that looks at OAM (or
+// rewrites the source) while a transfer is still running.
+#ifndef MMU_DMA_ACCURATE
+#define MMU_DMA_ACCURATE					(0)
+#endif
+
+// ----------------------------------------------------------------------
+// Access Instrumentation
+// Built with MMU_INSTRUMENTATION 1, the MMU counts reads and writes per
+// 256-byte page and per I/O register, and cpu_step counts the
+// instructions executed (against the page a block starts in), so the hot
+// parts of the address space can be exported as a heatmap
+// (mmu_stats_export). Reads include the decoder fetching code, once per
+// decode rather than per execution. Translated blocks are not chained in
+// such builds, so every block run passes through cpu_step and is counted.
+// With 0 (the default) the counters, the hooks and the functions below
+// do not exist.
+// ----------------------------------------------------------------------
+#ifndef MMU_INSTRUMENTATION
+#define MMU_INSTRUMENTATION					(0)
+#endif
+
+#if MMU_INSTRUMENTATION
+typedef struct
+{
+	uint64_t page_reads[MMU_PAGE_COUNT];
+	uint64_t page_writes[MMU_PAGE_COUNT];
+	uint64_t page_executes[MMU_PAGE_COUNT];
+	uint64_t io_reads[MMU_I_O_REGISTER_SIZE];
+	uint64_t io_writes[MMU_I_O_REGISTER_SIZE];
+} mmu_stats_t;
+
+#define MMU_STATS_READ(gb, address)				((gb)->mmu_stats.page_reads[(uint16_t)(address) >> MMU_PAGE_SHIFT]++)
+#define MMU_STATS_WRITE(gb, address)			((gb)->mmu_stats.page_writes[(uint16_t)(address) >> MMU_PAGE_SHIFT]++)
+#define MMU_STATS_EXECUTE(gb, address, count)	((gb)->mmu_stats.page_executes[(uint16_t)(address) >> MMU_PAGE_SHIFT] += (count))
+#define MMU_STATS_IO_READ(gb, offset)			((gb)->mmu_stats.io_reads[(offset)]++)
+#define MMU_STATS_IO_WRITE(gb, offset)			((gb)->mmu_stats.io_writes[(offset)]++)
+#else
+#define MMU_STATS_READ(gb, address)				((void)0)
+#define MMU_STATS_WRITE(gb, address)			((void)0)
+#define MMU_STATS_EXECUTE(gb, address, count)	((void)0)
+#define MMU_STATS_IO_READ(gb, offset)			((void)0)
+#define MMU_STATS_IO_WRITE(gb, offset)			((void)0)
+#endif
 
 // ----------------------------------------------------------------------
 // MMU Access Function Prototypes
 // ----------------------------------------------------------------------
-uint8_t mmu_read_byte(uint16_t address);
-void mmu_write_byte(uint16_t address, uint8_t value);
+// Puts the memory map of a freshly allocated instance into its power-on state.
+void mmu_init(gb_t *gb);
+
+// Rebuilds the page table from the memory arrays and the cartridge.
+void mmu_map_memory(gb_t *gb);
+
+// Points pages [start, end] at consecutive 256-byte slices of read_base
+// and write_base (either may be NULL to leave those pages to the handlers).
+void mmu_map_pages(gb_t *gb, uint16_t start, uint16_t end, const uint8_t *read_base, uint8_t *write_base);
+
+uint8_t mmu_read_byte(gb_t *gb, uint16_t address);
+void mmu_write_byte(gb_t *gb, uint16_t address, uint8_t value);
 
 // Function to load the ROM file into memory
-void mmu_load_rom(const char* filename);
+void mmu_load_rom(gb_t *gb, const char* filename);
+
+// Little-endian 16-bit accesses: one load or store when both bytes are in
+// the same mapped page, two byte accesses otherwise.
+uint16_t mmu_read_word(gb_t *gb, uint16_t address);
+void mmu_write_word(gb_t *gb, uint16_t address, uint16_t value);
+
+// Locks or unlocks VRAM and OAM for the PPU's current mode. Called by
+// the PPU on every mode change and whenever the LCD is switched on or off.
+void mmu_map_video_memory(gb_t *gb);
+
+// Starts (or restarts) an OAM DMA transfer from source_page << 8.
+void mmu_dma_start(gb_t *gb, uint8_t source_page);
+
+// Advances a running transfer by cycles T-cycles (called from ppu_step).
+void mmu_dma_step(gb_t *gb, uint32_t cycles);
+
+#if MMU_INSTRUMENTATION
+// Zeroes the access counters.
+void mmu_stats_reset(gb_t *gb);
 
-uint16_t mmu_read_word(uint16_t address);
-void mmu_write_word(uint16_t address, uint16_t value);
+// Writes the counters to filename as text: one line per 256-byte page
+// covering 0x0000-0xFFFF ("start end reads writes executes", addresses
+// in hex), then one per I/O register ("address reads writes"). Call it
+// after gb_run_frame for a per-frame map (resetting in between) or once
+// at the end of a run. Returns myFalse if the file cannot be written.
+myBool mmu_stats_export(gb_t *gb, const char *filename);
+#endif
 
 
 
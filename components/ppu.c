@@ -7,19 +7,27 @@
 
 #include <string.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "ppu.h"
 #include "mmu.h"
+#include "cpu.h"
+#include "gb.h"
 #include "..\headers\mystdbool.h"
 #include "..\BitOps\bit_macros.h"
 
 
-ppu_state_t ppu_state;
-
 //void ppu_decode_palette(uint8_t palette_data_register_value, uint32_t *target_palette_array);
-void ppu_render_scanline(void);
-void render_background_layer_for(uint8_t current_scanline_y);
-void render_window_layer_for(uint8_t current_scanline_y);
-void render_sprite_layer_for(uint8_t current_scanline_y);
+
+// The PPU reads VRAM (bank 0) straight from the arena: the CPU's view of
+// it through the page table is locked while the PPU is drawing.
+#define PPU_V_RAM(gb, address)		((gb)->v_ram[(uint16_t)(address) - MMU_ADDRESS_V_RAM_START])
+
+void ppu_render_scanline(gb_t *gb);
 
 // Note: Colours are defined in 0xRRGGBBAA format (Red, Green, Blue, Alpha).
 // You can adjust the alpha (A) value if your rendering library requires it.
@@ -62,125 +70,182 @@ const uint32_t MODERN_PURPLE_PALETTE[4] = {
 };
 
 
-void ppu_init(void)
+void ppu_init(gb_t *gb)
 {
-	ppu_state.current_mode = PPU_MODE_OAM_SCAN;
-	ppu_state.cycles_on_scanline = 0x00;
-	ppu_state.internal_ly_counter = 0x00;
-	ppu_state.lcd_enabled = myFalse;
+	gb->ppu_state.current_mode = PPU_MODE_OAM_SCAN;
+	gb->ppu_state.cycles_on_scanline = 0x00;
+	gb->ppu_state.internal_ly_counter = 0x00;
+	gb->ppu_state.lcd_enabled = myFalse;
+	gb->ppu_state.frame_ready = myFalse;
 
-	memset(ppu_state.bg_palette, 0x00 , 4 * 4);
-	memset(ppu_state.obj_palette_0, 0 , 4 * 4);
-	memset(ppu_state.obj_palette_1, 0 , 4 * 4);
+	memset(gb->ppu_state.bg_palette, 0x00 , 4 * 4);
+	memset(gb->ppu_state.obj_palette_0, 0 , 4 * 4);
+	memset(gb->ppu_state.obj_palette_1, 0 , 4 * 4);
 
-	ppu_state.dma_active = myFalse;
-	ppu_state.dma_cycles_left = 0x00;
+	gb->ppu_state.dma_active = myFalse;
+	gb->ppu_state.dma_cycles_left = 0x00;
+	gb->ppu_state.dma_bytes_copied = 0x00;
 
-	memset(ppu_state.screen_buffer, 0x00, GB_SCREEN_WIDTH * GB_SCREEN_HEIGHT * 4); // array is 160*144*uint32_t so 160*144*4bytes
-	memset(ppu_state.scanline_pixels, 0x00, GB_SCREEN_WIDTH * 4);
+	memset(gb->ppu_state.screen_buffer, 0x00, GB_SCREEN_WIDTH * GB_SCREEN_HEIGHT * 4); // array is 160*144*uint32_t so 160*144*4bytes
+	memset(gb->ppu_state.scanline_pixels, 0x00, GB_SCREEN_WIDTH * 4);
+	ppu_tile_cache_flush(gb);
 
 
 
-	mmu_write_byte(PPU_REGISTER_LCDC_ADDRESS, PPU_DEFAULT_LCDC_VALUE);
-	mmu_write_byte(PPU_REGISTER_STAT_ADDRESS, PPU_DEFAULT_STAT_VALUE);
-	mmu_write_byte(PPU_REGISTER_SCY_ADDRESS,PPU_DEFAULT_SCY_VALUE);
-	mmu_write_byte(PPU_REGISTER_SCX_ADDRESS,PPU_DEFAULT_SCX_VALUE);
-	mmu_write_byte(PPU_REGISTER_LY_ADDRESS,PPU_DEFAULT_LY_VALUE);
-	mmu_write_byte(PPU_REGISTER_LYC_ADDRESS,PPU_DEFAULT_LYC_VALUE);
+	mmu_write_byte(gb, PPU_REGISTER_LCDC_ADDRESS, PPU_DEFAULT_LCDC_VALUE);
+	MMU_IO_REGISTER(gb, PPU_REGISTER_STAT_ADDRESS) = PPU_DEFAULT_STAT_VALUE;	// The CPU cannot write the mode bits
+	mmu_write_byte(gb, PPU_REGISTER_SCY_ADDRESS,PPU_DEFAULT_SCY_VALUE);
+	mmu_write_byte(gb, PPU_REGISTER_SCX_ADDRESS,PPU_DEFAULT_SCX_VALUE);
+	// LY reads come from internal_ly_counter.
+	mmu_write_byte(gb, PPU_REGISTER_LYC_ADDRESS,PPU_DEFAULT_LYC_VALUE);
 //	mmu_write_byte(PPU_REGISTER_DMA_ADDRESS,); // The DMA register (0xFF46) is special; writing to it causes an action, so we don't 'initialize' it this way.
-	mmu_write_byte(PPU_REGISTER_BGP_ADDRESS,PPU_DEFAULT_BGP_VALUE);
-	mmu_write_byte(PPU_REGISTER_OBP0_ADDRESS,PPU_DEFAULT_OBP0_VALUE);
-	mmu_write_byte(PPU_REGISTER_OBP1_ADDRESS,PPU_DEFAULT_OBP1_VALUE);
-	mmu_write_byte(PPU_REGISTER_WY_ADDRESS,PPU_DEFAULT_WY_VALUE);
-	mmu_write_byte(PPU_REGISTER_WX_ADDRESS,PPU_DEFAULT_WX_VALUE);
+	mmu_write_byte(gb, PPU_REGISTER_BGP_ADDRESS,PPU_DEFAULT_BGP_VALUE);
+	mmu_write_byte(gb, PPU_REGISTER_OBP0_ADDRESS,PPU_DEFAULT_OBP0_VALUE);
+	mmu_write_byte(gb, PPU_REGISTER_OBP1_ADDRESS,PPU_DEFAULT_OBP1_VALUE);
+	mmu_write_byte(gb, PPU_REGISTER_WY_ADDRESS,PPU_DEFAULT_WY_VALUE);
+	mmu_write_byte(gb, PPU_REGISTER_WX_ADDRESS,PPU_DEFAULT_WX_VALUE);
+
+	ppu_decode_palette(mmu_read_byte(gb, PPU_REGISTER_BGP_ADDRESS), gb->ppu_state.bg_palette);
+	ppu_decode_palette(mmu_read_byte(gb, PPU_REGISTER_OBP0_ADDRESS), gb->ppu_state.obj_palette_0);
+	ppu_decode_palette(mmu_read_byte(gb, PPU_REGISTER_OBP1_ADDRESS), gb->ppu_state.obj_palette_1);
+
+}
+
+// Raises an interrupt by setting its bit in IF (0xFF0F).
+static void ppu_request_interrupt(gb_t *gb, uint8_t interrupt_flag)
+{
+	gb->m_interrupt_flags |= interrupt_flag;
+	cpu_interrupts_changed(gb);
+}
+
+// Switches mode and raises the STAT interrupt if that mode's source is enabled.
+static void ppu_enter_mode(gb_t *gb, ppu_mode_t new_mode)
+{
+	uint8_t stat = MMU_IO_REGISTER(gb, PPU_REGISTER_STAT_ADDRESS);
+
+	gb->ppu_state.current_mode = new_mode;
 
-	ppu_decode_palette(mmu_read_byte(PPU_REGISTER_BGP_ADDRESS), ppu_state.bg_palette);
-	ppu_decode_palette(mmu_read_byte(PPU_REGISTER_OBP0_ADDRESS), ppu_state.obj_palette_0);
-	ppu_decode_palette(mmu_read_byte(PPU_REGISTER_OBP1_ADDRESS), ppu_state.obj_palette_1);
+	// VRAM and OAM lock and unlock with the mode.
+	mmu_map_video_memory(gb);
 
+	if ((new_mode == PPU_MODE_HBLANK && (stat & PPU_STAT_MODE_0_HBLANK_INTERRUPT_ENABLE))
+		|| (new_mode == PPU_MODE_VBLANK && (stat & PPU_STAT_MODE_1_VBLANK_INTERRUPT_ENABLE))
+		|| (new_mode == PPU_MODE_OAM_SCAN && (stat & PPU_STAT_MODE_2_OAM_INTERRUPT_ENABLE)))
+	{
+		ppu_request_interrupt(gb, MMU_INTERRUPT_FLAG_LCD);
+	}
 }
 
-void ppu_step(uint32_t cpu_cycles_executed_this_turn)
+// Raises the STAT interrupt when LY has just become LYC (and that source is enabled).
+static void ppu_check_lyc_interrupt(gb_t *gb)
 {
+	uint8_t stat = MMU_IO_REGISTER(gb, PPU_REGISTER_STAT_ADDRESS);
 
-	if (ppu_state.lcd_enabled == myTrue)
+	if ((stat & PPU_STAT_LYC_LC_INTERRUPT_ENABLE)
+		&& gb->ppu_state.internal_ly_counter == MMU_IO_REGISTER(gb, PPU_REGISTER_LYC_ADDRESS))
+	{
+		ppu_request_interrupt(gb, MMU_INTERRUPT_FLAG_LCD);
+	}
+}
+
+void ppu_step(gb_t *gb, uint32_t cpu_cycles_executed_this_turn)
+{
+	if (gb->ppu_state.dma_active)
+	{
+		mmu_dma_step(gb, cpu_cycles_executed_this_turn);
+	}
+
+	if (gb->ppu_state.lcd_enabled == myTrue)
 	{
 
 		// 1. Advance the PPU's Internal Clock:
-		ppu_state.cycles_on_scanline += cpu_cycles_executed_this_turn;
+		gb->ppu_state.cycles_on_scanline += cpu_cycles_executed_this_turn;
 
 		// 2. Manage PPU Mode Transitions:
 		//    (The PPU cycles through modes based on how many cycles have passed on the current line.)
+		//    A bulk step (e.g. a halted CPU fast-forwarding) can cross several
+		//    transitions, so keep going until the current mode has time left.
+		myBool mode_changed;
 
-		if(ppu_state.current_mode == PPU_MODE_OAM_SCAN)//IF PPU's current_mode IS OAM_SCAN_MODE (Mode 2):
-		{
-			if(ppu_state.cycles_on_scanline >= 80)//IF PPU's internal_scanline_cycle_counter HAS REACHED APPROXIMATELY 80 CYCLES THEN
-			{
-				ppu_state.current_mode = PPU_MODE_DRAWING;//CHANGE PPU's current_mode TO DRAWING_MODE (Mode 3)
-				// TODO (Future): Check if Mode 2 interrupts are enabled in STAT, and if so, trigger one.
-			}
-		}
-		else if(ppu_state.current_mode == PPU_MODE_DRAWING)//ELSE IF PPU's current_mode IS DRAWING_MODE (Mode 3):
+		do
 		{
-			if(ppu_state.cycles_on_scanline >= 252)//IF PPU's internal_scanline_cycle_counter HAS REACHED APPROXIMATELY (80 + 172) CYCLES THEN // Total cycles for Mode 2 + Mode 3
+			mode_changed = myFalse;
+
+			if(gb->ppu_state.current_mode == PPU_MODE_OAM_SCAN)//IF PPU's current_mode IS OAM_SCAN_MODE (Mode 2):
 			{
-				ppu_state.current_mode = PPU_MODE_HBLANK; //CHANGE PPU's current_mode TO H_BLANK_MODE (Mode 0)
-				// TODO (Future): Here's where the actual pixel drawing for the CURRENT_SCANLINE would happen.
-				ppu_render_scanline();
-				//                 It would fill a row in ppu_state.screen_buffer.
-				// TODO (Future): Check if Mode 3 interrupts are enabled in STAT, and if so, trigger one.
+				if(gb->ppu_state.cycles_on_scanline >= PPU_OAM_SCAN_END_CYCLES)//IF PPU's internal_scanline_cycle_counter HAS REACHED APPROXIMATELY 80 CYCLES THEN
+				{
+					ppu_enter_mode(gb, PPU_MODE_DRAWING);//CHANGE PPU's current_mode TO DRAWING_MODE (Mode 3)
+					mode_changed = myTrue;
+				}
 			}
-		}
-		else if(ppu_state.current_mode == PPU_MODE_HBLANK)// ELSE IF PPU's current_mode IS H_BLANK_MODE (Mode 0)
-		{
-			if (ppu_state.cycles_on_scanline >= 456) //IF PPU's internal_scanline_cycle_counter HAS REACHED APPROXIMATELY 456 CYCLES THEN // Total cycles for a full visible scanline
+			else if(gb->ppu_state.current_mode == PPU_MODE_DRAWING)//ELSE IF PPU's current_mode IS DRAWING_MODE (Mode 3):
 			{
-				ppu_state.internal_ly_counter += 1; //INCREMENT THE PPU's internal_LY_counter (scanline counter)
-				mmu_write_byte(PPU_REGISTER_LY_ADDRESS, ppu_state.internal_ly_counter);
-				ppu_state.cycles_on_scanline = 0; //RESET PPU's internal_scanline_cycle_counter TO ZERO
-
-				if (ppu_state.internal_ly_counter < 144)	//IF internal_LY_counter IS LESS THAN 144 THEN // Still rendering visible lines (0-143)
+				if(gb->ppu_state.cycles_on_scanline >= PPU_DRAWING_END_CYCLES)//IF PPU's internal_scanline_cycle_counter HAS REACHED APPROXIMATELY (80 + 172) CYCLES THEN // Total cycles for Mode 2 + Mode 3
 				{
-					ppu_state.current_mode = PPU_MODE_OAM_SCAN;// CHANGE PPU's current_mode TO OAM_SCAN_MODE (Mode 2) // Start the next scanline
-						// TODO (Future): Check if Mode 0 interrupts are enabled in STAT, and if so, trigger one.
+					// Draw the CURRENT_SCANLINE into a row of ppu_state.screen_buffer.
+					ppu_render_scanline(gb);
+					ppu_enter_mode(gb, PPU_MODE_HBLANK); //CHANGE PPU's current_mode TO H_BLANK_MODE (Mode 0)
+					mode_changed = myTrue;
 				}
-				else // internal_LY_counter has reached 144, meaning V-Blank starts
+			}
+			else if(gb->ppu_state.current_mode == PPU_MODE_HBLANK)// ELSE IF PPU's current_mode IS H_BLANK_MODE (Mode 0)
+			{
+				if (gb->ppu_state.cycles_on_scanline >= PPU_SCANLINE_CYCLES) //IF PPU's internal_scanline_cycle_counter HAS REACHED APPROXIMATELY 456 CYCLES THEN // Total cycles for a full visible scanline
 				{
-					ppu_state.current_mode = PPU_MODE_VBLANK; //CHANGE PPU's current_mode TO V_BLANK_MODE (Mode 1)
-					// TODO (Future): Trigger a V-Blank Interrupt (set the V-Blank bit in the MMU's Interrupt Flag register).
-					// TODO (Future): Check if Mode 1 interrupts are enabled in STAT, and if so, trigger one.
+					gb->ppu_state.internal_ly_counter += 1; //INCREMENT THE PPU's internal_LY_counter (scanline counter)
+					gb->ppu_state.cycles_on_scanline -= PPU_SCANLINE_CYCLES; // Carry any excess into the next line
+					ppu_check_lyc_interrupt(gb);
+
+					if (gb->ppu_state.internal_ly_counter < 144)	//IF internal_LY_counter IS LESS THAN 144 THEN // Still rendering visible lines (0-143)
+					{
+						ppu_enter_mode(gb, PPU_MODE_OAM_SCAN);// CHANGE PPU's current_mode TO OAM_SCAN_MODE (Mode 2) // Start the next scanline
+					}
+					else // internal_LY_counter has reached 144, meaning V-Blank starts
+					{
+						ppu_request_interrupt(gb, MMU_INTERRUPT_FLAG_VBLANK);
+						cpu_idle_end_frame(gb);
+						cartridge_end_frame(gb);
+						gb->ppu_state.frame_ready = myTrue;
+						ppu_enter_mode(gb, PPU_MODE_VBLANK); //CHANGE PPU's current_mode TO V_BLANK_MODE (Mode 1)
+					}
+
+					mode_changed = myTrue;
 				}
 			}
-		}
 
-		else if (ppu_state.current_mode == PPU_MODE_VBLANK)//ELSE IF PPU's current_mode IS V_BLANK_MODE (Mode 1):
-		{
-			if (ppu_state.cycles_on_scanline >= 456) //IF PPU's internal_scanline_cycle_counter HAS REACHED APPROXIMATELY 456 CYCLES THEN // Each V-Blank line also takes 456 cycles
+			else if (gb->ppu_state.current_mode == PPU_MODE_VBLANK)//ELSE IF PPU's current_mode IS V_BLANK_MODE (Mode 1):
 			{
-				ppu_state.internal_ly_counter += 1; //INCREMENT THE PPU's internal_LY_counter
-				ppu_state.cycles_on_scanline = 0;//RESET PPU's internal_scanline_cycle_counter TO ZERO
-
-				if (ppu_state.internal_ly_counter > 153) //IF internal_LY_counter IS GREATER THAN 153 THEN // End of V-Blank (LY reaches 154)
+				if (gb->ppu_state.cycles_on_scanline >= PPU_SCANLINE_CYCLES) //IF PPU's internal_scanline_cycle_counter HAS REACHED APPROXIMATELY 456 CYCLES THEN // Each V-Blank line also takes 456 cycles
 				{
-					ppu_state.internal_ly_counter = 0; //RESET internal_LY_counter TO ZERO // Start a new frame, scanline counter back to 0
-					ppu_state.current_mode = PPU_MODE_OAM_SCAN;//CHANGE PPU's current_mode TO OAM_SCAN_MODE (Mode 2) // Start rendering the first line of the new frame
+					gb->ppu_state.internal_ly_counter += 1; //INCREMENT THE PPU's internal_LY_counter
+					gb->ppu_state.cycles_on_scanline -= PPU_SCANLINE_CYCLES;
+
+					if (gb->ppu_state.internal_ly_counter > 153) //IF internal_LY_counter IS GREATER THAN 153 THEN // End of V-Blank (LY reaches 154)
+					{
+						gb->ppu_state.internal_ly_counter = 0; //RESET internal_LY_counter TO ZERO // Start a new frame, scanline counter back to 0
+						ppu_enter_mode(gb, PPU_MODE_OAM_SCAN);//CHANGE PPU's current_mode TO OAM_SCAN_MODE (Mode 2) // Start rendering the first line of the new frame
+					}
+
+					ppu_check_lyc_interrupt(gb);
+					mode_changed = myTrue;
 				}
 			}
-		}
+		} while (mode_changed);
 
 		// 3. Check for LY=LYC Match Condition:
 		//    (This check should ideally happen frequently, or after LY increments)
-		uint8_t current_LY_value = ppu_state.internal_ly_counter; //GET current_LY_value (from PPU's internal counter)
-		uint8_t LYC_value = mmu_read_byte(PPU_REGISTER_LYC_ADDRESS); //GET LYC_value (from MMU by reading PPU_REGISTER_LYC_ADDRESS)
+		uint8_t current_LY_value = gb->ppu_state.internal_ly_counter; //GET current_LY_value (from PPU's internal counter)
+		uint8_t LYC_value = MMU_IO_REGISTER(gb, PPU_REGISTER_LYC_ADDRESS); //GET LYC_value (straight from the register's storage)
 
 		// At the very end of ppu_step
-		uint8_t current_stat_in_memory = mmu_read_byte(PPU_REGISTER_STAT_ADDRESS);
+		uint8_t current_stat_in_memory = MMU_IO_REGISTER(gb, PPU_REGISTER_STAT_ADDRESS);
 
 		// Preserve CPU-writable bits (interrupt enables)
 		uint8_t preserved_cpu_bits = current_stat_in_memory & PPU_REGISTER_STAT_WRITABLE_MASK;
 
 		// Get PPU-controlled mode bits
-		uint8_t ppu_mode_bits = (uint8_t)ppu_state.current_mode; // Assuming PPU_MODE_... are 0, 1, 2, 3
+		uint8_t ppu_mode_bits = (uint8_t)gb->ppu_state.current_mode; // Assuming PPU_MODE_... are 0, 1, 2, 3
 
 		// Get LYC=LY flag bit
 		uint8_t lyc_ly_flag = (current_LY_value == LYC_value) ? PPU_STAT_LYC_LC_FLAG : 0x00;
@@ -188,11 +253,45 @@ void ppu_step(uint32_t cpu_cycles_executed_this_turn)
 		// Combine all to form the new STAT byte
 		uint8_t new_stat_value = preserved_cpu_bits | ppu_mode_bits | lyc_ly_flag;
 
-		// Write the new STAT value back to memory
-		mmu_write_byte(PPU_REGISTER_STAT_ADDRESS, new_stat_value);
+		// Write the new STAT value back to memory. A CPU write would keep the
+		// old mode bits, so this goes to the register's storage directly.
+		MMU_IO_REGISTER(gb, PPU_REGISTER_STAT_ADDRESS) = new_stat_value;
+
+
+	}
+}
+
+uint32_t ppu_cycles_until_next_event(gb_t *gb)
+{
+	uint32_t mode_end_cycles;
+	uint32_t cycles_left = 0;
+
+	if (gb->ppu_state.lcd_enabled == myTrue)
+	{
+		if (gb->ppu_state.current_mode == PPU_MODE_OAM_SCAN)
+		{
+			mode_end_cycles = PPU_OAM_SCAN_END_CYCLES;
+		}
+		else if (gb->ppu_state.current_mode == PPU_MODE_DRAWING)
+		{
+			mode_end_cycles = PPU_DRAWING_END_CYCLES;
+		}
+		else
+		{
+			mode_end_cycles = PPU_SCANLINE_CYCLES;
+		}
 
+		cycles_left = (gb->ppu_state.cycles_on_scanline < mode_end_cycles) ? (mode_end_cycles - gb->ppu_state.cycles_on_scanline) : 1;
+	}
 
+	// The end of an OAM DMA transfer is an event too.
+	if (gb->ppu_state.dma_active == myTrue && gb->ppu_state.dma_cycles_left > 0
+		&& (cycles_left == 0 || gb->ppu_state.dma_cycles_left < cycles_left))
+	{
+		cycles_left = gb->ppu_state.dma_cycles_left;
 	}
+
+	return cycles_left;
 }
 
 void ppu_decode_palette(uint8_t palette_data_register_value, uint32_t *target_palette_array)
@@ -220,251 +319,405 @@ void ppu_decode_palette(uint8_t palette_data_register_value, uint32_t *target_pa
     }
 }
 
-void ppu_render_scanline(void)
+// ----------------------------------------------------------------------
+// Tile Cache
+// ----------------------------------------------------------------------
+void ppu_tile_cache_flush(gb_t *gb)
+{
+	memset(gb->ppu_tile_cache.dirty, 1, sizeof(gb->ppu_tile_cache.dirty));
+	gb->ppu_tile_cache.any_dirty = myTrue;
+}
+
+// Splits the two bitplanes of each row into one colour index per pixel.
+// With SSE2 two rows are decoded per vector: each plane byte is spread
+// over eight lanes and tested against one bit per lane. Elsewhere the
+// bits are taken one at a time.
+static void ppu_tile_decode(gb_t *gb, uint16_t tile)
+{
+	const uint8_t *data = gb->v_ram + (uint32_t)tile * PPU_TILE_BYTES;
+	uint8_t *rows = &gb->ppu_tile_cache.rows[tile][0][0];
+	uint8_t *flipped_rows = &gb->ppu_tile_cache.flipped_rows[tile][0][0];
+
+#if defined(__SSE2__)
+	const __m128i low_byte_mask = _mm_set1_epi16(0x00FF);
+	const __m128i pixel_bits = _mm_set_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+											0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80);
+	const __m128i flipped_pixel_bits = _mm_set_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+													(char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i two = _mm_set1_epi8(2);
+	__m128i tile_bytes = _mm_loadu_si128((const __m128i *)data);
+
+	// Plane bytes of rows 0-7, each doubled: l0 l0 l1 l1 ... l7 l7.
+	__m128i low_planes = _mm_packus_epi16(_mm_and_si128(tile_bytes, low_byte_mask), tile_bytes);
+	__m128i high_planes = _mm_packus_epi16(_mm_srli_epi16(tile_bytes, 8), tile_bytes);
+	low_planes = _mm_unpacklo_epi8(low_planes, low_planes);
+	high_planes = _mm_unpacklo_epi8(high_planes, high_planes);
+
+	for (uint8_t half = 0; half < 2; half++)
+	{
+		// Rows 4 * half to 4 * half + 3, each plane byte in four lanes.
+		__m128i low_quad = half ? _mm_unpackhi_epi16(low_planes, low_planes) : _mm_unpacklo_epi16(low_planes, low_planes);
+		__m128i high_quad = half ? _mm_unpackhi_epi16(high_planes, high_planes) : _mm_unpacklo_epi16(high_planes, high_planes);
+
+		for (uint8_t pair = 0; pair < 2; pair++)
+		{
+			// Two rows, each plane byte in eight lanes.
+			__m128i low_row = pair ? _mm_unpackhi_epi32(low_quad, low_quad) : _mm_unpacklo_epi32(low_quad, low_quad);
+			__m128i high_row = pair ? _mm_unpackhi_epi32(high_quad, high_quad) : _mm_unpacklo_epi32(high_quad, high_quad);
+			uint8_t offset = (uint8_t)((half * 4 + pair * 2) * PPU_TILE_SIZE);
+
+			__m128i colour_ids = _mm_or_si128(
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(low_row, pixel_bits), pixel_bits), one),
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(high_row, pixel_bits), pixel_bits), two));
+			__m128i flipped_colour_ids = _mm_or_si128(
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(low_row, flipped_pixel_bits), flipped_pixel_bits), one),
+				_mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(high_row, flipped_pixel_bits), flipped_pixel_bits), two));
+
+			_mm_storeu_si128((__m128i *)(rows + offset), colour_ids);
+			_mm_storeu_si128((__m128i *)(flipped_rows + offset), flipped_colour_ids);
+		}
+	}
+#else
+	for (uint8_t row = 0; row < PPU_TILE_SIZE; row++)
+	{
+		uint8_t low_plane = data[row * 2];
+		uint8_t high_plane = data[row * 2 + 1];
+
+		for (uint8_t column = 0; column < PPU_TILE_SIZE; column++)
+		{
+			uint8_t bit = 7 - column;
+			uint8_t colour_id = (uint8_t)(((low_plane >> bit) & 1) | (((high_plane >> bit) & 1) << 1));
+
+			rows[row * PPU_TILE_SIZE + column] = colour_id;
+			flipped_rows[row * PPU_TILE_SIZE + 7 - column] = colour_id;
+		}
+	}
+#endif
+}
+
+// Brings the tiles written since the last line up to date.
+static void ppu_tile_cache_update(gb_t *gb)
+{
+	ppu_tile_cache_t *cache = &gb->ppu_tile_cache;
+
+	if (!cache->any_dirty)
+	{
+		return;
+	}
+
+	for (uint16_t tile = 0; tile < PPU_TILE_COUNT; tile++)
+	{
+		if (cache->dirty[tile])
+		{
+			ppu_tile_decode(gb, tile);
+			cache->dirty[tile] = 0;
+		}
+	}
+
+	cache->any_dirty = myFalse;
+}
+
+// ----------------------------------------------------------------------
+// Scanline Rendering
+// Each layer writes colour indices into a line buffer, copying whole
+// tile rows out of the tile cache; the palettes turn them into pixels
+// as the last step.
+//
+// The LCDC bits that pick tile maps, tile numbering and sprite size are
+// compiled in: every combination has its own layer function, generated
+// by the macros below, and ppu_render_scanline picks them from tables
+// once per line. Registers and VRAM are read straight from the arena.
+// ----------------------------------------------------------------------
+
+typedef void (*ppu_layer_renderer_t)(gb_t *gb, uint8_t current_scanline_y, uint8_t *colour_ids);
+typedef void (*ppu_map_row_drawer_t)(gb_t *gb, const uint8_t *map_row, uint8_t map_x, uint8_t tile_row,
+									 uint8_t *colour_ids, uint8_t screen_x);
+
+// Looks count colour indices up in palette. AVX2 does eight pixels per
+// permute with the palette in a register; SSE2 builds four at a time by
+// masking each palette entry with a compare against its index.
+static void ppu_apply_palette(const uint8_t *colour_ids, const uint32_t *palette, uint32_t *pixels, uint8_t count)
+{
+	uint8_t x = 0;
+
+#if defined(__AVX2__)
+	const __m256i palette_lanes = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)palette));
+
+	for (; x + 8 <= count; x += 8)
+	{
+		__m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(colour_ids + x)));
+		_mm256_storeu_si256((__m256i *)(pixels + x), _mm256_permutevar8x32_epi32(palette_lanes, indices));
+	}
+#elif defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i colour_0 = _mm_set1_epi32((int)palette[0]);
+	const __m128i colour_1 = _mm_set1_epi32((int)palette[1]);
+	const __m128i colour_2 = _mm_set1_epi32((int)palette[2]);
+	const __m128i colour_3 = _mm_set1_epi32((int)palette[3]);
+
+	for (; x + 8 <= count; x += 8)
+	{
+		__m128i indices = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(colour_ids + x)), zero);
+
+		for (uint8_t half = 0; half < 2; half++)
+		{
+			__m128i lanes = half ? _mm_unpackhi_epi16(indices, zero) : _mm_unpacklo_epi16(indices, zero);
+			__m128i colours = _mm_and_si128(_mm_cmpeq_epi32(lanes, _mm_set1_epi32(0)), colour_0);
+
+			colours = _mm_or_si128(colours, _mm_and_si128(_mm_cmpeq_epi32(lanes, _mm_set1_epi32(1)), colour_1));
+			colours = _mm_or_si128(colours, _mm_and_si128(_mm_cmpeq_epi32(lanes, _mm_set1_epi32(2)), colour_2));
+			colours = _mm_or_si128(colours, _mm_and_si128(_mm_cmpeq_epi32(lanes, _mm_set1_epi32(3)), colour_3));
+			_mm_storeu_si128((__m128i *)(pixels + x + half * 4), colours);
+		}
+	}
+#endif
+
+	for (; x < count; x++)
+	{
+		pixels[x] = palette[colour_ids[x]];
+	}
+}
+// Tile a background/window tile map entry refers to: unsigned from 0x8000
+// with LCDC bit 4 set, signed from 0x9000 (the "0x8800 method") otherwise.
+#define PPU_TILE_NUMBER_8000(index)		((uint16_t)(index))
+#define PPU_TILE_NUMBER_8800(index)		((uint16_t)((PPU_TILE_DATA_SIGNED_BASE - PPU_TILE_DATA_ADDRESS) / PPU_TILE_BYTES + (int8_t)(index)))
+
+// ppu_draw_map_row_8000 / _8800: copies tile row tile_row of the map row
+// at map_row into colour_ids, from screen_x to the right edge, starting
+// map_x pixels into the map.
+#define DEFINE_DRAW_MAP_ROW(TILES) \
+	static void ppu_draw_map_row_##TILES(gb_t *gb, const uint8_t *map_row, uint8_t map_x, uint8_t tile_row, \
+										 uint8_t *colour_ids, uint8_t screen_x) \
+	{ \
+		uint8_t column = map_x / PPU_TILE_SIZE; \
+		uint8_t count = PPU_TILE_SIZE - map_x % PPU_TILE_SIZE; \
+		const uint8_t *pixels = gb->ppu_tile_cache.rows[PPU_TILE_NUMBER_##TILES(map_row[column])][tile_row] + map_x % PPU_TILE_SIZE; \
+		\
+		while (screen_x + count <= GB_SCREEN_WIDTH) \
+		{ \
+			memcpy(colour_ids + screen_x, pixels, count); \
+			screen_x += count; \
+			column = (column + 1) % PPU_TILE_MAP_WIDTH; \
+			count = PPU_TILE_SIZE; \
+			pixels = gb->ppu_tile_cache.rows[PPU_TILE_NUMBER_##TILES(map_row[column])][tile_row]; \
+		} \
+		\
+		memcpy(colour_ids + screen_x, pixels, GB_SCREEN_WIDTH - screen_x); \
+	}
+DEFINE_DRAW_MAP_ROW(8000)
+DEFINE_DRAW_MAP_ROW(8800)
+
+static void ppu_draw_background(gb_t *gb, uint8_t current_scanline_y, uint8_t *colour_ids,
+								uint16_t map_address, ppu_map_row_drawer_t draw_map_row)
+{
+    uint8_t scroll_x = MMU_IO_REGISTER(gb, PPU_REGISTER_SCX_ADDRESS);
+    uint8_t scroll_y = MMU_IO_REGISTER(gb, PPU_REGISTER_SCY_ADDRESS);
+
+    // The 256x256 background map wraps in both directions.
+    uint8_t background_map_y = (uint8_t)(current_scanline_y + scroll_y);
+    const uint8_t *map_row = &PPU_V_RAM(gb, map_address + (background_map_y / PPU_TILE_SIZE) * PPU_TILE_MAP_WIDTH);
+
+    draw_map_row(gb, map_row, scroll_x, background_map_y % PPU_TILE_SIZE, colour_ids, 0);
+}
+
+static void ppu_draw_window(gb_t *gb, uint8_t current_scanline_y, uint8_t *colour_ids,
+							uint16_t map_address, ppu_map_row_drawer_t draw_map_row)
+{
+    uint8_t window_x_pos = MMU_IO_REGISTER(gb, PPU_REGISTER_WX_ADDRESS);
+    uint8_t window_y_offset = current_scanline_y - MMU_IO_REGISTER(gb, PPU_REGISTER_WY_ADDRESS);
+    const uint8_t *map_row = &PPU_V_RAM(gb, map_address + (window_y_offset / PPU_TILE_SIZE) * PPU_TILE_MAP_WIDTH);
+
+    // WX is offset by 7: 7 puts the window's left edge at X 0, and smaller
+    // values cut its first pixels off instead.
+    if (window_x_pos >= GB_SCREEN_WIDTH + PPU_WINDOW_X_OFFSET)
+    {
+    	return;
+    }
+
+    if (window_x_pos < PPU_WINDOW_X_OFFSET)
+    {
+    	draw_map_row(gb, map_row, PPU_WINDOW_X_OFFSET - window_x_pos, window_y_offset % PPU_TILE_SIZE, colour_ids, 0);
+    }
+    else
+    {
+    	draw_map_row(gb, map_row, 0, window_y_offset % PPU_TILE_SIZE, colour_ids, window_x_pos - PPU_WINDOW_X_OFFSET);
+    }
+}
+
+// Draws the (at most ten) sprites on the line. On DMG the sprite with
+// the lower X wins where two overlap, then the one earlier in OAM.
+// tile_mask clears bit 0 of the tile index for 8x16 sprites, which use
+// the tile pair starting at the even index.
+static void ppu_draw_sprites(gb_t *gb, uint8_t current_scanline_y, const uint8_t *colour_ids,
+							 uint8_t sprite_height, uint8_t tile_mask)
+{
+    const uint8_t *line_sprites[PPU_SPRITES_PER_LINE];
+    uint8_t line_sprite_count = 0;
+    myBool pixel_taken[GB_SCREEN_WIDTH] = { myFalse };
+
+    // OAM scan: the first ten sprites (in OAM order) covering this line.
+    for (uint8_t sprite_index = 0; sprite_index < PPU_OAM_SPRITE_COUNT && line_sprite_count < PPU_SPRITES_PER_LINE; sprite_index++)
+    {
+    	const uint8_t *sprite = gb->oam + sprite_index * PPU_OAM_SPRITE_BYTES;
+    	int sprite_row = current_scanline_y + PPU_SPRITE_Y_OFFSET - sprite[0];
+
+    	if (sprite_row >= 0 && sprite_row < sprite_height)
+    	{
+    		// Insertion by X keeps earlier OAM entries ahead on ties.
+    		uint8_t position = line_sprite_count++;
+
+    		while (position > 0 && line_sprites[position - 1][1] > sprite[1])
+    		{
+    			line_sprites[position] = line_sprites[position - 1];
+    			position--;
+    		}
+
+    		line_sprites[position] = sprite;
+    	}
+    }
+
+    // Highest priority first; a pixel belongs to the first sprite that is
+    // opaque there, whether or not the background then covers it.
+    for (uint8_t entry = 0; entry < line_sprite_count; entry++)
+    {
+    	const uint8_t *sprite = line_sprites[entry];
+    	uint8_t attributes = sprite[3];
+    	uint8_t sprite_row = (uint8_t)(current_scanline_y + PPU_SPRITE_Y_OFFSET - sprite[0]);
+    	const uint32_t *palette = (attributes & PPU_OAM_ATTRIBUTE_PALETTE) ? gb->ppu_state.obj_palette_1 : gb->ppu_state.obj_palette_0;
+    	const uint8_t *pixels;
+    	uint8_t tile_index;
+    	int screen_x = sprite[1] - PPU_SPRITE_X_OFFSET;
+
+    	if (attributes & PPU_OAM_ATTRIBUTE_Y_FLIP)
+    	{
+    		sprite_row = sprite_height - 1 - sprite_row;
+    	}
+
+    	// Sprites always use the unsigned 0x8000 tile numbering.
+    	tile_index = (uint8_t)((sprite[2] & tile_mask) + sprite_row / PPU_TILE_SIZE);
+    	pixels = (attributes & PPU_OAM_ATTRIBUTE_X_FLIP)
+    			 ? gb->ppu_tile_cache.flipped_rows[tile_index][sprite_row % PPU_TILE_SIZE]
+    			 : gb->ppu_tile_cache.rows[tile_index][sprite_row % PPU_TILE_SIZE];
+
+    	for (uint8_t column = 0; column < PPU_TILE_SIZE; column++, screen_x++)
+    	{
+    		uint8_t colour_id = pixels[column];
+
+    		// Colour 0 is transparent.
+    		if (screen_x < 0 || screen_x >= GB_SCREEN_WIDTH || colour_id == 0 || pixel_taken[screen_x])
+    		{
+    			continue;
+    		}
+
+    		pixel_taken[screen_x] = myTrue;
+
+    		if (!(attributes & PPU_OAM_ATTRIBUTE_BG_PRIORITY) || colour_ids[screen_x] == 0)
+    		{
+    			gb->ppu_state.scanline_pixels[screen_x] = palette[colour_id];
+    		}
+    	}
+    }
+}
+
+// ----------------------------------------------------------------------
+// Layer Variants
+// MAP is the tile map address (9800 or 9C00), TILES the tile numbering
+// (8000 or 8800), HEIGHT the sprite height.
+// ----------------------------------------------------------------------
+
+#define DEFINE_RENDER_BACKGROUND_LAYER(MAP, TILES) \
+	static void render_background_layer_##MAP##_##TILES(gb_t *gb, uint8_t current_scanline_y, uint8_t *colour_ids) \
+	{ ppu_draw_background(gb, current_scanline_y, colour_ids, 0x##MAP, ppu_draw_map_row_##TILES); }
+DEFINE_RENDER_BACKGROUND_LAYER(9800, 8000)
+DEFINE_RENDER_BACKGROUND_LAYER(9800, 8800)
+DEFINE_RENDER_BACKGROUND_LAYER(9C00, 8000)
+DEFINE_RENDER_BACKGROUND_LAYER(9C00, 8800)
+
+#define DEFINE_RENDER_WINDOW_LAYER(MAP, TILES) \
+	static void render_window_layer_##MAP##_##TILES(gb_t *gb, uint8_t current_scanline_y, uint8_t *colour_ids) \
+	{ ppu_draw_window(gb, current_scanline_y, colour_ids, 0x##MAP, ppu_draw_map_row_##TILES); }
+DEFINE_RENDER_WINDOW_LAYER(9800, 8000)
+DEFINE_RENDER_WINDOW_LAYER(9800, 8800)
+DEFINE_RENDER_WINDOW_LAYER(9C00, 8000)
+DEFINE_RENDER_WINDOW_LAYER(9C00, 8800)
+
+#define DEFINE_RENDER_SPRITE_LAYER(HEIGHT, TILE_MASK) \
+	static void render_sprite_layer_##HEIGHT(gb_t *gb, uint8_t current_scanline_y, uint8_t *colour_ids) \
+	{ ppu_draw_sprites(gb, current_scanline_y, colour_ids, HEIGHT, TILE_MASK); }
+DEFINE_RENDER_SPRITE_LAYER(8, 0xFF)
+DEFINE_RENDER_SPRITE_LAYER(16, 0xFE)
+
+// [tile map select][tile data select], as set in LCDC.
+static const ppu_layer_renderer_t ppu_background_layer_table[2][2] =
+{
+	{ render_background_layer_9800_8800, render_background_layer_9800_8000 },
+	{ render_background_layer_9C00_8800, render_background_layer_9C00_8000 }
+};
+
+static const ppu_layer_renderer_t ppu_window_layer_table[2][2] =
+{
+	{ render_window_layer_9800_8800, render_window_layer_9800_8000 },
+	{ render_window_layer_9C00_8800, render_window_layer_9C00_8000 }
+};
+
+// [sprite size select]
+static const ppu_layer_renderer_t ppu_sprite_layer_table[2] =
+{
+	render_sprite_layer_8,
+	render_sprite_layer_16
+};
+
+void ppu_render_scanline(gb_t *gb)
 {
     // The current scanline we are rendering. This value comes from ppu_state.
-    uint8_t current_scanline_y = ppu_state.internal_ly_counter;
+    uint8_t current_scanline_y = gb->ppu_state.internal_ly_counter;
 
     // Check the LCDC register to see what we need to render.
-    uint8_t lcdc_register = mmu_read_byte(PPU_REGISTER_LCDC_ADDRESS);
+    uint8_t lcdc_register = MMU_IO_REGISTER(gb, PPU_REGISTER_LCDC_ADDRESS);
+    uint8_t tile_data_select = (lcdc_register & PPU_LCDC_BG_WINDOW_TILE_SELECT) ? 1 : 0;
+
+    // Background colour index of each pixel, which sprite priority looks at.
+    uint8_t colour_ids[GB_SCREEN_WIDTH];
+
+    ppu_tile_cache_update(gb);
 
     // Check if BG and Window layers are enabled.
     if (lcdc_register & PPU_LCDC_BG_DISPLAY_PRIORITY)
     {
         // Render the Background Layer (the base layer)
         // This is always drawn first and can be overwritten by other layers.
-    	render_background_layer_for(current_scanline_y);
+    	ppu_background_layer_table[(lcdc_register & PPU_LCDC_BG_TILE_MAP_DISPLAY_SELECT) ? 1 : 0][tile_data_select](gb, current_scanline_y, colour_ids);
 
         // Check if the Window layer is enabled.
         if (lcdc_register & PPU_LCDC_WINDOW_DISPLAY_ENABLE)
 		{
         	// Check if the Window's Y position has been reached.
-            uint8_t window_y_pos = mmu_read_byte(PPU_REGISTER_WY_ADDRESS);
+            uint8_t window_y_pos = MMU_IO_REGISTER(gb, PPU_REGISTER_WY_ADDRESS);
             if (current_scanline_y >= window_y_pos)
             {
             	// Render the Window Layer, which can overlap the background.
-				render_window_layer_for(current_scanline_y);
+            	ppu_window_layer_table[(lcdc_register & PPU_LCDC_WINDOW_TILE_MAP_SELECT) ? 1 : 0][tile_data_select](gb, current_scanline_y, colour_ids);
             }
     	}
     }
+    else
+    {
+    	// With BG off on DMG the line is blank (colour 0) under the sprites.
+    	memset(colour_ids, 0, sizeof(colour_ids));
+    }
+
+    ppu_apply_palette(colour_ids, gb->ppu_state.bg_palette, gb->ppu_state.scanline_pixels, GB_SCREEN_WIDTH);
 
     // Check if Sprites are enabled.
     if(lcdc_register & PPU_LCDC_OBJ_SPRITE_DISPLAY_ENABLE)
     {
     	// Render the Sprite Layer. Sprites are drawn on top of the BG and Window.
-    	render_sprite_layer_for(current_scanline_y);
+    	ppu_sprite_layer_table[(lcdc_register & PPU_LCDC_OBJ_SPRITE_SIZE) ? 1 : 0](gb, current_scanline_y, colour_ids);
     }
 
     // After all the layers have been drawn for this scanline,
     // copy the final pixels to the main screen buffer.
-    memcpy(ppu_state.screen_buffer + (current_scanline_y * GB_SCREEN_WIDTH), ppu_state.scanline_pixels , 4 * GB_SCREEN_WIDTH);
-
-}
-
-void render_background_layer_for(uint8_t current_scanline_y)
-{
-    // Get the current scroll positions from the MMU
-    uint8_t scroll_x = mmu_read_byte(PPU_REGISTER_SCX_ADDRESS);
-    uint8_t scroll_y = mmu_read_byte(PPU_REGISTER_SCY_ADDRESS);
-
-    // Calculate the 'y' position on the 256x256 pixel background map
-    // The modulo operation ensures we wrap around the map if scrolling goes past the edge.
-    uint8_t background_map_y = (current_scanline_y + scroll_y) % 256;
-
-    // Get the base address of the background map data from LCDC register
-    uint8_t lcdc_register = mmu_read_byte(PPU_REGISTER_LCDC_ADDRESS);
-
-    uint16_t background_map_address, tile_data_address = 0xffff;
-
-    if(lcdc_register & PPU_LCDC_BG_TILE_MAP_DISPLAY_SELECT)
-    {
-    	background_map_address = 0x9C00;
-    }
-    else
-    {
-    	background_map_address = 0x9800;
-    }
-
-    // Get the base address of the tile pattern data
-    if (lcdc_register & PPU_LCDC_BG_WINDOW_TILE_SELECT)
-	{
-    	tile_data_address = 0x8000;
-	}
-    else
-    {
-        tile_data_address = 0x8800;
-    }
-
-    // Loop through each pixel on the current scanline (0 to 159)
-    for (int p_x = 0; p_x <= 159; p_x++)
-    {
-        // Calculate the 'x' position on the background map
-        uint16_t background_map_x = (p_x + scroll_x) % 256;
-
-        // Determine which 8x8 tile we need to look at
-        // Divide by 8 to convert pixel coords to tile coords
-        uint8_t tile_x = background_map_x / 8;
-        uint8_t tile_y = background_map_y / 8;
-
-        // Find the index of the tile in the background map
-        // The background map is 32 tiles wide.
-        uint8_t tile_index = mmu_read_byte(background_map_address + (tile_y * 32) + tile_x);
-
-        // Find the 2-bit color ID of the specific pixel within that tile
-        // Remember that each row of an 8x8 tile is represented by 2 bytes of data.
-        uint16_t tile_row = background_map_y % 8;
-        uint16_t tile_column = background_map_x % 8;
-
-        // Use the tile_index to read the two bytes that define the row of pixels
-        // The address of the tile's data is calculated using the base tile_data_address + a specific offset
-        // This offset changes based on the tile_data_address, so you will need to handle that logic
-        // This is a subtle point that you will need to implement, i have left it vague for you to solve
-        uint16_t tile_start_address = tile_data_address + (tile_index * 16);
-
-        // Use bitwise logic to get the 2-bit color ID from those two bytes
-        uint8_t byte_1, byte_2;
-        byte_1 = mmu_read_byte(tile_start_address + (tile_row * 2));
-        byte_2 = mmu_read_byte(tile_start_address + (tile_row * 2) + 1);
-
-        uint8_t low_bit = (byte_1 >> (7 - tile_column )) & 1
-        uint8_t high_bit = (byte_2 >> (7 - tile column)) & 1;
-
-        // Use the bg_palette to translate the 2-bit ID into a 32-bit RGBA color
-        // The palette was already set up by your `ppu_decode_palette` function.
-        uint32_t final_colour = ppu_state.bg_palette[colour_id];
-
-        // Store the final color in the `scanline_pixels` array.
-        ppu_state.scanline_pixels[p_x] = final_colour;
-    }
-//END FUNCTION
-}
-
-void render_window_layer_for(uint8_t current_scanline_y)
-{//FUNCTION render_window_layer_for(current_scanline_y):
-//    // Get the current window position from the MMU
-//    window_x_pos = mmu_read_byte(PPU_REGISTER_WX_ADDRESS)
-//    window_y_pos = mmu_read_byte(PPU_REGISTER_WY_ADDRESS)
-//
-//    // The Window's Y position is a simple check. We already did this check
-//    // in the main render function, so we don't need to do it again here.
-//
-//    // Determine the base address of the Window's tile map
-//    lcdc_register = mmu_read_byte(PPU_REGISTER_LCDC_ADDRESS)
-//    IF (lcdc_register BITWISE AND PPU_LCDC_WINDOW_TILE_MAP_DISPLAY_SELECT_FLAG):
-//        window_map_address = 0x9C00
-//    ELSE:
-//        window_map_address = 0x9800
-//    END IF
-//
-//    // Get the base address of the tile pattern data
-//    IF (lcdc_register BITWISE AND PPU_LCDC_BG_WINDOW_TILE_SELECT_FLAG):
-//        tile_data_address = 0x8000
-//    ELSE:
-//        tile_data_address = 0x8800
-//    END IF
-//
-//    // The Game Boy's Window has a small quirk: WX is offset by 7.
-//    // A value of 7 means the Window starts at X position 0.
-//    start_x_on_screen = window_x_pos - 7
-//
-//    // Track the pixel 'y' within the window itself, starting from 0.
-//    window_y_offset = current_scanline_y - window_y_pos
-//
-//    // Loop through each pixel on the scanline, but only draw inside the window's area.
-//    FOR pixel_x FROM start_x_on_screen TO 159:
-//        // Calculate the 'x' position within the window, starting from 0.
-//        window_x_offset = pixel_x - start_x_on_screen
-//
-//        // Determine the tile coordinates within the window map.
-//        // Divide by 8 to convert pixel coords to tile coords.
-//        tile_x = window_x_offset / 8
-//        tile_y = window_y_offset / 8
-//
-//        // Find the index of the tile in the window map.
-//        tile_index = mmu_read_byte(window_map_address + (tile_y * 32) + tile_x)
-//
-//        // Find the 2-bit color ID of the specific pixel within that tile.
-//        // This logic is the same as the background layer.
-//        tile_row = window_y_offset MODULO 8
-//        tile_column = window_x_offset MODULO 8
-//
-//        // Use the tile_index to read the two bytes that define the row of pixels
-//        // The address of the tile's data is calculated using the base tile_data_address + a specific offset
-//        // This is a subtle point that you will need to implement, i have left it vague for you to solve
-//
-//        // Use bitwise logic to get the 2-bit color ID from those two bytes.
-//
-//        // Use the bg_palette to translate the 2-bit ID into a 32-bit RGBA color.
-//        final_color = ppu_state.bg_palette[color_id]
-//
-//        // Overwrite the background pixels at this position with the window's pixel color.
-//        ppu_state.scanline_pixels[pixel_x] = final_color
-//
-//    END FOR
-//END FUNCTION
-}
+    memcpy(gb->ppu_state.screen_buffer + (current_scanline_y * GB_SCREEN_WIDTH), gb->ppu_state.scanline_pixels , 4 * GB_SCREEN_WIDTH);
 
-void render_sprite_layer_for(uint8_t current_scanline_y)
-{
-//FUNCTION render_sprite_layer_for(current_scanline_y):
-//	// Get the sprite height (8x8 or 8x16) from the LCDC register.
-//	lcdc_register = mmu_read_byte(PPU_REGISTER_LCDC_ADDRESS)
-//	sprite_height = (lcdc_register BITWISE AND PPU_LCDC_OBJ_SPRITE_SIZE) ? 16 : 8
-//
-//	// There are 40 possible sprites, stored in OAM from 0xFE00 to 0xFE9F.
-//	// Each sprite is 4 bytes of data.
-//	FOR sprite_index FROM 0 TO 39:
-//		// Get the sprite's 4 bytes of data from OAM.
-//		sprite_data_address = 0xFE00 + (sprite_index * 4)
-//		sprite_y_pos = mmu_read_byte(sprite_data_address + 0)
-//		sprite_x_pos = mmu_read_byte(sprite_data_address + 1)
-//		tile_index = mmu_read_byte(sprite_data_address + 2)
-//		sprite_flags = mmu_read_byte(sprite_data_address + 3)
-//
-//		// Check if the sprite is on the current scanline.
-//		// Sprites are positioned at Y-16 on the screen.
-//		IF (current_scanline_y >= (sprite_y_pos - 16) AND current_scanline_y < (sprite_y_pos - 16 + sprite_height)):
-//			// This sprite is visible on the current line. Now we render its pixels.
-//
-//			// Get the tile data from VRAM. Sprites always use the 0x8000 tile data address space.
-//			tile_data_address = 0x8000
-//
-//			// Apply vertical flip logic.
-//			// This is a subtle point. If the sprite is flipped vertically, you need to
-//			// access its tile data in reverse. For example, if a sprite is 8 pixels tall,
-//			// pixel row 0 on the screen corresponds to row 7 in the tile data.
-//			// You will need to use a bitwise AND on the sprite_flags and check a specific bit.
-//
-//			// Loop through each pixel column of the sprite (0 to 7)
-//			FOR sprite_pixel_x FROM 0 TO 7:
-//				// Apply horizontal flip logic.
-//				// This is a subtle point. If the sprite is flipped horizontally, you need to
-//				// access its tile data from right-to-left.
-//
-//				// Get the 2-bit color ID of the pixel from the tile data.
-//
-//				// Check for transparency.
-//				// Color ID 0 is always transparent for sprites. Do not draw this pixel.
-//				IF color_id IS NOT 0:
-//					// Use the sprite_flags to determine which palette to use (OBP0 or OBP1).
-//					// This is a bitwise AND on the sprite_flags and a specific bit.
-//
-//					// Check for sprite priority.
-//					// If the sprite has low priority, it can be drawn behind the background/window.
-//					// This is also a bitwise AND on the sprite_flags and a specific bit.
-//
-//					// If the sprite has high priority, just draw it.
-//					// If the sprite has low priority, check if the background pixel at this
-//					// location is non-white (color ID 0). If it is, DO NOT draw the sprite.
-//
-//					// Use the correct palette to get the final RGBA color.
-//					final_color = ppu_state.obj_palette_[0/1][color_id]
-//
-//					// Overwrite the pixel in the scanline_pixels array.
-//					ppu_state.scanline_pixels[sprite_x_pos + sprite_pixel_x] = final_color
-//				END IF
-//			END FOR
-//		END IF
-//	END FOR
-//END FUNCTION
 }
@@ -12,6 +12,11 @@
 #include "..\headers\mystdbool.h"
 #include "..\BitOps\bit_macros.h"
 
+#ifndef GB_T_DECLARED
+#define GB_T_DECLARED
+typedef struct gb_s gb_t;
+#endif
+
 // Default Power-On Values for PPU Registers
 #define PPU_DEFAULT_LCDC_VALUE  (0x91)
 #define PPU_DEFAULT_STAT_VALUE  (0x02)
@@ -25,10 +30,41 @@
 #define PPU_DEFAULT_WY_VALUE    (0x00)
 #define PPU_DEFAULT_WX_VALUE    (0x00)
 
+// Scanline timing (T-cycles from the start of the line)
+#define PPU_OAM_SCAN_END_CYCLES		(80)	// Mode 2 -> Mode 3
+#define PPU_DRAWING_END_CYCLES		(252)	// Mode 3 -> Mode 0 (80 + 172)
+#define PPU_SCANLINE_CYCLES			(456)	// Mode 0/1 -> next line
+#define PPU_FRAME_CYCLES			(PPU_SCANLINE_CYCLES * 154)	// 144 visible + 10 V-Blank lines
+
 // And the pixel dimensions for your screen_buffer
 #define GB_SCREEN_WIDTH   (160)
 #define GB_SCREEN_HEIGHT  (144)
 
+// VRAM layout: 384 tiles of 8x8 2-bit pixels (16 bytes, two bitplanes
+// per row), then the two 32x32 tile maps.
+#define PPU_TILE_DATA_ADDRESS			(0x8000)
+#define PPU_TILE_DATA_SIGNED_BASE		(0x9000)	// Tile 0 when LCDC bit 4 is clear
+#define PPU_TILE_DATA_ADDRESS_END		(0x97FF)
+#define PPU_TILE_MAP_0_ADDRESS			(0x9800)
+#define PPU_TILE_MAP_1_ADDRESS			(0x9C00)
+#define PPU_TILE_MAP_WIDTH				(32)
+#define PPU_TILE_SIZE					(8)
+#define PPU_TILE_BYTES					(16)
+#define PPU_TILE_COUNT					(384)
+
+// Sprites (OAM entries)
+#define PPU_OAM_SPRITE_COUNT			(40)
+#define PPU_OAM_SPRITE_BYTES			(4)		// Y, X, tile, attributes
+#define PPU_SPRITES_PER_LINE			(10)
+#define PPU_SPRITE_Y_OFFSET				(16)
+#define PPU_SPRITE_X_OFFSET				(8)
+#define PPU_WINDOW_X_OFFSET				(7)
+
+#define PPU_OAM_ATTRIBUTE_BG_PRIORITY	BIT(7)	// BG colours 1-3 cover the sprite
+#define PPU_OAM_ATTRIBUTE_Y_FLIP		BIT(6)
+#define PPU_OAM_ATTRIBUTE_X_FLIP		BIT(5)
+#define PPU_OAM_ATTRIBUTE_PALETTE		BIT(4)	// OBP1 instead of OBP0
+
 
 // LCDC 0XFF40 BYTE MAP
 #define PPU_LCDC_LCD_PPU_ENABLE 			BIT(7)
@@ -67,6 +103,7 @@ typedef struct
 	uint8_t internal_ly_counter; 	// PPU's internal counter for the current scanline (LY register value)
 	uint8_t current_lyc_value;
 	myBool lcd_enabled;
+	myBool frame_ready;				// Set on entering V-Blank, cleared by whoever consumes the frame
 
     // Decoded palettes for faster lookups during rendering
 	uint32_t bg_palette[4];			// Decoded colors for background/window
@@ -76,12 +113,38 @@ typedef struct
     // DMA transfer state
     myBool dma_active;				// True if an OAM DMA transfer is currently in progress
     uint16_t dma_cycles_left;		// Cycles remaining for the current DMA transfer
+    uint8_t dma_source_page;		// High byte of the source address (after the echo fold)
+    uint8_t dma_bytes_copied;		// Bytes already in OAM (all of them unless MMU_DMA_ACCURATE)
 
     // Pixel buffers
 	uint32_t screen_buffer[GB_SCREEN_WIDTH * GB_SCREEN_HEIGHT];	// The full screen frame buffer
     uint32_t scanline_pixels[GB_SCREEN_WIDTH];					// Temporary buffer for the current scanline being rendered
 } ppu_state_t;
 
+// ----------------------------------------------------------------------
+// Tile Cache
+// Every tile in VRAM bank 0, kept as one colour index (0-3) per pixel,
+// each row left to right and again right to left for X-flipped sprites.
+// The MMU sends writes to 0x8000-0x97FF through its handler, which marks
+// the tile dirty; dirty tiles are decoded again before the next line is
+// drawn, so the renderer only ever copies ready rows. Host state, rebuilt
+// from VRAM after a restore.
+// ----------------------------------------------------------------------
+typedef struct
+{
+	uint8_t rows[PPU_TILE_COUNT][PPU_TILE_SIZE][PPU_TILE_SIZE];
+	uint8_t flipped_rows[PPU_TILE_COUNT][PPU_TILE_SIZE][PPU_TILE_SIZE];
+	uint8_t dirty[PPU_TILE_COUNT];
+	myBool any_dirty;
+} ppu_tile_cache_t;
+
+// offset is from 0x8000 and inside the tile data.
+#define PPU_TILE_CACHE_NOTE_WRITE(gb, offset) \
+	do { \
+		(gb)->ppu_tile_cache.dirty[(offset) / PPU_TILE_BYTES] = 1; \
+		(gb)->ppu_tile_cache.any_dirty = myTrue; \
+	} while (0)
+
 
 // DECLARE the palettes here using extern
 extern const uint32_t CLASSIC_GREEN_PALETTE[4];
@@ -89,9 +152,16 @@ extern const uint32_t CLASSIC_GRAYSCALE_PALETTE[4];
 extern const uint32_t MODERN_VIBRANT_PALETTE[4];
 extern const uint32_t MODERN_PURPLE_PALETTE[4];
 
-extern ppu_state_t ppu_state;
-void ppu_init(void);
-void ppu_step(uint32_t cpu_cycles_executed_this_turn);
+void ppu_init(gb_t *gb);
+void ppu_step(gb_t *gb, uint32_t cpu_cycles_executed_this_turn);
 void ppu_decode_palette(uint8_t palette_data_register_value, uint32_t *target_palette_array);
 
+// T-cycles until the PPU next changes mode or an OAM DMA transfer ends,
+// i.e. the next point at which it could raise an interrupt.
+// Returns 0 when nothing is scheduled (LCD off and no DMA running).
+uint32_t ppu_cycles_until_next_event(gb_t *gb);
+
+// Marks every tile for decoding (VRAM was replaced wholesale).
+void ppu_tile_cache_flush(gb_t *gb);
+
 #endif /* COMPONENTS_PPU_H_ */
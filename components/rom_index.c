@@ -0,0 +1,592 @@
+/*
+ * rom_index.c
+ *
+ * ROM library scanning and the on-disk index.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "..\headers\mystdbool.h"
+
+#include "rom_index.h"
+#include "cartridge.h"
+
+#if ROM_INDEX_SCAN_SUPPORTED
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#endif
+
+#if CARTRIDGE_MMAP_SUPPORTED
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+_Static_assert(sizeof(rom_index_entry_t) == 48, "rom_index_entry_t is written to disk as it is");
+
+#define ROM_INDEX_FNV_OFFSET_BASIS			(0xCBF29CE484222325ULL)
+#define ROM_INDEX_FNV_PRIME					(0x00000100000001B3ULL)
+
+uint64_t rom_index_hash(const uint8_t *data, uint32_t size)
+{
+	uint64_t hash = ROM_INDEX_FNV_OFFSET_BASIS;
+
+	for (uint32_t index = 0; index < size; index++)
+	{
+		hash = (hash ^ data[index]) * ROM_INDEX_FNV_PRIME;
+	}
+
+	return hash;
+}
+
+void rom_index_free(rom_index_t *index)
+{
+	free(index->entries);
+	free(index->paths);
+	memset(index, 0, sizeof(*index));
+}
+
+// ----------------------------------------------------------------------
+// Lookup
+// ----------------------------------------------------------------------
+const rom_index_entry_t *rom_index_find(const rom_index_t *index, uint64_t content_hash)
+{
+	uint32_t low = 0;
+	uint32_t high = index->entry_count;
+
+	while (low < high)
+	{
+		uint32_t middle = low + (high - low) / 2;
+
+		if (index->entries[middle].content_hash < content_hash)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	if (low < index->entry_count && index->entries[low].content_hash == content_hash)
+	{
+		return &index->entries[low];
+	}
+
+	return NULL;
+}
+
+const char *rom_index_path(const rom_index_t *index, const rom_index_entry_t *entry)
+{
+	return index->paths + entry->path_offset;
+}
+
+// ----------------------------------------------------------------------
+// Index File
+// ----------------------------------------------------------------------
+myBool rom_index_save(const rom_index_t *index, const char *filename)
+{
+	uint32_t file_header[4] = { ROM_INDEX_MAGIC, ROM_INDEX_VERSION, index->entry_count, index->paths_size };
+	FILE *file = fopen(filename, "wb");
+	myBool written;
+
+	if (file == NULL)
+	{
+		printf("Error: Could not open ROM index file %s for writing.\n", filename);
+		return myFalse;
+	}
+
+	written = (fwrite(file_header, sizeof(file_header), 1, file) == 1
+			   && fwrite(index->entries, sizeof(rom_index_entry_t), index->entry_count, file) == index->entry_count
+			   && fwrite(index->paths, 1, index->paths_size, file) == index->paths_size) ? myTrue : myFalse;
+
+	if (fclose(file) != 0 || !written)
+	{
+		printf("Error: Could not write ROM index file %s.\n", filename);
+		return myFalse;
+	}
+
+	return myTrue;
+}
+
+myBool rom_index_load(rom_index_t *index, const char *filename)
+{
+	uint32_t file_header[4];
+	FILE *file;
+
+	rom_index_free(index);
+
+	file = fopen(filename, "rb");
+
+	if (file == NULL)
+	{
+		printf("Error: Could not open ROM index file: %s\n", filename);
+		return myFalse;
+	}
+
+	if (fread(file_header, sizeof(file_header), 1, file) != 1
+		|| file_header[0] != ROM_INDEX_MAGIC
+		|| file_header[1] != ROM_INDEX_VERSION)
+	{
+		printf("Error: %s is not a ROM index of this version.\n", filename);
+		fclose(file);
+		return myFalse;
+	}
+
+	index->entry_count = file_header[2];
+	index->paths_size = file_header[3];
+	index->entries = (rom_index_entry_t *)malloc((size_t)index->entry_count * sizeof(rom_index_entry_t) + 1);
+	index->paths = (char *)malloc((size_t)index->paths_size + 1);
+
+	if (index->entries == NULL || index->paths == NULL
+		|| fread(index->entries, sizeof(rom_index_entry_t), index->entry_count, file) != index->entry_count
+		|| fread(index->paths, 1, index->paths_size, file) != index->paths_size)
+	{
+		printf("Error: Could not read ROM index file: %s\n", filename);
+		fclose(file);
+		rom_index_free(index);
+		return myFalse;
+	}
+
+	fclose(file);
+
+	// Reject entries pointing outside the path table rather than trusting the file.
+	for (uint32_t entry = 0; entry < index->entry_count; entry++)
+	{
+		if ((uint64_t)index->entries[entry].path_offset + index->entries[entry].path_length >= index->paths_size
+			|| index->paths[index->entries[entry].path_offset + index->entries[entry].path_length] != '\0')
+		{
+			printf("Error: ROM index file is corrupt: %s\n", filename);
+			rom_index_free(index);
+			return myFalse;
+		}
+	}
+
+	return myTrue;
+}
+
+#if ROM_INDEX_SCAN_SUPPORTED
+// ----------------------------------------------------------------------
+// Scanning
+// The tree is walked on the calling thread (directory reads are cheap);
+// hashing and decoding, which read every byte, are shared out between
+// the worker threads one file at a time.
+// ----------------------------------------------------------------------
+typedef struct
+{
+	char *path;
+	rom_index_entry_t entry;
+	myBool indexed;
+} rom_index_file_t;
+
+typedef struct
+{
+	rom_index_file_t *files;
+	uint32_t count;
+	uint32_t capacity;
+
+	// Next file a worker should take.
+	uint32_t next;
+	pthread_mutex_t lock;
+} rom_index_scan_t;
+
+static myBool rom_index_is_rom_name(const char *name)
+{
+	const char *extension = strrchr(name, '.');
+
+	if (extension == NULL)
+	{
+		return myFalse;
+	}
+
+	extension++;
+
+	if ((extension[0] == 'g' || extension[0] == 'G') && (extension[1] == 'b' || extension[1] == 'B'))
+	{
+		return (extension[2] == '\0'
+				|| ((extension[2] == 'c' || extension[2] == 'C') && extension[3] == '\0')) ? myTrue : myFalse;
+	}
+
+	return myFalse;
+}
+
+static myBool rom_index_add_file(rom_index_scan_t *scan, char *path)
+{
+	if (scan->count == scan->capacity)
+	{
+		uint32_t capacity = scan->capacity ? scan->capacity * 2 : 256;
+		rom_index_file_t *files = (rom_index_file_t *)realloc(scan->files, capacity * sizeof(*files));
+
+		if (files == NULL)
+		{
+			return myFalse;
+		}
+
+		scan->files = files;
+		scan->capacity = capacity;
+	}
+
+	memset(&scan->files[scan->count], 0, sizeof(scan->files[scan->count]));
+	scan->files[scan->count].path = path;
+	scan->count++;
+
+	return myTrue;
+}
+
+// Adds every ROM file under directory. Subdirectories that cannot be
+// opened are skipped; only running out of memory is an error.
+static myBool rom_index_walk(rom_index_scan_t *scan, const char *directory)
+{
+	DIR *stream = opendir(directory);
+	struct dirent *item;
+	myBool ok = myTrue;
+
+	if (stream == NULL)
+	{
+		return myTrue;
+	}
+
+	while (ok && (item = readdir(stream)) != NULL)
+	{
+		struct stat item_status;
+		size_t length;
+		char *path;
+
+		if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+		{
+			continue;
+		}
+
+		length = strlen(directory) + 1 + strlen(item->d_name);
+		path = (char *)malloc(length + 1);
+
+		if (path == NULL)
+		{
+			ok = myFalse;
+			break;
+		}
+
+		snprintf(path, length + 1, "%s/%s", directory, item->d_name);
+
+		if (stat(path, &item_status) != 0)
+		{
+			free(path);
+		}
+		else if (S_ISDIR(item_status.st_mode))
+		{
+#if defined(S_ISLNK)
+			// Symlinked directories are not followed; one pointing back up would never end.
+			struct stat link_status;
+
+			if (lstat(path, &link_status) == 0 && !S_ISLNK(link_status.st_mode))
+#endif
+			{
+				ok = rom_index_walk(scan, path);
+			}
+
+			free(path);
+		}
+		else if (S_ISREG(item_status.st_mode) && rom_index_is_rom_name(item->d_name)
+				 && item_status.st_size >= CARTRIDGE_HEADER_END && item_status.st_size <= CARTRIDGE_MAX_ROM_SIZE)
+		{
+			if (!rom_index_add_file(scan, path))
+			{
+				free(path);
+				ok = myFalse;
+			}
+		}
+		else
+		{
+			free(path);
+		}
+	}
+
+	closedir(stream);
+	return ok;
+}
+
+// Maps (or reads) the file, hashes it and decodes its header.
+static void rom_index_scan_file(rom_index_file_t *file)
+{
+	cartridge_header_t header;
+	const uint8_t *image = NULL;
+	uint32_t size = 0;
+	myBool mapped = myFalse;
+
+#if CARTRIDGE_MMAP_SUPPORTED
+	{
+		struct stat file_status;
+		int file_descriptor = open(file->path, O_RDONLY);
+
+		if (file_descriptor >= 0)
+		{
+			if (fstat(file_descriptor, &file_status) == 0
+				&& file_status.st_size >= CARTRIDGE_HEADER_END && file_status.st_size <= CARTRIDGE_MAX_ROM_SIZE)
+			{
+				void *view = mmap(NULL, (size_t)file_status.st_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+
+				if (view != MAP_FAILED)
+				{
+					image = (const uint8_t *)view;
+					size = (uint32_t)file_status.st_size;
+					mapped = myTrue;
+				}
+			}
+
+			close(file_descriptor);
+		}
+	}
+#endif
+
+	if (image == NULL)
+	{
+		FILE *stream = fopen(file->path, "rb");
+		long file_size;
+		uint8_t *buffer;
+
+		if (stream == NULL)
+		{
+			return;
+		}
+
+		fseek(stream, 0, SEEK_END);
+		file_size = ftell(stream);
+		fseek(stream, 0, SEEK_SET);
+
+		if (file_size < CARTRIDGE_HEADER_END || file_size > CARTRIDGE_MAX_ROM_SIZE
+			|| (buffer = (uint8_t *)malloc((size_t)file_size)) == NULL)
+		{
+			fclose(stream);
+			return;
+		}
+
+		if (fread(buffer, 1, (size_t)file_size, stream) != (size_t)file_size)
+		{
+			free(buffer);
+			fclose(stream);
+			return;
+		}
+
+		fclose(stream);
+		image = buffer;
+		size = (uint32_t)file_size;
+	}
+
+	cartridge_read_header(image, size, &header);
+
+	file->entry.content_hash = rom_index_hash(image, size);
+	memcpy(file->entry.title, header.title, CARTRIDGE_HEADER_TITLE_LENGTH);
+	file->entry.file_size = size;
+	file->entry.ram_size = header.ram_size;
+	file->entry.type = header.type;
+	file->entry.mbc = (uint8_t)header.mbc;
+	file->entry.cgb_flag = header.cgb_flag;
+	file->entry.rom_size_code = image[CARTRIDGE_HEADER_ROM_SIZE_ADDRESS];
+	file->entry.flags = (header.header_checksum_ok ? ROM_INDEX_FLAG_HEADER_CHECKSUM_OK : 0)
+						| (header.global_checksum_ok ? ROM_INDEX_FLAG_GLOBAL_CHECKSUM_OK : 0)
+						| (header.mbc_supported ? ROM_INDEX_FLAG_MBC_SUPPORTED : 0)
+						| (header.has_battery ? ROM_INDEX_FLAG_BATTERY : 0)
+						| (header.has_rtc ? ROM_INDEX_FLAG_RTC : 0)
+						| (header.has_rumble ? ROM_INDEX_FLAG_RUMBLE : 0);
+	file->indexed = myTrue;
+
+#if CARTRIDGE_MMAP_SUPPORTED
+	if (mapped)
+	{
+		munmap((void *)image, size);
+		return;
+	}
+#endif
+
+	(void)mapped;
+	free((void *)image);
+}
+
+static void *rom_index_worker(void *argument)
+{
+	rom_index_scan_t *scan = (rom_index_scan_t *)argument;
+	uint32_t file;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&scan->lock);
+		file = scan->next++;
+		pthread_mutex_unlock(&scan->lock);
+
+		if (file >= scan->count)
+		{
+			return NULL;
+		}
+
+		rom_index_scan_file(&scan->files[file]);
+	}
+}
+
+// Content hash first, then path, so the result does not depend on which
+// thread finished first.
+static int rom_index_compare_files(const void *a, const void *b)
+{
+	const rom_index_file_t *file_a = (const rom_index_file_t *)a;
+	const rom_index_file_t *file_b = (const rom_index_file_t *)b;
+
+	if (file_a->entry.content_hash != file_b->entry.content_hash)
+	{
+		return (file_a->entry.content_hash < file_b->entry.content_hash) ? -1 : 1;
+	}
+
+	return strcmp(file_a->path, file_b->path);
+}
+
+// Packs the indexed files (already sorted) into index, one per hash.
+static myBool rom_index_collect(rom_index_t *index, const rom_index_scan_t *scan)
+{
+	uint32_t paths_size = 0;
+	uint32_t file;
+
+	for (file = 0; file < scan->count; file++)
+	{
+		paths_size += (uint32_t)strlen(scan->files[file].path) + 1;
+	}
+
+	index->entries = (rom_index_entry_t *)malloc((size_t)scan->count * sizeof(rom_index_entry_t) + 1);
+	index->paths = (char *)malloc((size_t)paths_size + 1);
+
+	if (index->entries == NULL || index->paths == NULL)
+	{
+		return myFalse;
+	}
+
+	for (file = 0; file < scan->count; file++)
+	{
+		const rom_index_file_t *source = &scan->files[file];
+		rom_index_entry_t *entry;
+		size_t length;
+
+		if (!source->indexed
+			|| (index->entry_count > 0 && index->entries[index->entry_count - 1].content_hash == source->entry.content_hash))
+		{
+			continue;
+		}
+
+		length = strlen(source->path);
+
+		if (length > UINT16_MAX)
+		{
+			continue;
+		}
+
+		entry = &index->entries[index->entry_count++];
+		*entry = source->entry;
+		entry->path_offset = index->paths_size;
+		entry->path_length = (uint16_t)length;
+		memcpy(index->paths + index->paths_size, source->path, length + 1);
+		index->paths_size += (uint32_t)length + 1;
+	}
+
+	return myTrue;
+}
+
+// Scans every file in scan on up to thread_count threads.
+static void rom_index_scan_files(rom_index_scan_t *scan, uint32_t thread_count)
+{
+	pthread_t threads[ROM_INDEX_MAX_THREADS];
+	uint32_t started = 0;
+
+	if (thread_count == 0)
+	{
+		thread_count = ROM_INDEX_DEFAULT_THREADS;
+	}
+
+	if (thread_count > ROM_INDEX_MAX_THREADS)
+	{
+		thread_count = ROM_INDEX_MAX_THREADS;
+	}
+
+	if (thread_count > scan->count)
+	{
+		thread_count = scan->count;
+	}
+
+	pthread_mutex_init(&scan->lock, NULL);
+
+	for (; started < thread_count; started++)
+	{
+		if (pthread_create(&threads[started], NULL, rom_index_worker, scan) != 0)
+		{
+			break;
+		}
+	}
+
+	// With no thread to be had, the files are scanned here instead.
+	if (started == 0)
+	{
+		rom_index_worker(scan);
+	}
+
+	for (uint32_t thread = 0; thread < started; thread++)
+	{
+		pthread_join(threads[thread], NULL);
+	}
+
+	pthread_mutex_destroy(&scan->lock);
+}
+
+myBool rom_index_build(rom_index_t *index, const char *root, uint32_t thread_count)
+{
+	rom_index_scan_t scan;
+	DIR *stream;
+	myBool ok;
+
+	rom_index_free(index);
+	memset(&scan, 0, sizeof(scan));
+
+	stream = opendir(root);
+
+	if (stream == NULL)
+	{
+		printf("Error: Could not open ROM directory: %s\n", root);
+		return myFalse;
+	}
+
+	closedir(stream);
+
+	ok = rom_index_walk(&scan, root);
+
+	if (ok)
+	{
+		rom_index_scan_files(&scan, thread_count);
+
+		if (scan.count > 0)
+		{
+			qsort(scan.files, scan.count, sizeof(*scan.files), rom_index_compare_files);
+		}
+
+		ok = rom_index_collect(index, &scan);
+	}
+
+	if (!ok)
+	{
+		printf("Error: Out of memory indexing ROM directory: %s\n", root);
+		rom_index_free(index);
+	}
+
+	for (uint32_t file = 0; file < scan.count; file++)
+	{
+		free(scan.files[file].path);
+	}
+
+	free(scan.files);
+	return ok;
+}
+#else
+myBool rom_index_build(rom_index_t *index, const char *root, uint32_t thread_count)
+{
+	(void)thread_count;
+
+	rom_index_free(index);
+	printf("Error: ROM directory scanning is not supported on this platform: %s\n", root);
+	return myFalse;
+}
+#endif
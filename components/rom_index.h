@@ -0,0 +1,96 @@
+/*
+ * rom_index.h
+ *
+ * Index of a ROM library. A directory tree is scanned once, on several
+ * threads, and the header of every .gb/.gbc file found is decoded and its
+ * contents hashed. The result is saved as one compact file, sorted by
+ * content hash, so a job can look a ROM up and check what it is without
+ * opening it again.
+ */
+
+#ifndef COMPONENTS_ROM_INDEX_H_
+#define COMPONENTS_ROM_INDEX_H_
+
+#include <stdint.h>
+#include "..\headers\mystdbool.h"
+#include "cartridge.h"
+
+// Scanning walks directories with dirent and runs on POSIX threads, so
+// it needs a POSIX-like host (MinGW included). Files are mapped for
+// hashing where mmap exists and read elsewhere. Saved indexes can be
+// loaded and searched anywhere.
+#if defined(__unix__) || defined(__APPLE__) || defined(__MINGW32__)
+#define ROM_INDEX_SCAN_SUPPORTED			(1)
+#else
+#define ROM_INDEX_SCAN_SUPPORTED			(0)
+#endif
+
+#define ROM_INDEX_DEFAULT_THREADS			(8)
+#define ROM_INDEX_MAX_THREADS				(64)
+
+// Index file: ROM_INDEX_MAGIC, ROM_INDEX_VERSION, the entry count and the
+// size of the path table (four uint32_t), then the entries, then the path
+// table. Numbers are in host byte order; an index is built and read on
+// the same kind of machine.
+#define ROM_INDEX_MAGIC						(0x58494247)	// "GBIX"
+#define ROM_INDEX_VERSION					(1)
+
+// rom_index_entry_t.flags
+#define ROM_INDEX_FLAG_HEADER_CHECKSUM_OK	BIT(0)
+#define ROM_INDEX_FLAG_GLOBAL_CHECKSUM_OK	BIT(1)
+#define ROM_INDEX_FLAG_MBC_SUPPORTED		BIT(2)
+#define ROM_INDEX_FLAG_BATTERY				BIT(3)
+#define ROM_INDEX_FLAG_RTC					BIT(4)
+#define ROM_INDEX_FLAG_RUMBLE				BIT(5)
+
+// One ROM, 48 bytes with no padding so it is written as it is.
+typedef struct
+{
+	uint64_t content_hash;				// rom_index_hash() of the whole file
+	char title[CARTRIDGE_HEADER_TITLE_LENGTH];	// NUL-padded, not terminated at full length
+	uint32_t file_size;
+	uint32_t ram_size;					// As declared in the header
+	uint32_t path_offset;				// Into rom_index_t.paths
+	uint16_t path_length;				// Without the terminating NUL
+	uint8_t type;						// Raw cartridge type byte (0x0147)
+	uint8_t mbc;						// cartridge_mbc_t
+	uint8_t cgb_flag;					// Raw byte at 0x0143
+	uint8_t rom_size_code;				// Raw byte at 0x0148
+	uint8_t flags;						// ROM_INDEX_FLAG_*
+	uint8_t reserved[5];
+} rom_index_entry_t;
+
+typedef struct
+{
+	rom_index_entry_t *entries;			// Sorted by content_hash, no duplicates
+	uint32_t entry_count;
+	char *paths;						// NUL-terminated paths, back to back
+	uint32_t paths_size;
+} rom_index_t;
+
+// 64-bit FNV-1a of size bytes.
+uint64_t rom_index_hash(const uint8_t *data, uint32_t size);
+
+// Scans root and every directory below it for .gb and .gbc files on
+// thread_count threads (0 for ROM_INDEX_DEFAULT_THREADS). Files that
+// cannot be read or are too short for a header are left out; of several
+// files with the same contents only the first path in sort order is
+// kept. Replaces whatever index held. Returns myFalse if root cannot be
+// opened, memory runs out or scanning is not supported on this host.
+myBool rom_index_build(rom_index_t *index, const char *root, uint32_t thread_count);
+
+myBool rom_index_save(const rom_index_t *index, const char *filename);
+
+// Replaces whatever index held. Returns myFalse (leaving index empty) if
+// the file is missing, truncated or from another version.
+myBool rom_index_load(rom_index_t *index, const char *filename);
+
+// Entry with that content hash, or NULL.
+const rom_index_entry_t *rom_index_find(const rom_index_t *index, uint64_t content_hash);
+
+// Path the entry was found at when the index was built.
+const char *rom_index_path(const rom_index_t *index, const rom_index_entry_t *entry);
+
+void rom_index_free(rom_index_t *index);
+
+#endif /* COMPONENTS_ROM_INDEX_H_ */